@@ -1,45 +1,733 @@
+#include <sys/random.h>
+
 #include "chat_server.h"
 
-ChatServer::Message::Message(const std::string& from, time_t time, const std::string& text):
-        JSON(std::map<std::string, JSON>(makeFields(from, time, text))) {}
+ChatServer::Settings::Settings():
+        maxHistoryCount(100000), maxHistoryBytes(64 << 20), maxTotalHistoryBytes(256 << 20), maxRooms(1000),
+        roomTimeout(7 * 24 * 60 * 60), emptyRoomTimeout(10 * 60), trackUnread(false), sessionTimeout(30 * 60) {
+    // Bursts leave room for pasting a few lines, or for a page opened in a few tabs; polls come back as often as
+    // messages are posted. Addresses get more, as many clients may share one behind a NAT
+    sessionLimits[LOGIN_ROUTE] = RateLimiter();
+    sessionLimits[POST_ROUTE] = RateLimiter(5, 20);
+    sessionLimits[POLL_ROUTE] = RateLimiter(20, 50);
+    addressLimits[LOGIN_ROUTE] = RateLimiter(2, 20);
+    addressLimits[POST_ROUTE] = RateLimiter(50, 200);
+    addressLimits[POLL_ROUTE] = RateLimiter(200, 500);
+    // A few rooms at once, then one a minute; a session can't get around it, so only addresses are limited
+    sessionLimits[NEW_ROOM] = RateLimiter();
+    addressLimits[NEW_ROOM] = RateLimiter(1.0 / 60, 10);
+}
+
+ChatServer::Message::Message(uint64_t id, const std::string& from, time_t time, const std::string& text):
+        json(JSON(makeFields(id, from, time, text)).toString()) {}
+
+ChatServer::Message::Message(const std::string& json): json(json) {}
+
+const std::string& ChatServer::Message::toString() const {
+    return json;
+}
 
 std::map<std::string, JSON> ChatServer::Message::makeFields(
-        const std::string& from, time_t time, const std::string& text) {
+        uint64_t id, const std::string& from, time_t time, const std::string& text) {
     std::map<std::string, JSON> result;
+    result["id"] = (long) id;
     result["from"] = from;
     result["time"] = time;
     result["text"] = text;
     return result;
 }
 
-ChatServer::Object::Object(const std::map<std::string, JSON::Type>& types): types(types), size(types.size()) {}
+ChatServer::History::History(size_t maxCount, size_t maxBytes):
+        segmentsStart(0), first(0), next(0), bytes(0), maxCount(maxCount), maxBytes(maxBytes) {}
+
+void ChatServer::History::add(Message message) {
+    if (segments.empty() || segments.back().size() == SEGMENT_SIZE) {
+        segments.emplace_back();
+        segments.back().reserve(SEGMENT_SIZE);
+    }
+    bytes += message.toString().size();
+    segments.back().push_back(std::move(message));
+    ++next;
+    trim();
+}
+
+void ChatServer::History::setMaxBytes(size_t newMaxBytes) {
+    maxBytes = newMaxBytes;
+    trim();
+}
+
+void ChatServer::History::trim() {
+    while (next - first > 1 && (next - first > maxCount || bytes > maxBytes)) {
+        bytes -= get(first).toString().size();
+        if (++first - segmentsStart == SEGMENT_SIZE) {
+            segments.pop_front();
+            segmentsStart = first;
+        }
+    }
+}
+
+void ChatServer::History::restart(uint64_t id) {
+    segments.clear();
+    segmentsStart = first = next = id;
+    bytes = 0;
+}
+
+const ChatServer::Message& ChatServer::History::get(uint64_t id) const {
+    uint64_t offset = id - segmentsStart;
+    return segments[offset / SEGMENT_SIZE][offset % SEGMENT_SIZE];
+}
+
+uint64_t ChatServer::History::getFirstId() const {
+    return first;
+}
+
+uint64_t ChatServer::History::getNextId() const {
+    return next;
+}
+
+ChatServer::Room::Room(const std::string& name, uint64_t serial, size_t maxHistoryCount, size_t maxHistoryBytes):
+        name(name), serial(serial), history(maxHistoryCount, maxHistoryBytes),
+        lastUsed(std::chrono::steady_clock::now()), deadline(std::chrono::steady_clock::time_point::max()) {}
+
+ChatServer::Object::Object(const std::map<std::string, JSON::Type>& types, const std::set<std::string>& optional):
+        types(types), optional(optional), requiredCount(types.size() - optional.size()) {}
 
-std::map<std::string, JSON> ChatServer::Object::match(const std::string& data) {
-    JSON payload = JSON::parseJSON(data);
-    if (payload.getType() != JSON::Type::OBJECT || payload.getObjectValue().size() != size) {
-        throw OwnException("Object mismatched: " + data);
+bool ChatServer::Object::match(const std::string& data, std::map<std::string, JSON>& fields) const {
+    JSON payload;
+    JSON::ParseError error;
+    if (!JSON::parseJSON(data, payload, error) || payload.getType() != JSON::Type::OBJECT) {
+        return false;
     }
-    std::map<std::string, JSON> payloadFields = payload.getObjectValue();
-    for (std::map<std::string, JSON>::const_iterator it = payloadFields.begin(); it != payloadFields.end(); ++it) {
-        if (types.find(it->first) == types.end() || it->second.getType() != types[it->first]) {
-            throw OwnException("Object mismatched: " + data);
+    fields = payload.getObjectValue();
+    size_t found = 0;
+    for (std::map<std::string, JSON>::const_iterator it = fields.begin(); it != fields.end(); ++it) {
+        std::map<std::string, JSON::Type>::const_iterator type = types.find(it->first);
+        if (type == types.end() || it->second.getType() != type->second) {
+            return false;
+        }
+        if (optional.find(it->first) == optional.end()) {
+            ++found;
         }
     }
-    return payload.getObjectValue();
+    return found == requiredCount;
 }
 
-std::pair<std::string, std::string> ChatServer::parseMessage(const std::string& string) {
+bool ChatServer::parseMessage(const std::string& string, std::string& username, std::string& message) {
+    // Clients with a session leave the username out
     std::map<std::string, JSON::Type> pattern;
     pattern["message"] = JSON::Type::STRING;
     pattern["username"] = JSON::Type::STRING;
-    std::map<std::string, JSON> messagePayload = Object(pattern).match(string);
-    return std::make_pair(messagePayload["username"].getStringValue(), messagePayload["message"].getStringValue());
+    std::map<std::string, JSON> messagePayload;
+    if (!Object(pattern, {"username"}).match(string, messagePayload)) {
+        return false;
+    }
+    std::map<std::string, JSON>::iterator name = messagePayload.find("username");
+    username = (name != messagePayload.end()) ? name->second.getStringValue() : "";
+    message = messagePayload["message"].getStringValue();
+    return true;
+}
+
+bool ChatServer::isValidRoomName(const std::string& name) {
+    if (name.empty() || name.size() > MAX_ROOM_NAME_SIZE) {
+        return false;
+    }
+    for (char c : name) {
+        if (!isalnum((unsigned char) c) && c != '-' && c != '_') {
+            return false;
+        }
+    }
+    return true;
+}
+
+std::string ChatServer::getRoomName(const HttpRequest& request) {
+    std::string_view room = request.getRouteParameter("room");
+    return room.empty() ? DEFAULT_ROOM : std::string(room);
+}
+
+ChatServer::Room* ChatServer::findRoom(const std::string& name) {
+    std::unordered_map<std::string, std::unique_ptr<Room>>::iterator it = rooms.find(name);
+    if (it == rooms.end()) {
+        return NULL;
+    }
+    it->second->lastUsed = std::chrono::steady_clock::now();
+    return it->second.get();
+}
+
+ChatServer::Room& ChatServer::addRoom(const std::string& name) {
+    std::unique_ptr<Room>& room = rooms[name];
+    if (room == NULL) {
+        room.reset(new Room(name, roomCount++, settings.maxHistoryCount, settings.maxHistoryBytes));
+        resizeHistories();
+    }
+    return *room;
+}
+
+void ChatServer::closeRoom(std::unordered_map<std::string, std::unique_ptr<Room>>::iterator it, bool restoring) {
+    Room& room = *it->second;
+    if (log != NULL && !restoring) {
+        log->append(MessageLog::CLOSE, room.name, 0, "", 0);
+    }
+    for (std::unordered_map<uint32_t, uint64_t>::const_iterator first = room.firstMessage.begin();
+         first != room.firstMessage.end(); ++first) {
+        releaseUser(first->first);
+    }
+    // Sessions only compare the pointers, but a new room may get the same address
+    for (Session& session : sessions) {
+        session.unread.erase(std::remove_if(session.unread.begin(), session.unread.end(),
+                                            [&room](const std::pair<const Room*, uint64_t>& unread) {
+            return unread.first == &room;
+        }), session.unread.end());
+    }
+    if (room.deadline != std::chrono::steady_clock::time_point::max()) {
+        deadlines.erase(std::make_pair(room.deadline, &room));
+    }
+    rooms.erase(it);
+    resizeHistories();
+}
+
+void ChatServer::closeIdleRooms(std::chrono::steady_clock::time_point now) {
+    for (std::unordered_map<std::string, std::unique_ptr<Room>>::iterator it = rooms.begin(); it != rooms.end();) {
+        Room& room = *it->second;
+        // Gone listeners are dropped within a heartbeat, and an idle room stays a little longer until then
+        if (!room.waiters.empty() || !room.subscribers.empty() || !room.webSockets.empty()) {
+            room.lastUsed = now;
+        }
+
+        // Every login of a new user adds one message, so a room with no more messages than users has no posts
+        bool posted = room.history.getNextId() > room.firstMessage.size();
+        unsigned timeout = posted ? settings.roomTimeout : settings.emptyRoomTimeout;
+        if (room.name == DEFAULT_ROOM || now - room.lastUsed < std::chrono::seconds(timeout)) {
+            ++it;
+            continue;
+        }
+        std::cout << "Room \"" << room.name << "\" closed after being idle" << std::endl;
+        std::unordered_map<std::string, std::unique_ptr<Room>>::iterator closed = it++;
+        closeRoom(closed, false);
+    }
+}
+
+void ChatServer::scheduleRoom(Room& room, std::chrono::steady_clock::time_point deadline) {
+    if (deadline >= room.deadline) {
+        return;
+    }
+    if (room.deadline != std::chrono::steady_clock::time_point::max()) {
+        deadlines.erase(std::make_pair(room.deadline, &room));
+    }
+    room.deadline = deadline;
+    deadlines.insert(std::make_pair(deadline, &room));
+}
+
+void ChatServer::rescheduleRoom(Room& room) {
+    if (room.deadline != std::chrono::steady_clock::time_point::max()) {
+        deadlines.erase(std::make_pair(room.deadline, &room));
+        room.deadline = std::chrono::steady_clock::time_point::max();
+    }
+    std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::time_point::max();
+    for (const Waiter& waiter : room.waiters) {
+        deadline = std::min(deadline, waiter.deadline);
+    }
+    if (!room.subscribers.empty() || !room.webSockets.empty()) {
+        deadline = std::min(deadline, room.nextHeartbeat);
+    }
+    scheduleRoom(room, deadline);
+}
+
+void ChatServer::addListener(Room& room) {
+    if (room.subscribers.empty() && room.webSockets.empty()) {
+        room.nextHeartbeat = std::chrono::steady_clock::now() + std::chrono::seconds(HEARTBEAT_INTERVAL);
+        scheduleRoom(room, room.nextHeartbeat);
+    }
+}
+
+void ChatServer::serveDeadlines(std::chrono::steady_clock::time_point now) {
+    while (!deadlines.empty() && deadlines.begin()->first <= now) {
+        Room& room = *deadlines.begin()->second;
+        deadlines.erase(deadlines.begin());
+        room.deadline = std::chrono::steady_clock::time_point::max();
+
+        expireWaiters(room);
+        if (now >= room.nextHeartbeat) {
+            room.nextHeartbeat = now + std::chrono::seconds(HEARTBEAT_INTERVAL);
+            publish(room, ": heartbeat\n\n");
+            room.webSockets.erase(std::remove_if(room.webSockets.begin(), room.webSockets.end(),
+                                                 [](const HttpServer::WebSocket& webSocket) {
+                return !webSocket.isOpened();
+            }), room.webSockets.end());
+        }
+        rescheduleRoom(room);
+    }
+}
+
+void ChatServer::resizeHistories() {
+    // The default room is always there
+    size_t share = std::min(settings.maxHistoryBytes, settings.maxTotalHistoryBytes / rooms.size());
+    for (std::unordered_map<std::string, std::unique_ptr<Room>>::iterator it = rooms.begin(); it != rooms.end();
+         ++it) {
+        it->second->history.setMaxBytes(share);
+    }
+}
+
+uint32_t ChatServer::internUser(std::string_view username) {
+    uint32_t userId = findUser(username);
+    if (userId != NO_USER) {
+        return userId;
+    }
+
+    if (!freeUsers.empty()) {
+        userId = freeUsers.back();
+        freeUsers.pop_back();
+        users[userId].name = username;
+    } else {
+        userId = users.size();
+        users.push_back(User{std::string(username), 0});
+    }
+    // The key is a view of the name kept in the table
+    userIds.emplace(users[userId].name, userId);
+    return userId;
+}
+
+uint32_t ChatServer::findUser(std::string_view username) const {
+    std::unordered_map<std::string_view, uint32_t>::const_iterator it = userIds.find(username);
+    return (it != userIds.end()) ? it->second : NO_USER;
 }
 
-std::string ChatServer::historyAsJson(size_t begin, size_t end) {
-    std::map<std::string, JSON> payload;
-    payload["messages"] = JSON(std::vector<JSON>(history.begin() + begin, history.begin() + end));
-    return JSON(payload).toString();
+void ChatServer::acquireUser(uint32_t userId) {
+    ++users[userId].references;
+}
+
+void ChatServer::releaseUser(uint32_t userId) {
+    if (userId == NO_USER || --users[userId].references != 0) {
+        return;
+    }
+    userIds.erase(users[userId].name);
+    std::string().swap(users[userId].name);
+    freeUsers.push_back(userId);
+}
+
+ChatServer::Session& ChatServer::openSession(uint32_t userId, std::string& token) {
+    uint32_t index;
+    if (!freeSessions.empty()) {
+        index = freeSessions.back();
+        freeSessions.pop_back();
+    } else {
+        index = sessions.size();
+        sessions.push_back(Session{{0, 0}, 0, NO_USER, std::chrono::steady_clock::time_point(), {}});
+    }
+
+    Session& session = sessions[index];
+    _m1_system_call(getrandom(session.secret, sizeof session.secret, 0), "Couldn't get random bytes");
+    session.userId = userId;
+    acquireUser(userId);
+    session.lastUsed = std::chrono::steady_clock::now();
+    uint32_t now = RateLimiter::now();
+    for (size_t i = 0; i < LIMITED_ROUTE_COUNT; ++i) {
+        session.buckets[i] = settings.sessionLimits[i].makeBucket(now);
+    }
+
+    char buffer[41];
+    snprintf(buffer, sizeof buffer, "%08x%016llx%016llx", index, (unsigned long long) session.secret[0],
+             (unsigned long long) session.secret[1]);
+    token = buffer;
+    return session;
+}
+
+ChatServer::Session* ChatServer::findSession(const HttpRequest& request) {
+    std::string cookies = request.getHeader("Cookie");
+    std::string_view token = Http::findCookie(cookies, SESSION_COOKIE);
+    if (token.size() != 40) {
+        return NULL;
+    }
+
+    uint64_t values[3] = {};
+    for (size_t i = 0; i < token.size(); ++i) {
+        char c = token[i];
+        int digit = (c >= '0' && c <= '9') ? c - '0' : (c >= 'a' && c <= 'f') ? c - 'a' + 10 : -1;
+        if (digit == -1) {
+            return NULL;
+        }
+        uint64_t& value = values[(i < 8) ? 0 : (i < 24) ? 1 : 2];
+        value = (value << 4) | digit;
+    }
+
+    if (values[0] >= sessions.size()) {
+        return NULL;
+    }
+    Session& session = sessions[values[0]];
+    if (session.userId == NO_USER || session.secret[0] != values[1] || session.secret[1] != values[2]) {
+        return NULL;
+    }
+    session.lastUsed = std::chrono::steady_clock::now();
+    return &session;
+}
+
+ChatServer::Session* ChatServer::getSession(uint32_t index, uint32_t generation) {
+    if (index == NO_SESSION || sessions[index].generation != generation || sessions[index].userId == NO_USER) {
+        return NULL;
+    }
+    return &sessions[index];
+}
+
+bool ChatServer::identify(const HttpRequest& request, std::string_view username, Client& client) {
+    client.session = findSession(request);
+    if (client.session != NULL) {
+        client.userId = client.session->userId;
+        client.username = users[client.userId].name;
+        return true;
+    } else if (username.empty()) {
+        return false;
+    }
+    client.userId = findUser(username);
+    client.username = username;
+    return true;
+}
+
+void ChatServer::evictSessions(std::chrono::steady_clock::time_point now) {
+    size_t count = 0;
+    for (uint32_t i = 0; i < sessions.size(); ++i) {
+        Session& session = sessions[i];
+        if (session.userId == NO_USER || now - session.lastUsed < std::chrono::seconds(settings.sessionTimeout)) {
+            continue;
+        }
+        releaseUser(session.userId);
+        session.userId = NO_USER;
+        session.secret[0] = session.secret[1] = 0;
+        ++session.generation;
+        std::vector<std::pair<const Room*, uint64_t>>().swap(session.unread);
+        freeSessions.push_back(i);
+        ++count;
+    }
+    if (count != 0) {
+        std::cout << "Dropped " << count << " idle sessions, " << sessions.size() - freeSessions.size()
+                  << " left of " << users.size() - freeUsers.size() << " users" << std::endl;
+    }
+}
+
+unsigned ChatServer::takeToken(LimitedRoute route, RateLimiter::Bucket* bucket, const std::string& host) {
+    const RateLimiter& sessionLimiter = settings.sessionLimits[route];
+    const RateLimiter& addressLimiter = settings.addressLimits[route];
+    uint32_t now = RateLimiter::now();
+    unsigned wait = 0;
+    if (bucket != NULL) {
+        wait = sessionLimiter.refill(*bucket, now);
+    }
+
+    RateLimiter::Bucket* addressBucket = NULL;
+    if (addressLimiter.isEnabled()) {
+        std::unordered_map<std::string, AddressBuckets>::iterator it = addressBuckets.find(host);
+        if (it == addressBuckets.end()) {
+            AddressBuckets buckets;
+            for (size_t i = 0; i < LIMITED_ROUTE_COUNT; ++i) {
+                buckets.buckets[i] = settings.addressLimits[i].makeBucket(now);
+            }
+            it = addressBuckets.insert(std::make_pair(host, buckets)).first;
+        }
+        addressBucket = &it->second.buckets[route];
+        wait = std::max(wait, addressLimiter.refill(*addressBucket, now));
+    }
+
+    if (wait == 0) {
+        if (bucket != NULL && sessionLimiter.isEnabled()) {
+            RateLimiter::take(*bucket);
+        }
+        if (addressBucket != NULL) {
+            RateLimiter::take(*addressBucket);
+        }
+    }
+    return wait;
+}
+
+bool ChatServer::checkLimits(const HttpRequest& request, HttpServer::ResponseSocket& responseSocket,
+                             LimitedRoute route, Session* session) {
+    unsigned wait = takeToken(route, (session != NULL) ? &session->buckets[route] : NULL,
+                              responseSocket.getRemoteHost());
+    if (wait == 0) {
+        return true;
+    }
+    sendTooManyRequests(request, responseSocket, wait);
+    return false;
+}
+
+void ChatServer::pruneAddresses(uint32_t now) {
+    for (std::unordered_map<std::string, AddressBuckets>::iterator it = addressBuckets.begin();
+         it != addressBuckets.end();) {
+        bool full = true;
+        for (size_t i = 0; i < LIMITED_ROUTE_COUNT && full; ++i) {
+            full = settings.addressLimits[i].isFull(it->second.buckets[i], now);
+        }
+        it = full ? addressBuckets.erase(it) : std::next(it);
+    }
+}
+
+std::string ChatServer::historyAsJson(const Room& room, uint64_t begin, uint64_t end) {
+    // The same text JSON::toString() makes of {"messages": [...]}, with one copy per message
+    static const std::string prefix = "{\"messages\": [", separator = ", ", suffix = "]}";
+    size_t size = prefix.size() + suffix.size();
+    for (uint64_t id = begin; id < end; ++id) {
+        size += room.history.get(id).toString().size() + separator.size();
+    }
+
+    std::string result;
+    result.reserve(size);
+    result += prefix;
+    for (uint64_t id = begin; id < end; ++id) {
+        if (id != begin) {
+            result += separator;
+        }
+        result += room.history.get(id).toString();
+    }
+    result += suffix;
+    return result;
+}
+
+uint64_t ChatServer::addMessage(Room& room, const std::string& from, const std::string& text) {
+    History& history = room.history;
+    uint64_t id = history.getNextId();
+    history.add(Message(id, from, time(NULL), text));
+    uint64_t sequence = 0;
+    if (log != NULL) {
+        sequence = log->append(MessageLog::MESSAGE, room.name, id, history.get(id).toString(),
+                               history.getFirstId());
+    }
+
+    std::string event;
+    appendEvent(event, room, id);
+    publish(room, event);
+    // Framed once for all the sockets
+    std::string frame;
+    HttpServer::WebSocket::encodeText(history.get(id).toString(), frame);
+    broadcast(room, frame);
+    notifyWaiters(room);
+    return sequence;
+}
+
+void ChatServer::restoreRecord(MessageLog::RecordType type, const std::string& roomName, uint64_t id,
+                               const char* data, size_t size) {
+    if (type == MessageLog::CLOSE) {
+        std::unordered_map<std::string, std::unique_ptr<Room>>::iterator it = rooms.find(roomName);
+        if (it != rooms.end() && roomName != DEFAULT_ROOM) {
+            closeRoom(it, true);
+        }
+        return;
+    }
+
+    Room& room = addRoom(roomName);
+    History& history = room.history;
+    if (type == MessageLog::JOIN) {
+        uint32_t userId = internUser(std::string_view(data, size));
+        std::pair<std::unordered_map<uint32_t, uint64_t>::iterator, bool> inserted =
+                room.firstMessage.insert(std::make_pair(userId, id));
+        if (inserted.second) {
+            acquireUser(userId);
+        } else {
+            inserted.first->second = id;
+        }
+    } else if (type == MessageLog::MESSAGE && id >= history.getNextId()) {
+        if (id != history.getNextId()) {
+            history.restart(id);
+        }
+        history.add(Message(std::string(data, size)));
+    }
+}
+
+void ChatServer::completeWrites(uint64_t sequence) {
+    bool failed = log->hasFailed();
+    while (!pendingWrites.empty() && pendingWrites.front().sequence <= sequence) {
+        HttpServer::ResponseSocket& responseSocket = pendingWrites.front().responseSocket;
+        try {
+            if (responseSocket.isValid()) {
+                HttpResponse response(Http::Method::POST, Http::VERSION1_1, failed ? 500 : 200,
+                                      failed ? "Internal Server Error" : "OK");
+                responseSocket.end(response);
+            }
+        } catch (const std::exception& exception) {
+            std::cerr << "Exception while answering a post: " << exception.what() << std::endl;
+            responseSocket.close();
+        }
+        pendingWrites.pop_front();
+    }
+}
+
+void ChatServer::appendEvent(std::string& output, const Room& room, uint64_t id) {
+    // EventSource sends the id back as Last-Event-ID when it reconnects
+    output += "id: ";
+    Http::appendNumber(output, id);
+    output += "\ndata: ";
+    output += room.history.get(id).toString();
+    output += "\n\n";
+}
+
+void ChatServer::publish(Room& room, const std::string& data) {
+    std::vector<HttpServer::ResponseSocket> remaining;
+    for (HttpServer::ResponseSocket& subscriber : room.subscribers) {
+        if (subscriber.getOutputSize() > MAX_BACKLOG) {
+            std::cout << "Disconnecting a subscriber which doesn't keep up" << std::endl;
+            subscriber.close();
+        } else if (subscriber.send(data)) {
+            remaining.push_back(subscriber);
+        }
+    }
+    room.subscribers.swap(remaining);
+}
+
+void ChatServer::broadcast(Room& room, const std::string& frame) {
+    std::vector<HttpServer::WebSocket> remaining;
+    for (HttpServer::WebSocket& webSocket : room.webSockets) {
+        if (webSocket.getOutputSize() > MAX_BACKLOG) {
+            std::cout << "Disconnecting a WebSocket which doesn't keep up" << std::endl;
+            webSocket.close(1008);
+        } else if (webSocket.sendFrame(frame)) {
+            remaining.push_back(webSocket);
+        }
+    }
+    room.webSockets.swap(remaining);
+}
+
+void ChatServer::receiveMessage(Room& room, const std::string& username, HttpServer::WebSocket& webSocket,
+                                const std::string& data) {
+    std::map<std::string, JSON::Type> pattern;
+    pattern["message"] = JSON::Type::STRING;
+    std::map<std::string, JSON> messagePayload;
+    if (!Object(pattern).match(data, messagePayload) || messagePayload["message"].getStringValue() == "") {
+        std::cout << "User \"" << username << "\" sent an invalid WebSocket message: \"" << data << "\""
+                  << std::endl;
+        webSocket.close(1007);
+        return;
+    }
+
+    std::string message = messagePayload["message"].getStringValue();
+    std::cout << "User \"" << username << "\" sent message: \"" << message << "\"" << std::endl;
+    addMessage(room, username, message);
+}
+
+uint64_t ChatServer::findFirstMessage(const Room& room, uint32_t userId) {
+    // What was dropped from the history is gone for everyone
+    std::unordered_map<uint32_t, uint64_t>::const_iterator first = room.firstMessage.find(userId);
+    return std::max((first != room.firstMessage.end()) ? first->second : 0, room.history.getFirstId());
+}
+
+uint64_t ChatServer::findBegin(const Room& room, uint32_t userId, const Session* session, bool all,
+                               int64_t after) const {
+    uint64_t begin = findFirstMessage(room, userId);
+    if (after >= 0) {
+        begin = std::max(begin, (uint64_t) after + 1);
+    } else if (!all && settings.trackUnread && session != NULL) {
+        // Sessions are in a few rooms at most
+        for (const std::pair<const Room*, uint64_t>& unread : session->unread) {
+            if (unread.first == &room) {
+                begin = std::max(begin, unread.second);
+                break;
+            }
+        }
+    }
+    return std::min(begin, room.history.getNextId());
+}
+
+uint64_t ChatServer::findEnd(const Room& room, uint64_t begin, unsigned limit) {
+    uint64_t end = room.history.getNextId();
+    return (limit != 0) ? std::min(end, begin + limit) : end;
+}
+
+std::string ChatServer::makeEtag(const Room& room, uint64_t begin, uint64_t end) const {
+    std::string etag = etagPrefix;
+    Http::appendNumber(etag, room.serial);
+    etag += '-';
+    Http::appendNumber(etag, begin);
+    etag += '-';
+    Http::appendNumber(etag, end);
+    etag += '"';
+    return etag;
+}
+
+bool ChatServer::sendNotModified(const std::string& ifNoneMatch, const std::string& etag,
+                                 HttpServer::ResponseSocket& responseSocket) {
+    if (ifNoneMatch.empty() || !Http::etagMatches(ifNoneMatch, etag)) {
+        return false;
+    }
+    HttpResponse response(Http::Method::GET, Http::VERSION1_1, 304, "Not Modified");
+    response.setHeader("ETag", etag);
+    response.setHeader("Cache-Control", "no-cache");
+    responseSocket.end(response);
+    return true;
+}
+
+void ChatServer::sendMessages(Room& room, Session* session, uint64_t begin, unsigned limit, bool markRead,
+                              const std::string& ifNoneMatch, HttpServer::ResponseSocket& responseSocket) {
+    uint64_t end = findEnd(room, begin, limit);
+    if (markRead && settings.trackUnread && session != NULL) {
+        std::vector<std::pair<const Room*, uint64_t>>::iterator unread = session->unread.begin();
+        for (; unread != session->unread.end() && unread->first != &room; ++unread);
+        if (unread != session->unread.end()) {
+            unread->second = end;
+        } else {
+            session->unread.push_back(std::make_pair(&room, end));
+        }
+    }
+
+    // Messages never change, so the same range of ids is the same body
+    std::string etag = makeEtag(room, begin, end);
+    if (sendNotModified(ifNoneMatch, etag, responseSocket)) {
+        return;
+    }
+
+    HttpResponse response(Http::Method::GET, Http::VERSION1_1, 200, "OK");
+    response.setContentType(Http::APPLICATION_JSON);
+    // Browsers revalidate with If-None-Match on their own, so polls repeating a URL get 304 while nothing's new
+    response.setHeader("ETag", etag);
+    response.setHeader("Cache-Control", "no-cache");
+    std::string body = historyAsJson(room, begin, end);
+    response.swapBody(body);
+    responseSocket.end(response);
+}
+
+void ChatServer::notifyWaiters(Room& room) {
+    // Handlers may park new polls meanwhile, so the list is swapped out first
+    std::vector<Waiter> notified;
+    notified.swap(room.waiters);
+    for (Waiter& waiter : notified) {
+        if (!waiter.responseSocket.isValid()) {
+            releaseUser(waiter.userId);
+            continue;
+        }
+        Session* session = getSession(waiter.session, waiter.generation);
+        uint64_t begin = findBegin(room, waiter.userId, session, false, waiter.after);
+        if (begin == room.history.getNextId()) {
+            // Another poll of the same session took the messages
+            room.waiters.push_back(waiter);
+            continue;
+        }
+        try {
+            sendMessages(room, session, begin, waiter.limit, waiter.after < 0, waiter.ifNoneMatch,
+                         waiter.responseSocket);
+        } catch (const std::exception& exception) {
+            std::cerr << "Exception while completing a long poll: " << exception.what() << std::endl;
+            waiter.responseSocket.close();
+        }
+        releaseUser(waiter.userId);
+    }
+}
+
+void ChatServer::expireWaiters(Room& room) {
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    std::vector<Waiter> remaining;
+    for (Waiter& waiter : room.waiters) {
+        if (!waiter.responseSocket.isValid()) {
+            releaseUser(waiter.userId);
+            continue;
+        } else if (now < waiter.deadline) {
+            remaining.push_back(waiter);
+            continue;
+        }
+        try {
+            Session* session = getSession(waiter.session, waiter.generation);
+            sendMessages(room, session, findBegin(room, waiter.userId, session, false, waiter.after),
+                         waiter.limit, waiter.after < 0, waiter.ifNoneMatch, waiter.responseSocket);
+        } catch (const std::exception& exception) {
+            std::cerr << "Exception while completing a long poll: " << exception.what() << std::endl;
+            waiter.responseSocket.close();
+        }
+        releaseUser(waiter.userId);
+    }
+    room.waiters.swap(remaining);
 }
 
 void ChatServer::logError(const HttpRequest& request, int code, const std::string& response) {
@@ -48,286 +736,539 @@ void ChatServer::logError(const HttpRequest& request, int code, const std::strin
     std::cout << "  Result: " << response << ", sending code " << code << std::endl;
 }
 
-ChatServer::ChatServer(uint16_t port, Poller& poller): httpServer(HttpServer(port, poller)) {
-    httpServer.addRouteMatcher(RouteMatcher(Http::Method::POST, "/login"),
-        [this](const HttpRequest& request, HttpServer::ResponseSocket responseSocket) {
-            try {
-                try {
-                    std::map<std::string, JSON::Type> pattern;
-                    pattern["username"] = JSON::Type::STRING;
-                    std::map<std::string, JSON> usernamePayload = Object(pattern).match(request.getBody());
-                    std::string username = usernamePayload["username"].getStringValue();
-
-                    if (username == ADMIN_NAME) {
-                        throw OwnException("One can't login with username Admin");
-                    }
-
-                    if (firstMessage.find(username) == firstMessage.end()) {
-                        size_t first = history.size();
-                        std::cout << "User \"" << username << "\" joined to chat" << std::endl;
-                        history.push_back(Message(ADMIN_NAME, time(NULL), "User " + username + " joined to chat!"));
-                        firstMessage[username] = first;
-                    }
-                } catch (const OwnException& exception) {
-                    logError(request, 400, "Bad request: " + std::string(exception.what()));
-                    HttpResponse response(request.getMethod(), Http::VERSION1_1, 400, "Bad Request");
-                    responseSocket.end(response);
-                    return;
-                }
+void ChatServer::sendBadRequest(const HttpRequest& request, HttpServer::ResponseSocket& responseSocket,
+                                const char* reason) {
+    logError(request, 400, reason);
+    HttpResponse response(request.getMethod(), Http::VERSION1_1, 400, "Bad Request");
+    responseSocket.end(response);
+}
 
-                HttpResponse response = HttpResponse(request.getMethod(), Http::VERSION1_1, 200, "OK");
-                if (!request.shouldKeepAlive()) {
-                    response.setHeader("Connection", "Keep-Alive");
-                }
-                responseSocket.end(response);
-            } catch (const std::exception& exception) {
-                std::cerr << "Exception while responding to request (method "
-                          << Http::methodToString(request.getMethod()) << ", URL \"" << request.getUri()
-                          << "\"), closing connection: " << exception.what() << "" << std::endl;
-                responseSocket.close();
-            }
-        });
-
-    httpServer.addRouteMatcher(RouteMatcher(Http::Method::GET, "/messages"),
-        [this](const HttpRequest& request, HttpServer::ResponseSocket responseSocket) {
-            try {
-                size_t begin;
-
-                try {
-                    std::map<std::string, std::string> queryParams = Http::queryParameters(request.getUri());
-                    if (queryParams.find("username") == queryParams.end() ||
-                            queryParams.find("all") == queryParams.end()) {
-                        throw OwnException(
-                                std::string("There should be \"username\" and \"all\" query parameters")
-                                + " in a GET request to \"messages\"");
-                    }
-                    std::string username = queryParams["username"];
-                    std::string allMessages = queryParams["all"];
-                    if (username == "" || (allMessages != "true" && allMessages != "false")) {
-                        throw OwnException("Bad request: empty username or invalid all messages indicator");
-                    } else if (username == ADMIN_NAME) {
-                        throw OwnException("One can't get messages from username Admin");
-                    }
-
-                    bool isAll = (allMessages == "true");
-                    if (isAll || firstUnreadMessage.find(username) == firstUnreadMessage.end()) {
-                        begin = firstMessage[username];
-                    } else {
-                        begin = firstUnreadMessage[username];
-                    }
-                    firstUnreadMessage[username] = history.size();
-                } catch (const OwnException& exception) {
-                    logError(request, 400, "Bad request: " + std::string(exception.what()));
-                    HttpResponse response(request.getMethod(), Http::VERSION1_1, 400, "Bad Request");
-                    responseSocket.end(response);
-                    return;
-                }
+void ChatServer::sendUnauthorized(const HttpRequest& request, HttpServer::ResponseSocket& responseSocket) {
+    logError(request, 401, "Unauthorized: no session and no username");
+    HttpResponse response(request.getMethod(), Http::VERSION1_1, 401, "Unauthorized");
+    responseSocket.end(response);
+}
 
-                HttpResponse response(request.getMethod(), Http::VERSION1_1, 200, "OK");
-                if (!request.shouldKeepAlive()) {
-                    response.setHeader("Connection", "Keep-Alive");
-                }
-                response.setHeader("Content-Type", "application/json; charset=UTF-8");
-                response.appendBody(historyAsJson(begin, history.size()));
-                responseSocket.end(response);
-            } catch (const std::exception& exception) {
-                std::cerr << "Exception while responding to request (method "
-                          << Http::methodToString(request.getMethod()) << ", URL \"" << request.getUri()
-                          << "\"), closing connection: " << exception.what() << "" << std::endl;
-                responseSocket.close();
-            }
-        });
-
-    httpServer.addRouteMatcher(RouteMatcher(Http::Method::HEAD, "/messages"),
-        [this](const HttpRequest& request, HttpServer::ResponseSocket responseSocket) {
-            try {
-                try {
-                    std::map<std::string, std::string> queryParams = Http::queryParameters(request.getUri());
-                    if (queryParams.find("username") == queryParams.end() ||
-                            queryParams.find("all") == queryParams.end()) {
-                        throw OwnException(
-                                std::string("There should be \"username\" and \"all\" query parameters")
-                                + " in a GET request to \"messages\"");
-                    }
-                    std::string username = queryParams["username"];
-                    std::string allMessages = queryParams["all"];
-                    if (username == "" || (allMessages != "true" && allMessages != "false")) {
-                        throw OwnException("Bad request: empty username or invalid all messages indicator");
-                    } else if (username == ADMIN_NAME) {
-                        throw OwnException("One can't get messages from username Admin");
-                    }
-                } catch (const OwnException& exception) {
-                    logError(request, 400, "Bad request: " + std::string(exception.what()));
-                    HttpResponse response(request.getMethod(), Http::VERSION1_1, 400, "Bad Request");
-                    responseSocket.end(response);
-                    return;
-                }
+void ChatServer::sendTooManyRequests(const HttpRequest& request, HttpServer::ResponseSocket& responseSocket,
+                                     unsigned wait) {
+    logError(request, 429, "Too many requests from " + responseSocket.getRemoteHost());
+    HttpResponse response(request.getMethod(), Http::VERSION1_1, 429, "Too Many Requests");
+    response.setHeader("Retry-After", std::to_string(wait));
+    responseSocket.end(response);
+}
 
-                HttpResponse response(request.getMethod(), Http::VERSION1_1, 200, "OK");
-                if (!request.shouldKeepAlive()) {
-                    response.setHeader("Connection", "Keep-Alive");
-                }
-                response.setHeader("Content-Type", "application/json; charset=UTF-8");
-                responseSocket.end(response);
-            } catch (const std::exception& exception) {
-                std::cerr << "Exception while responding to request (method "
-                          << Http::methodToString(request.getMethod()) << ", URL \"" << request.getUri()
-                          << "\"), closing connection: " << exception.what() << "" << std::endl;
-                responseSocket.close();
-            }
-        });
-
-    httpServer.addRouteMatcher(RouteMatcher(Http::Method::POST, "/messages"),
-        [this](const HttpRequest& request, HttpServer::ResponseSocket responseSocket) {
-            try {
-                try {
-                    std::pair<std::string, std::string> identifiedMessage = parseMessage(request.getBody());
-                    std::string username = identifiedMessage.first;
-                    std::string message = identifiedMessage.second;
-                    if (username == "" || message == "") {
-                        throw OwnException("Bad request: empty username or message");
-                    } else if (username == ADMIN_NAME) {
-                        throw OwnException("One can't post a message from username Admin");
-                    }
-
-                    std::cout << "User \"" << username << "\" sent message: \"" << message << "\"" << std::endl;
-                    history.push_back(Message(username, time(NULL), message));
-                } catch (const OwnException& exception) {
-                    logError(request, 400, "Bad request: " + std::string(exception.what()));
-                    HttpResponse response(request.getMethod(), Http::VERSION1_1, 400, "Bad Request");
-                    responseSocket.end(response);
-                    return;
-                }
+void ChatServer::sendRoomNotFound(const HttpRequest& request, HttpServer::ResponseSocket& responseSocket) {
+    logError(request, 404, "Not found: no such room");
+    HttpResponse response(request.getMethod(), Http::VERSION1_1, 404, "Not Found");
+    responseSocket.end(response);
+}
 
-                HttpResponse response(request.getMethod(), Http::VERSION1_1, 200, "OK");
-                if (!request.shouldKeepAlive()) {
-                    response.setHeader("Connection", "Keep-Alive");
-                }
-                responseSocket.end(response);
-            } catch (const std::exception& exception) {
-                std::cerr << "Exception while responding to request (method "
-                          << Http::methodToString(request.getMethod()) << ", URL \"" << request.getUri()
-                          << "\"), closing connection: " << exception.what() << "" << std::endl;
-                responseSocket.close();
-            }
-        });
-
-    httpServer.addRouteMatcher(RouteMatcher(Http::Method::GET, "*"),
-        [](const HttpRequest& request, HttpServer::ResponseSocket responseSocket) {
-            try {
-                std::string body, type;
-
-                try {
-                    std::string filename = Http::getUriPath(request.getUri());
-                    if (filename[0] == '/') {
-                        filename.erase(0, 1);
-                    }
-                    if (filename == "") {
-                        filename = "index.html";
-                    }
-
-                    try {
-                        Resource resource = Resource::getResource(filename);
-                        body = std::string(resource.data(), resource.size());
-                    } catch (const std::out_of_range& out_of_range) {
-                        logError(request, 404, "Not found: " + filename);
-                        HttpResponse response(request.getMethod(), Http::VERSION1_1, 404, "Not Found");
-                        response.appendBody("<html>"
-                                                    "<head>"
-                                                    "<title>The resource isn't found</title>"
-                                                    "</head>"
-                                                    "<body>"
-                                                    "<h1>Not found</h1>"
-                                                    "<p>The requested URL " + Http::getUriPath(request.getUri())
-                                            + " was not found on this server.</p>"
-                                                    "<hr>"
-                                                    "</body>"
-                                                    "</html>");
-                        responseSocket.end(response);
-                        return;
-                    }
-
-                    size_t ext = filename.find('.');
-                    type = (ext != std::string::npos)
-                                       ? filename.substr(ext + 1, filename.size() - ext - 1)
-                                       : "";
-                } catch (const OwnException& own_exception) {
-                    logError(request, 400, "Bad request: " + std::string(own_exception.what()));
-                    HttpResponse response(request.getMethod(), Http::VERSION1_1, 400, "Bad Request");
-                    responseSocket.end(response);
+bool ChatServer::isNotModified(const HttpRequest& request, const Resource& resource, Resource::Encoding encoding) {
+    // If-Modified-Since is only looked at when there's no If-None-Match (RFC 7232, section 6)
+    if (request.hasHeader("If-None-Match")) {
+        return Http::etagMatches(request.getHeader("If-None-Match"), resource.etag(encoding));
+    }
+    if (request.hasHeader("If-Modified-Since")) {
+        time_t since = Http::parseDate(request.getHeader("If-Modified-Since"));
+        return since != -1 && resource.lastModified() <= since;
+    }
+    return false;
+}
+
+void ChatServer::setCacheHeaders(HttpResponse& response, const Resource& resource, Resource::Encoding encoding) {
+    response.setHeader("ETag", resource.etag(encoding));
+    response.setHeader("Last-Modified", resource.lastModifiedString());
+    response.setHeader("Cache-Control", resource.cacheControl());
+    response.setHeader("Vary", "Accept-Encoding");
+}
+
+ChatServer::StaticResponses::StaticResponses(const Resource& resource): resource(resource) {}
+
+ChatServer::StaticResponses ChatServer::prepareResponses(const Resource& resource) {
+    StaticResponses responses(resource);
+    Http::ContentType type = resource.contentType();
+    // Images hardly ever change; the rest is revalidated with ETag on every use
+    if (responses.resource.cacheControl().empty()) {
+        bool isImage = type == Http::IMAGE_PNG || type == Http::IMAGE_X_ICON;
+        responses.resource.setCacheControl(isImage ? "public, max-age=86400" : "no-cache");
+    }
+
+    for (size_t i = 0; i < Resource::ENCODING_COUNT; ++i) {
+        Resource::Encoding encoding = (Resource::Encoding) i;
+        if (!resource.hasEncoding(encoding)) {
+            continue;
+        }
+
+        for (Http::Method method : {Http::Method::GET, Http::Method::HEAD}) {
+            HttpResponse response(method, Http::VERSION1_1, 200, "OK");
+            response.setContentType(type);
+            if (encoding != Resource::IDENTITY) {
+                response.setHeader("Content-Encoding", Resource::encodingToString(encoding));
+            }
+            setCacheHeaders(response, responses.resource, encoding);
+            HttpResponse::Prepared& prepared = (method == Http::Method::GET)
+                                               ? responses.get[encoding] : responses.head[encoding];
+            prepared = response.prepare(resource.data(encoding), resource.size(encoding), resource.owner());
+        }
+
+        HttpResponse notModified(Http::Method::GET, Http::VERSION1_1, 304, "Not Modified");
+        setCacheHeaders(notModified, responses.resource, encoding);
+        responses.notModified[encoding] = notModified.prepare(NULL, 0);
+    }
+    return responses;
+}
+
+const ChatServer::StaticResponses* ChatServer::findResponses(std::string_view name) const {
+    if (resourceDirectory) {
+        std::unordered_map<std::string, StaticResponses>::const_iterator it = staticResponses.find(std::string(name));
+        return (it != staticResponses.end()) ? &it->second : NULL;
+    }
+
+    // The responses of an embedded resource are at its index in the generated table
+    const Resource::Embedded* embedded = Resource::findEmbedded(name);
+    return (embedded != NULL) ? &embeddedResponses[embedded - &Resource::getEmbedded(0)] : NULL;
+}
+
+void ChatServer::sendResource(const HttpRequest& request, const StaticResponses& responses,
+                              HttpServer::ResponseSocket responseSocket) {
+    Resource::Encoding encoding = responses.resource.chooseEncoding(request.getHeader("Accept-Encoding"));
+    if (isNotModified(request, responses.resource, encoding)) {
+        responseSocket.end(responses.notModified[encoding]);
+    } else if (request.getMethod() == Http::Method::HEAD) {
+        responseSocket.end(responses.head[encoding]);
+    } else {
+        responseSocket.end(responses.get[encoding]);
+    }
+}
+
+ChatServer::ChatServer(uint16_t port, Poller& poller, const std::string& resourcePath, const Settings& settings):
+        settings(settings), httpServer(HttpServer(port, poller)), poller(poller), tfd(-1), roomCount(0),
+        lastSessionSweep(std::chrono::steady_clock::now()) {
+    uint32_t epoch;
+    _m1_system_call(getrandom(&epoch, sizeof epoch, 0), "Couldn't get random bytes");
+    // Weak, as the body may be sent compressed
+    char buffer[16];
+    snprintf(buffer, sizeof buffer, "W/\"%08x-", epoch);
+    etagPrefix = buffer;
+
+    addRoom(DEFAULT_ROOM);
+    if (!settings.logPath.empty()) {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        log.reset(new MessageLog(settings.logPath, poller,
+                                 [this](MessageLog::RecordType type, const std::string& room, uint64_t id,
+                                        const char* data, size_t size) {
+            restoreRecord(type, room, id, data, size);
+        }, [this](uint64_t sequence) {
+            completeWrites(sequence);
+        }));
+        std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+        size_t messageCount = 0, userCount = 0;
+        for (std::unordered_map<std::string, std::unique_ptr<Room>>::const_iterator it = rooms.begin();
+             it != rooms.end(); ++it) {
+            messageCount += it->second->history.getNextId() - it->second->history.getFirstId();
+            userCount += it->second->firstMessage.size();
+        }
+        std::cout << "Restored " << messageCount << " messages and " << userCount << " logins in "
+                  << rooms.size() << " rooms in " << elapsed.count() << " ms" << std::endl;
+    }
+
+    // Logging in to a room creates it; the response sets the session cookie, which later requests are
+    // recognized by instead of their username
+    HttpServer::RequestHandler login = [this](const HttpRequest& request,
+                                              HttpServer::ResponseSocket responseSocket) {
+        try {
+            if (!checkLimits(request, responseSocket, LOGIN_ROUTE, NULL)) {
+                return;
+            }
+
+            std::map<std::string, JSON::Type> pattern;
+            pattern["username"] = JSON::Type::STRING;
+            std::map<std::string, JSON> usernamePayload;
+            if (!Object(pattern).match(request.getBody(), usernamePayload)) {
+                sendBadRequest(request, responseSocket, "Bad request: invalid login payload");
+                return;
+            }
+            std::string username = usernamePayload["username"].getStringValue();
+            if (username == ADMIN_NAME) {
+                sendBadRequest(request, responseSocket, "Bad request: one can't login with username Admin");
+                return;
+            }
+
+            std::string roomName = getRoomName(request);
+            Room* room = findRoom(roomName);
+            if (room == NULL) {
+                if (!isValidRoomName(roomName)) {
+                    sendBadRequest(request, responseSocket, "Bad request: invalid room name");
+                    return;
+                } else if (rooms.size() >= this->settings.maxRooms) {
+                    sendBadRequest(request, responseSocket, "Bad request: too many rooms");
+                    return;
+                } else if (!checkLimits(request, responseSocket, NEW_ROOM, findSession(request))) {
                     return;
                 }
+                std::cout << "Room \"" << roomName << "\" opened" << std::endl;
+                room = &addRoom(roomName);
+            }
 
-                HttpResponse response(request.getMethod(), Http::VERSION1_1, 200, "OK");
-                if (!request.shouldKeepAlive()) {
-                    response.setHeader("Connection", "Keep-Alive");
+            uint32_t userId = internUser(username);
+            if (room->firstMessage.find(userId) == room->firstMessage.end()) {
+                uint64_t first = room->history.getNextId();
+                std::cout << "User \"" << username << "\" joined to room \"" << roomName << "\"" << std::endl;
+                addMessage(*room, ADMIN_NAME, "User " + username + " joined to chat!");
+                room->firstMessage[userId] = first;
+                acquireUser(userId);
+                if (log != NULL) {
+                    log->append(MessageLog::JOIN, roomName, first, username, room->history.getFirstId());
                 }
-                if (type == "js") {
-                    response.setHeader("Content-Type", "application/javascript");
-                } else if (type == "html" || type == "htm") {
-                    response.setHeader("Content-Type", "text/html");
-                } else if (type == "css") {
-                    response.setHeader("Content-Type", "text/css");
+            }
+
+            HttpResponse response = HttpResponse(request.getMethod(), Http::VERSION1_1, 200, "OK");
+            // The same user logging in to another room keeps the session
+            Session* session = findSession(request);
+            if (session == NULL || session->userId != userId) {
+                std::string token;
+                openSession(userId, token);
+                response.setHeader("Set-Cookie", std::string(SESSION_COOKIE) + "=" + token
+                                                 + "; Path=/; HttpOnly; SameSite=Strict");
+            }
+            responseSocket.end(response);
+        } catch (const std::exception& exception) {
+            std::cerr << "Exception while responding to request (method "
+                      << Http::methodToString(request.getMethod()) << ", URL \"" << request.getUri()
+                      << "\"), closing connection: " << exception.what() << "" << std::endl;
+            responseSocket.close();
+        }
+    };
+
+    auto getMessages = [this](const HttpRequest& request, const MessagesQuery& query,
+                              HttpServer::ResponseSocket responseSocket) {
+        try {
+            Client client;
+            if (!identify(request, query.username, client)) {
+                sendUnauthorized(request, responseSocket);
+                return;
+            } else if (!checkLimits(request, responseSocket, POLL_ROUTE, client.session)) {
+                return;
+            } else if (client.username == ADMIN_NAME) {
+                sendBadRequest(request, responseSocket, "Bad request: one can't get messages from username Admin");
+                return;
+            }
+            Room* room = findRoom(getRoomName(request));
+            if (room == NULL) {
+                sendRoomNotFound(request, responseSocket);
+                return;
+            }
+
+            uint64_t begin = findBegin(*room, client.userId, client.session, query.all, query.after);
+            if (query.wait != 0 && !query.all && begin == room->history.getNextId()) {
+                unsigned wait = std::min(query.wait, MAX_WAIT);
+                uint32_t session = (client.session != NULL) ? client.session - sessions.data() : NO_SESSION;
+                uint32_t generation = (client.session != NULL) ? client.session->generation : 0;
+                if (client.userId != NO_USER) {
+                    acquireUser(client.userId);
                 }
-                response.appendBody(body);
-                responseSocket.end(response);
-            } catch (const std::exception& exception) {
-                std::cerr << "Exception while responding to request (method "
-                          << Http::methodToString(request.getMethod()) << ", URL \"" << request.getUri()
-                          << "\"), closing connection: " << exception.what() << "" << std::endl;
-                responseSocket.close();
-            }
-        });
-
-    httpServer.addRouteMatcher(RouteMatcher(Http::Method::HEAD, "*"),
-        [](const HttpRequest& request, HttpServer::ResponseSocket responseSocket) {
-            try {
-                std::string type;
-
-                try {
-                    std::string filename = Http::getUriPath(request.getUri());
-                    if (filename[0] == '/') {
-                        filename.erase(0, 1);
-                    }
-                    if (filename == "") {
-                        filename = "index.html";
-                    }
-
-                    try {
-                        Resource::getResource(filename);
-                    } catch (const std::out_of_range& out_of_range) {
-                        logError(request, 404, "Not found: " + filename);
-                        HttpResponse response(request.getMethod(), Http::VERSION1_1, 404, "Not Found");
-                        responseSocket.end(response);
-                        return;
-                    }
-
-                    size_t ext = filename.find('.');
-                    type = (ext != std::string::npos)
-                                       ? filename.substr(ext + 1, filename.size() - ext - 1)
-                                       : "";
-                } catch (const OwnException& exception) {
-                    logError(request, 400, "Bad request: " + std::string(exception.what()));
-                    HttpResponse response(request.getMethod(), Http::VERSION1_1, 400, "Bad Request");
-                    responseSocket.end(response);
+                room->waiters.push_back(Waiter{client.userId, session, generation, query.after, query.limit,
+                                               request.getHeader("If-None-Match"), responseSocket,
+                                               std::chrono::steady_clock::now() + std::chrono::seconds(wait)});
+                scheduleRoom(*room, room->waiters.back().deadline);
+                return;
+            }
+            sendMessages(*room, client.session, begin, query.limit, query.after < 0,
+                         request.getHeader("If-None-Match"), responseSocket);
+        } catch (const std::exception& exception) {
+            std::cerr << "Exception while responding to request (method "
+                      << Http::methodToString(request.getMethod()) << ", URL \"" << request.getUri()
+                      << "\"), closing connection: " << exception.what() << "" << std::endl;
+            responseSocket.close();
+        }
+    };
+
+    auto headMessages = [this](const HttpRequest& request, const MessagesQuery& query,
+                               HttpServer::ResponseSocket responseSocket) {
+        try {
+            Client client;
+            if (!identify(request, query.username, client)) {
+                sendUnauthorized(request, responseSocket);
+                return;
+            } else if (!checkLimits(request, responseSocket, POLL_ROUTE, client.session)) {
+                return;
+            } else if (client.username == ADMIN_NAME) {
+                sendBadRequest(request, responseSocket, "Bad request: username Admin");
+                return;
+            }
+            Room* room = findRoom(getRoomName(request));
+            if (room == NULL) {
+                sendRoomNotFound(request, responseSocket);
+                return;
+            }
+
+            // The validators a GET would have, without waiting for messages or marking any read
+            uint64_t begin = findBegin(*room, client.userId, client.session, query.all, query.after);
+            std::string etag = makeEtag(*room, begin, findEnd(*room, begin, query.limit));
+            if (sendNotModified(request.getHeader("If-None-Match"), etag, responseSocket)) {
+                return;
+            }
+            HttpResponse response(request.getMethod(), Http::VERSION1_1, 200, "OK");
+            response.setContentType(Http::APPLICATION_JSON);
+            response.setHeader("ETag", etag);
+            response.setHeader("Cache-Control", "no-cache");
+            responseSocket.end(response);
+        } catch (const std::exception& exception) {
+            std::cerr << "Exception while responding to request (method "
+                      << Http::methodToString(request.getMethod()) << ", URL \"" << request.getUri()
+                      << "\"), closing connection: " << exception.what() << "" << std::endl;
+            responseSocket.close();
+        }
+    };
+
+    auto getEvents = [this](const HttpRequest& request, const EventsQuery& query,
+                            HttpServer::ResponseSocket responseSocket) {
+        try {
+            Client client;
+            if (!identify(request, query.username, client)) {
+                sendUnauthorized(request, responseSocket);
+                return;
+            } else if (!checkLimits(request, responseSocket, POLL_ROUTE, client.session)) {
+                return;
+            }
+            Room* room = findRoom(getRoomName(request));
+            if (room == NULL) {
+                sendRoomNotFound(request, responseSocket);
+                return;
+            } else if (room->firstMessage.find(client.userId) == room->firstMessage.end()) {
+                sendBadRequest(request, responseSocket, "Bad request: unknown username");
+                return;
+            }
+
+            // A reconnecting stream continues after the last message it got
+            uint64_t begin = findFirstMessage(*room, client.userId);
+            uint64_t lastEventId;
+            if (Http::parseNumber(request.getHeader("Last-Event-ID"), lastEventId) && lastEventId >= begin) {
+                begin = std::min(lastEventId + 1, room->history.getNextId());
+            }
+
+            HttpResponse response(request.getMethod(), Http::VERSION1_1, 200, "OK");
+            response.setContentType(Http::TEXT_EVENT_STREAM);
+            response.setHeader("Cache-Control", "no-cache");
+            std::string body = "retry: 1000\n\n";
+            for (uint64_t id = begin; id < room->history.getNextId(); ++id) {
+                appendEvent(body, *room, id);
+            }
+            response.appendBody(body);
+            responseSocket.start(response);
+            addListener(*room);
+            room->subscribers.push_back(responseSocket);
+        } catch (const std::exception& exception) {
+            std::cerr << "Exception while responding to request (method "
+                      << Http::methodToString(request.getMethod()) << ", URL \"" << request.getUri()
+                      << "\"), closing connection: " << exception.what() << "" << std::endl;
+            responseSocket.close();
+        }
+    };
+
+    // Messages go both ways as text frames: every message of the history as JSON from the server,
+    // and {"message": "..."} from the client
+    auto getSocket = [this](const HttpRequest& request, const EventsQuery& query,
+                            HttpServer::ResponseSocket responseSocket) {
+        try {
+            Client client;
+            if (!identify(request, query.username, client)) {
+                sendUnauthorized(request, responseSocket);
+                return;
+            } else if (!checkLimits(request, responseSocket, POLL_ROUTE, client.session)) {
+                return;
+            }
+            Room* room = findRoom(getRoomName(request));
+            if (room == NULL) {
+                sendRoomNotFound(request, responseSocket);
+                return;
+            } else if (room->firstMessage.find(client.userId) == room->firstMessage.end()) {
+                sendBadRequest(request, responseSocket, "Bad request: unknown username");
+                return;
+            }
+
+            // Every socket has a bucket of its own for its messages, the way a session has for its posts
+            std::string username(client.username), host = responseSocket.getRemoteHost();
+            RateLimiter::Bucket bucket = this->settings.sessionLimits[POST_ROUTE].makeBucket(RateLimiter::now());
+            HttpServer::WebSocket webSocket = responseSocket.acceptWebSocket(request,
+                    [this, room, username, host, bucket](HttpServer::WebSocket& webSocket,
+                                                         const std::string& data) mutable {
+                if (takeToken(POST_ROUTE, &bucket, host) != 0) {
+                    std::cout << "Closing the WebSocket of user \"" << username << "\", which sends too much"
+                              << std::endl;
+                    webSocket.close(1008);
                     return;
                 }
+                receiveMessage(*room, username, webSocket, data);
+            });
+            if (!webSocket.isOpened()) {
+                logError(request, 400, "Bad request: not a WebSocket handshake");
+                return;
+            }
+            for (uint64_t id = findFirstMessage(*room, client.userId); id < room->history.getNextId(); ++id) {
+                webSocket.sendText(room->history.get(id).toString());
+            }
+            addListener(*room);
+            room->webSockets.push_back(webSocket);
+        } catch (const std::exception& exception) {
+            std::cerr << "Exception while responding to request (method "
+                      << Http::methodToString(request.getMethod()) << ", URL \"" << request.getUri()
+                      << "\"), closing connection: " << exception.what() << "" << std::endl;
+            responseSocket.close();
+        }
+    };
 
-                HttpResponse response(request.getMethod(), Http::VERSION1_1, 200, "OK");
-                if (!request.shouldKeepAlive()) {
-                    response.setHeader("Connection", "Keep-Alive");
-                }
-                if (type == "js") {
-                    response.setHeader("Content-Type", "application/javascript");
-                } else if (type == "html" || type == "htm") {
-                    response.setHeader("Content-Type", "text/html");
+    HttpServer::RequestHandler postMessage = [this](const HttpRequest& request,
+                                                    HttpServer::ResponseSocket responseSocket) {
+        try {
+            std::string name, message;
+            Client client;
+            if (!parseMessage(request.getBody(), name, message)) {
+                sendBadRequest(request, responseSocket, "Bad request: invalid message payload");
+                return;
+            } else if (!identify(request, name, client)) {
+                sendUnauthorized(request, responseSocket);
+                return;
+            } else if (!checkLimits(request, responseSocket, POST_ROUTE, client.session)) {
+                return;
+            } else if (message == "") {
+                sendBadRequest(request, responseSocket, "Bad request: empty message");
+                return;
+            } else if (client.username == ADMIN_NAME) {
+                sendBadRequest(request, responseSocket, "Bad request: one can't post a message from username Admin");
+                return;
+            }
+            Room* room = findRoom(getRoomName(request));
+            if (room == NULL) {
+                sendRoomNotFound(request, responseSocket);
+                return;
+            }
+
+            std::string username(client.username);
+            std::cout << "User \"" << username << "\" sent message: \"" << message << "\"" << std::endl;
+            uint64_t sequence = addMessage(*room, username, message);
+            if (sequence != 0) {
+                pendingWrites.push_back(PendingWrite{sequence, responseSocket});
+                return;
+            }
+
+            HttpResponse response(request.getMethod(), Http::VERSION1_1, 200, "OK");
+            responseSocket.end(response);
+        } catch (const std::exception& exception) {
+            std::cerr << "Exception while responding to request (method "
+                      << Http::methodToString(request.getMethod()) << ", URL \"" << request.getUri()
+                      << "\"), closing connection: " << exception.what() << "" << std::endl;
+            responseSocket.close();
+        }
+    };
+
+    // The unprefixed routes are the default room's
+    for (const std::string prefix : {"", "/rooms/:room"}) {
+        httpServer.addRouteMatcher(RouteMatcher(Http::Method::POST, prefix + "/login"), login);
+        httpServer.addRoute<MessagesQuery>(RouteMatcher(Http::Method::GET, prefix + "/messages"), getMessages);
+        httpServer.addRoute<MessagesQuery>(RouteMatcher(Http::Method::HEAD, prefix + "/messages"), headMessages);
+        httpServer.addRoute<EventsQuery>(RouteMatcher(Http::Method::GET, prefix + "/events"), getEvents);
+        httpServer.addRoute<EventsQuery>(RouteMatcher(Http::Method::GET, prefix + "/socket"), getSocket);
+        httpServer.addRouteMatcher(RouteMatcher(Http::Method::POST, prefix + "/messages"), postMessage);
+    }
+
+    if (!resourcePath.empty()) {
+        // Files come and go at runtime, so they're only found through the table below
+        resourceDirectory.reset(new ResourceDirectory(resourcePath, poller,
+                                                      [this](const std::string& name, const Resource* resource) {
+            if (resource != NULL) {
+                // Requests being answered keep the replaced body alive through its owner
+                staticResponses.insert_or_assign(name, prepareResponses(*resource));
+            } else {
+                staticResponses.erase(name);
+            }
+        }));
+    } else {
+        // Embedded resources are found through the perfect hash of the generated table, never rehashed
+        embeddedResponses.reserve(Resource::getEmbeddedCount());
+        for (size_t i = 0; i < Resource::getEmbeddedCount(); ++i) {
+            embeddedResponses.push_back(prepareResponses(Resource(Resource::getEmbedded(i))));
+        }
+    }
+
+    HttpServer::RequestHandler fileHandler = [this](const HttpRequest& request,
+                                                    HttpServer::ResponseSocket responseSocket) {
+        try {
+            std::string_view filename = request.getUriPath();
+            if (!filename.empty() && filename[0] == '/') {
+                filename.remove_prefix(1);
+            }
+            if (filename.empty()) {
+                filename = "index.html";
+            }
+
+            const StaticResponses* responses = findResponses(filename);
+            if (responses == NULL) {
+                logError(request, 404, "Not found: " + std::string(filename));
+                HttpResponse response(request.getMethod(), Http::VERSION1_1, 404, "Not Found");
+                response.setContentType(Http::TEXT_HTML);
+                if (request.getMethod() != Http::Method::HEAD) {
+                    response.appendBody("<html>"
+                                                "<head>"
+                                                "<title>The resource isn't found</title>"
+                                                "</head>"
+                                                "<body>"
+                                                "<h1>Not found</h1>"
+                                                "<p>The requested URL " + std::string(request.getUriPath())
+                                        + " was not found on this server.</p>"
+                                                "<hr>"
+                                                "</body>"
+                                                "</html>");
                 }
                 responseSocket.end(response);
-            } catch (const std::exception& exception) {
-                std::cerr << "Exception while responding to request (method "
-                          << Http::methodToString(request.getMethod()) << ", URL \"" << request.getUri()
-                          << "\"), closing connection: " << exception.what() << "" << std::endl;
-                responseSocket.close();
+                return;
             }
-        });
+            sendResource(request, *responses, responseSocket);
+        } catch (const std::exception& exception) {
+            std::cerr << "Exception while responding to request (method "
+                      << Http::methodToString(request.getMethod()) << ", URL \"" << request.getUri()
+                      << "\"), closing connection: " << exception.what() << "" << std::endl;
+            responseSocket.close();
+        }
+    };
+    httpServer.addRouteMatcher(RouteMatcher(Http::Method::GET, "*"), fileHandler);
+    httpServer.addRouteMatcher(RouteMatcher(Http::Method::HEAD, "*"), fileHandler);
+
+    // Long polls expire with a one second resolution
+    tfd = _m1_system_call(timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC),
+                          "Couldn't create a timer fd");
+    try {
+        struct itimerspec its = {};
+        its.it_interval.tv_sec = 1;
+        its.it_value.tv_sec = 1;
+        _m1_system_call(timerfd_settime(tfd, 0, &its, NULL), "Couldn't run the timer fd");
+
+        poller.setHandler(tfd, [this](const epoll_event&) {
+            uint64_t expirations;
+            if (read(tfd, &expirations, sizeof expirations) == -1 && errno != EAGAIN) {
+                std::cerr << "Couldn't read timer fd (fd " << tfd << "): " << strerror(errno) << std::endl;
+            }
+            std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+            if (now - lastSessionSweep >= std::chrono::seconds(SESSION_SWEEP_INTERVAL)) {
+                lastSessionSweep = now;
+                // Rooms first, so the users only they referred to are counted out with the sessions
+                closeIdleRooms(now);
+                evictSessions(now);
+                pruneAddresses(RateLimiter::now());
+            }
+            serveDeadlines(now);
+        }, EPOLLIN);
+    } catch (const std::exception& exception) {
+        ::close(tfd);
+        throw;
+    }
+}
+
+ChatServer::~ChatServer() {
+    try {
+        poller.removeHandler(tfd);
+    } catch (const std::exception& exception) {
+        std::cerr << "Exception while removing the timer fd (fd " << tfd << "): " << exception.what() << std::endl;
+    }
+    ::close(tfd);
 }
@@ -2,40 +2,346 @@
 #define HTTPWEBCHAT_CHATSERVER_H
 
 
+#include <deque>
 #include <fstream>
+#include <set>
+#include <unordered_map>
 
 #include "../resource.h"
+#include "../resource_directory.h"
 #include "../HTTP/http_server.h"
 #include "json.h"
+#include "message_log.h"
+#include "rate_limiter.h"
 
 class ChatServer {
 public:
     static constexpr const char* ADMIN_NAME = "Admin";
+    // The routes without a room prefix serve this one, which always exists
+    static constexpr const char* DEFAULT_ROOM = "main";
+    // Room names are made of letters, digits, '-' and '_'
+    static constexpr size_t MAX_ROOM_NAME_SIZE = 64;
 
-    class Message: public JSON {
-        static std::map<std::string, JSON> makeFields(const std::string&, time_t, const std::string&);
+    // Routes with limits of their own; event streams and WebSockets count as polls, and the messages sent over
+    // a WebSocket as posts. A login creating a room takes a token of NEW_ROOM as well
+    enum LimitedRoute {LOGIN_ROUTE, POST_ROUTE, POLL_ROUTE, NEW_ROOM, LIMITED_ROUTE_COUNT};
+
+    struct Settings {
+        // The oldest messages of a room are dropped once there are more than this many of them, or their JSON
+        // takes more than this many bytes
+        size_t maxHistoryCount;
+        size_t maxHistoryBytes;
+        // The histories of all the rooms together take at most this many bytes: every room gets an equal share,
+        // up to maxHistoryBytes
+        size_t maxTotalHistoryBytes;
+        // Logins to new rooms fail with 400 once there are this many
+        size_t maxRooms;
+        // Rooms other than the default one are closed, history and all, after this many seconds without
+        // requests or listeners; rooms nobody posted to after emptyRoomTimeout
+        unsigned roomTimeout;
+        unsigned emptyRoomTimeout;
+        // Keep where every session stopped reading, for GET /messages without "after"; otherwise it returns
+        // all the messages since the user joined
+        bool trackUnread;
+        // Sessions are dropped after this many seconds without a request
+        unsigned sessionTimeout;
+        // Requests over these get 429, for every route per session and per client address
+        RateLimiter sessionLimits[LIMITED_ROUTE_COUNT];
+        RateLimiter addressLimits[LIMITED_ROUTE_COUNT];
+        // Messages are kept in this file, if it's given, and read back from it at startup; a post is answered
+        // once its message is on the disk
+        std::string logPath;
+
+        Settings();
+    };
+
+    // Serialized once when it's posted; every response is put together from these fragments
+    class Message {
+        std::string json;
+
+        static std::map<std::string, JSON> makeFields(uint64_t, const std::string&, time_t, const std::string&);
+    public:
+        Message(uint64_t, const std::string&, time_t, const std::string&);
+        // Serialized already, as read back from the log
+        explicit Message(const std::string&);
+
+        const std::string& toString() const;
+    };
+
+    // Messages with ids counting from 0, in segments of SEGMENT_SIZE, so dropping the oldest ones never moves
+    // the rest; a segment is freed once all of its messages are dropped
+    class History {
+        std::deque<std::vector<Message>> segments;
+        // The id of the first message of the first segment, and of the oldest one kept
+        uint64_t segmentsStart;
+        uint64_t first;
+        uint64_t next;
+        size_t bytes;
+        size_t maxCount;
+        size_t maxBytes;
+
+        void trim();
     public:
-        Message(const std::string&, time_t, const std::string&);
+        static constexpr size_t SEGMENT_SIZE = 256;
+
+        History(size_t, size_t);
+
+        // The newest message is always kept, however long it is
+        void add(Message);
+        // Drops the oldest messages right away if they take more now
+        void setMaxBytes(size_t);
+        // Drops everything, so the next message gets the id; for picking up where the log ends
+        void restart(uint64_t);
+        // Only the ids from getFirstId() to getNextId() are there
+        const Message& get(uint64_t) const;
+        uint64_t getFirstId() const;
+        uint64_t getNextId() const;
+    };
+
+    // Long polls wait at most this many seconds, whatever they ask for
+    static constexpr unsigned MAX_WAIT = 60;
+    // Event streams get a comment this often, so proxies don't close them; a subscriber with more than
+    // MAX_BACKLOG bytes not taken is disconnected
+    static constexpr unsigned HEARTBEAT_INTERVAL = 15;
+    static constexpr size_t MAX_BACKLOG = 256 << 10;
+    // Logins get a cookie of this name; idle sessions are looked for this often, in seconds
+    static constexpr const char* SESSION_COOKIE = "session";
+    static constexpr unsigned SESSION_SWEEP_INTERVAL = 10;
+    static constexpr uint32_t NO_USER = (uint32_t) -1;
+    static constexpr uint32_t NO_SESSION = (uint32_t) -1;
+
+    // Both for event streams and WebSockets. The username is only looked at without a session cookie. The room
+    // is only ever the one of the route, as for posts, so a query can't name another one
+    struct EventsQuery {
+        std::string username;
+
+        static constexpr auto parameters() {
+            return std::make_tuple(Http::parameter("username", &EventsQuery::username));
+        }
+    };
+
+    struct MessagesQuery {
+        std::string username;
+        bool all = false;
+        // Only messages with greater ids, when it's not negative
+        int64_t after = -1;
+        // At most this many messages, unless it's 0
+        unsigned limit = 0;
+        // Seconds to hold the response back while there's nothing new
+        unsigned wait = 0;
+
+        static constexpr auto parameters() {
+            return std::make_tuple(Http::parameter("username", &MessagesQuery::username),
+                                   Http::parameter("all", &MessagesQuery::all),
+                                   Http::parameter("after", &MessagesQuery::after),
+                                   Http::parameter("limit", &MessagesQuery::limit),
+                                   Http::parameter("wait", &MessagesQuery::wait));
+        }
     };
 
     class Object {
         std::map<std::string, JSON::Type> types;
-        size_t size;
+        std::set<std::string> optional;
+        size_t requiredCount;
     public:
-        Object(const std::map<std::string, JSON::Type>&);
+        Object(const std::map<std::string, JSON::Type>&, const std::set<std::string>& = std::set<std::string>());
 
-        std::map<std::string, JSON> match(const std::string&);
+        // False for invalid JSON, fields other than the expected ones or missing required ones
+        bool match(const std::string&, std::map<std::string, JSON>&) const;
     };
 private:
+    // A username and what refers to it: the sessions logged in with it, the rooms it joined and its polls
+    struct User {
+        std::string name;
+        uint32_t references;
+    };
+
+    // A long poll parked until a message is posted or its deadline passes; its session may be gone by then.
+    // It holds a reference to its user, if there is one
+    struct Waiter {
+        uint32_t userId;
+        uint32_t session;
+        uint32_t generation;
+        int64_t after;
+        unsigned limit;
+        std::string ifNoneMatch;
+        HttpServer::ResponseSocket responseSocket;
+        std::chrono::steady_clock::time_point deadline;
+    };
+
+    // Everything of one room; rooms share nothing, so serving one never costs anything for the others
+    struct Room {
+        std::string name;
+        // Tells apart the rooms which had the name, for entity tags
+        uint64_t serial;
+        History history;
+        // The first message of every user who joined, by user id
+        std::unordered_map<uint32_t, uint64_t> firstMessage;
+        std::vector<Waiter> waiters;
+        std::vector<HttpServer::ResponseSocket> subscribers;
+        std::vector<HttpServer::WebSocket> webSockets;
+        // The last request to the room, or the last sweep which found it listened to
+        std::chrono::steady_clock::time_point lastUsed;
+        // When the timer has to look at the room next, as it's kept in deadlines, or time_point::max() if it
+        // isn't; and when its listeners get the next heartbeat
+        std::chrono::steady_clock::time_point deadline;
+        std::chrono::steady_clock::time_point nextHeartbeat;
+
+        Room(const std::string&, uint64_t, size_t, size_t);
+    };
+
+    // A login, named by its cookie: the index of its slot and a random secret, so finding it takes one lookup
+    // in the table. Slots of sessions which went idle are reused
+    struct Session {
+        uint64_t secret[2];
+        // Tells apart the sessions which had the slot, for the polls outliving one
+        uint32_t generation;
+        // NO_USER while the slot is free
+        uint32_t userId;
+        std::chrono::steady_clock::time_point lastUsed;
+        // Where the session stopped reading in each room, with trackUnread
+        std::vector<std::pair<const Room*, uint64_t>> unread;
+        RateLimiter::Bucket buckets[LIMITED_ROUTE_COUNT];
+    };
+
+    struct AddressBuckets {
+        RateLimiter::Bucket buckets[LIMITED_ROUTE_COUNT];
+    };
+
+    // Who a request comes from: the user of its session, or else the one it names
+    struct Client {
+        std::string_view username;
+        // NO_USER for a name nobody logged in with
+        uint32_t userId;
+        Session* session;
+    };
+
+    // A post answered once its message is durable
+    struct PendingWrite {
+        uint64_t sequence;
+        HttpServer::ResponseSocket responseSocket;
+    };
+
+    // Every response for a resource, serialized at startup
+    struct StaticResponses {
+        Resource resource;
+        HttpResponse::Prepared get[Resource::ENCODING_COUNT];
+        HttpResponse::Prepared head[Resource::ENCODING_COUNT];
+        HttpResponse::Prepared notModified[Resource::ENCODING_COUNT];
+
+        StaticResponses(const Resource&);
+    };
+
+    Settings settings;
     HttpServer httpServer;
-    std::vector<Message> history;
-    std::map<std::string, size_t> firstMessage, firstUnreadMessage;
+    Poller& poller;
+    int tfd;
+    // Rooms are only closed while nothing listens to them, so WebSocket handlers may keep pointers to them
+    std::unordered_map<std::string, std::unique_ptr<Room>> rooms;
+    uint64_t roomCount;
+    // The rooms with waiters or listeners, by their deadlines; the timer only ever walks the ones due
+    std::set<std::pair<std::chrono::steady_clock::time_point, Room*>> deadlines;
+    // Every username is kept once, and everything else refers to users by their index here. Indices of
+    // users nothing refers to anymore are reused
+    std::deque<User> users;
+    std::vector<uint32_t> freeUsers;
+    // Keyed by the names in users, which a deque never moves, so looking a name up copies nothing
+    std::unordered_map<std::string_view, uint32_t> userIds;
+    std::vector<Session> sessions;
+    std::vector<uint32_t> freeSessions;
+    std::chrono::steady_clock::time_point lastSessionSweep;
+    // Buckets of addresses are forgotten once they're full again
+    std::unordered_map<std::string, AddressBuckets> addressBuckets;
+    std::unique_ptr<MessageLog> log;
+    std::deque<PendingWrite> pendingWrites;
+    // The start of every entity tag of messages: ids are reused after a restart without a log
+    std::string etagPrefix;
+    // Of the files of the resource directory
+    std::unordered_map<std::string, StaticResponses> staticResponses;
+    // Of the embedded resources, in the order of their table
+    std::vector<StaticResponses> embeddedResponses;
+    // Only when serving a directory instead of the embedded resources
+    std::unique_ptr<ResourceDirectory> resourceDirectory;
 
-    static std::pair<std::string, std::string> parseMessage(const std::string&);
-    std::string historyAsJson(size_t, size_t);
+    static bool parseMessage(const std::string&, std::string&, std::string&);
+    static bool isValidRoomName(const std::string&);
+    // The room of the route, or the default one for the routes without a room prefix
+    static std::string getRoomName(const HttpRequest&);
+    // NULL if there's no such room; a room found counts as used
+    Room* findRoom(const std::string&);
+    Room& addRoom(const std::string&);
+    // Releases everything of the room; with the log, records it closed, unless it's restoring the close
+    void closeRoom(std::unordered_map<std::string, std::unique_ptr<Room>>::iterator, bool);
+    void closeIdleRooms(std::chrono::steady_clock::time_point);
+    // Moves the room's deadline up to the time given, if that's earlier
+    void scheduleRoom(Room&, std::chrono::steady_clock::time_point);
+    // Sets the room's deadline from its earliest waiter and its heartbeat, or takes the room out of deadlines
+    void rescheduleRoom(Room&);
+    // Starts the heartbeats of a room getting its first listener
+    void addListener(Room&);
+    // Expires the waiters, sends the heartbeat and drops closed WebSockets of the rooms due
+    void serveDeadlines(std::chrono::steady_clock::time_point);
+    // Shares maxTotalHistoryBytes out among the rooms again
+    void resizeHistories();
+    // A new user has no references until something takes one
+    uint32_t internUser(std::string_view);
+    uint32_t findUser(std::string_view) const;
+    void acquireUser(uint32_t);
+    // Frees the user with its last reference; NO_USER is ignored
+    void releaseUser(uint32_t);
+    // Fills the token for the cookie in
+    Session& openSession(uint32_t, std::string&);
+    // The session of the request's cookie, if it's still there, marked as used
+    Session* findSession(const HttpRequest&);
+    Session* getSession(uint32_t, uint32_t);
+    // False if the request has neither a session nor a username
+    bool identify(const HttpRequest&, std::string_view, Client&);
+    void evictSessions(std::chrono::steady_clock::time_point);
+    // Takes a token for the route from the bucket, unless it's NULL, and from the one of the address; returns 0,
+    // or the seconds until both have a token, taking none then
+    unsigned takeToken(LimitedRoute, RateLimiter::Bucket*, const std::string&);
+    // Answers with 429 and returns false if the request is over a limit
+    bool checkLimits(const HttpRequest&, HttpServer::ResponseSocket&, LimitedRoute, Session*);
+    void pruneAddresses(uint32_t);
+    static std::string historyAsJson(const Room&, uint64_t, uint64_t);
+    // Returns the sequence of its log record, or 0 without a log
+    uint64_t addMessage(Room&, const std::string&, const std::string&);
+    void restoreRecord(MessageLog::RecordType, const std::string&, uint64_t, const char*, size_t);
+    void completeWrites(uint64_t);
+    static uint64_t findFirstMessage(const Room&, uint32_t);
+    uint64_t findBegin(const Room&, uint32_t, const Session*, bool, int64_t) const;
+    // Past the last message sent from the beginning, at most the limit of them if it isn't 0
+    static uint64_t findEnd(const Room&, uint64_t, unsigned);
+    // The tag of the messages of the room with ids in the range
+    std::string makeEtag(const Room&, uint64_t, uint64_t) const;
+    // Answers with 304 if the request's If-None-Match has the tag
+    static bool sendNotModified(const std::string&, const std::string&, HttpServer::ResponseSocket&);
+    // Answers with 304 and no JSON at all when the request's If-None-Match has the tag of the messages
+    void sendMessages(Room&, Session*, uint64_t, unsigned, bool, const std::string&, HttpServer::ResponseSocket&);
+    static void appendEvent(std::string&, const Room&, uint64_t);
+    static void publish(Room&, const std::string&);
+    static void broadcast(Room&, const std::string&);
+    void receiveMessage(Room&, const std::string&, HttpServer::WebSocket&, const std::string&);
+    void notifyWaiters(Room&);
+    void expireWaiters(Room&);
     static void logError(const HttpRequest&, int, const std::string&);
+    static void sendBadRequest(const HttpRequest&, HttpServer::ResponseSocket&, const char*);
+    static void sendRoomNotFound(const HttpRequest&, HttpServer::ResponseSocket&);
+    static void sendUnauthorized(const HttpRequest&, HttpServer::ResponseSocket&);
+    static void sendTooManyRequests(const HttpRequest&, HttpServer::ResponseSocket&, unsigned);
+    static bool isNotModified(const HttpRequest&, const Resource&, Resource::Encoding);
+    static void setCacheHeaders(HttpResponse&, const Resource&, Resource::Encoding);
+    static StaticResponses prepareResponses(const Resource&);
+    // NULL if there's no such resource
+    const StaticResponses* findResponses(std::string_view) const;
+    static void sendResource(const HttpRequest&, const StaticResponses&, HttpServer::ResponseSocket);
 public:
-    ChatServer(uint16_t, Poller&);
+    // Serves the files under the path, reloading them when they change, if it's given
+    ChatServer(uint16_t, Poller&, const std::string& = "", const Settings& = Settings());
+    ~ChatServer();
+
+    ChatServer(const ChatServer&) = delete;
+    ChatServer& operator=(const ChatServer&) = delete;
 };
 
 
@@ -1,3 +1,5 @@
+#include <charconv>
+
 #include "json.h"
 
 JSON::JSON(): type(NULL_VALUE) {}
@@ -83,75 +85,97 @@ JSON& JSON::operator=(const JSON& rhs)
     return *this;
 }
 
-JSON JSON::readNumber(const std::string& data, size_t& cur, bool isNegative) {
-    std::string numberAsString = (isNegative ? "-" : "");
-    if (data[cur] == '0') {
-        if (data[cur + 1] >= '0' && data[cur + 1] <= '9') {
-            throw OwnException("Wrong JSON (number starting with 0) at symbol " + std::to_string(cur) + ": \""
-                                     + data + "\"");
-        } else {
-            numberAsString += data[cur++];
+namespace {
+    void skipWhitespace(const std::string& data, size_t& cur) {
+        for (; cur < data.size()
+               && (data[cur] == ' ' || data[cur] == '\t' || data[cur] == '\r' || data[cur] == '\n'); ++cur);
+    }
+
+    bool fail(JSON::ParseError& error, const char* reason, size_t position) {
+        error.reason = reason;
+        error.position = position;
+        return false;
+    }
+}
+
+std::string JSON::ParseError::describe(const std::string& data) const {
+    // Bodies may be large, so only the part around the error is quoted
+    const size_t CONTEXT = 16;
+    size_t begin = (position > CONTEXT) ? position - CONTEXT : 0;
+    std::string excerpt = data.substr(begin, 2 * CONTEXT);
+    return "Wrong JSON (" + std::string(reason) + ") at symbol " + std::to_string(position) + ": \""
+           + (begin > 0 ? "..." : "") + excerpt + (begin + excerpt.size() < data.size() ? "..." : "") + "\"";
+}
+
+bool JSON::readNumber(const std::string& data, size_t& cur, JSON& result, ParseError& error) {
+    size_t begin = cur;
+    if (data[cur] == '-') {
+        ++cur;
+    }
+    if (cur == data.size()) {
+        return fail(error, "unfinished", cur);
+    } else if (data[cur] == '0') {
+        if (cur + 1 < data.size() && data[cur + 1] >= '0' && data[cur + 1] <= '9') {
+            return fail(error, "number starting with 0", cur);
         }
+        ++cur;
     } else if (data[cur] >= '1' && data[cur] <= '9') {
-        for (; cur < data.size() && data[cur] >= '0' && data[cur] <= '9'; ++cur) {
-            numberAsString += data[cur];
-        }
+        for (; cur < data.size() && data[cur] >= '0' && data[cur] <= '9'; ++cur);
     } else {
-        throw OwnException("Wrong JSON (pure minus) at symbol " + std::to_string(cur) + ": \"" + data + "\"");
+        return fail(error, "pure minus", cur);
     }
 
-    if (data[cur] != '.') {
-        return JSON(std::stol(numberAsString));
-    } else {
-        numberAsString += data[cur++];
-        if (cur == data.size()) {
-            throw OwnException("Wrong JSON (unfinished): " + data);
+    if (cur == data.size() || data[cur] != '.') {
+        long value;
+        std::from_chars_result parsed = std::from_chars(data.data() + begin, data.data() + cur, value);
+        if (parsed.ec != std::errc()) {
+            return fail(error, "number is too large", begin);
         }
-        for (; cur < data.size() && data[cur] >= '0' && data[cur] <= '9'; ++cur) {
-            numberAsString += data[cur];
-        }
-        return JSON(std::stod(numberAsString));
+        result = JSON(value);
+        return true;
+    }
+
+    if (++cur == data.size()) {
+        return fail(error, "unfinished", cur);
+    }
+    for (; cur < data.size() && data[cur] >= '0' && data[cur] <= '9'; ++cur);
+    double value;
+    std::from_chars_result parsed = std::from_chars(data.data() + begin, data.data() + cur, value);
+    if (parsed.ec != std::errc()) {
+        return fail(error, "number is out of range", begin);
     }
+    result = JSON(value);
+    return true;
 }
 
-JSON JSON::_parseJSON(const std::string& data, size_t& cur) {
-    for (; cur < data.size()
-           && (data[cur] == ' ' || data[cur] == '\t' || data[cur] == '\r' || data[cur] == '\n'); ++cur);
+bool JSON::_parseJSON(const std::string& data, size_t& cur, JSON& result, ParseError& error, unsigned depth) {
+    skipWhitespace(data, cur);
     if (cur == data.size()) {
-        throw OwnException("Wrong JSON (unfinished): " + data);
+        return fail(error, "unfinished", cur);
     }
     if (data[cur] == 'n') {
-        if (data[cur + 1] == 'u' && data[cur + 2] == 'l' && data[cur + 3] == 'l') {
-            cur += 4;
-            return JSON();
-        } else {
-            throw OwnException("Wrong JSON (couln't parse null) at symbol " + std::to_string(cur) + ": \""
-                                     + data + "\"");
+        if (data.compare(cur, 4, "null") != 0) {
+            return fail(error, "couldn't parse null", cur);
         }
+        cur += 4;
+        result = JSON();
+        return true;
     } else if (data[cur] == 't') {
-        if (data[cur + 1] == 'r' && data[cur + 2] == 'u' && data[cur + 3] == 'e') {
-            cur += 4;
-            return JSON(true);
-        } else {
-            throw OwnException("Wrong JSON (couldn't parse true) at symbol " + std::to_string(cur) + ": \""
-                                     + data + "\"");
+        if (data.compare(cur, 4, "true") != 0) {
+            return fail(error, "couldn't parse true", cur);
         }
+        cur += 4;
+        result = JSON(true);
+        return true;
     } else if (data[cur] == 'f') {
-        if (data[cur + 1] == 'a' && data[cur + 2] == 'l' && data[cur + 3] == 's' && data[cur + 4] == 'e') {
-            cur += 5;
-            return JSON(false);
-        } else {
-            throw OwnException("Wrong JSON (couldn't parse false) at symbol " + std::to_string(cur) + ": \""
-                                     + data + "\"");
+        if (data.compare(cur, 5, "false") != 0) {
+            return fail(error, "couldn't parse false", cur);
         }
-    } else if (data[cur] == '-') {
-        if (++cur == data.size()) {
-            throw OwnException("Wrong JSON (unfinished): " + data);
-        } else {
-            return readNumber(data, cur, true);
-        }
-    } else if (data[cur] >= '0' && data[cur] <= '9') {
-        return readNumber(data, cur, false);
+        cur += 5;
+        result = JSON(false);
+        return true;
+    } else if (data[cur] == '-' || (data[cur] >= '0' && data[cur] <= '9')) {
+        return readNumber(data, cur, result, error);
     } else if (data[cur] == '\"') {
         ++cur;
 
@@ -160,134 +184,114 @@ JSON JSON::_parseJSON(const std::string& data, size_t& cur) {
         for (fnes = cur; cur < data.size() && data[cur] != '\"'; ++cur) {
             if (data[cur] == '\\') {
                 if (fnes < cur) {
-                    string += data.substr(fnes, cur - fnes);
+                    string.append(data, fnes, cur - fnes);
                 }
-                if (data[cur + 1] == '"') {
+                char escaped = (cur + 1 < data.size()) ? data[cur + 1] : '\0';
+                if (escaped == '"') {
                     string += '"';
-                } else if (data[cur + 1] == 'n') {
+                } else if (escaped == 'n') {
                     string += '\n';
-                } else if (data[cur + 1] == '\\') {
+                } else if (escaped == '\\') {
                     string += '\\';
-                } else if (data[cur + 1] == 't') {
+                } else if (escaped == 't') {
                     string += '\t';
-                } else if (data[cur + 1] == 'r') {
+                } else if (escaped == 'r') {
                     string += '\r';
-                } else if (data[cur + 1] == 'b') {
+                } else if (escaped == 'b') {
                     string += '\b';
-                } else if (data[cur + 1] == 'f') {
+                } else if (escaped == 'f') {
                     string += '\f';
-                } else if (data[cur + 1] == '/') {
+                } else if (escaped == '/') {
                     string += '/';
                 } else {
-                    throw OwnException("Wrong JSON (invalid escape sequence) at symbol "
-                                             + std::to_string(cur + 1) + ": \"" + data + "\"");
+                    return fail(error, "invalid escape sequence", cur + 1);
                 }
                 fnes = cur + 2;
                 ++cur;
             }
         }
-        if (fnes < cur) {
-            string += data.substr(fnes, cur - fnes);
-        }
-
         if (cur == data.size()) {
-            throw OwnException("Wrong JSON (unfinished): " + data);
-        } else {
-            ++cur;
-            return JSON(string);
+            return fail(error, "unfinished", cur);
+        }
+        if (fnes < cur) {
+            string.append(data, fnes, cur - fnes);
         }
+        ++cur;
+        result = JSON(string);
+        return true;
+    } else if ((data[cur] == '[' || data[cur] == '{') && depth == MAX_DEPTH) {
+        return fail(error, "nested too deep", cur);
     } else if (data[cur] == '[') {
         ++cur;
 
         std::vector<JSON> arrayElements;
-        while (cur < data.size() && data[cur] != ']') {
-            for (; cur < data.size()
-                   && (data[cur] == ' ' || data[cur] == '\t' || data[cur] == '\r' || data[cur] == '\n'); ++cur);
-            if (cur == data.size()) {
-                throw OwnException("Wrong JSON (unfinished): " + data);
+        skipWhitespace(data, cur);
+        if (cur < data.size() && data[cur] == ']') {
+            ++cur;
+            result = JSON(arrayElements);
+            return true;
+        }
+        while (true) {
+            arrayElements.push_back(JSON());
+            if (!_parseJSON(data, cur, arrayElements.back(), error, depth + 1)) {
+                return false;
             }
 
-            arrayElements.push_back(_parseJSON(data, cur));
-
-            for (; cur < data.size()
-                   && (data[cur] == ' ' || data[cur] == '\t' || data[cur] == '\r' || data[cur] == '\n'); ++cur);
+            skipWhitespace(data, cur);
             if (cur == data.size()) {
-                throw OwnException("Wrong JSON (unfinished): " + data);
-            }
-
-            if (data[cur] == ']') {
-                break;
+                return fail(error, "unfinished", cur);
+            } else if (data[cur] == ']') {
+                ++cur;
+                result = JSON(arrayElements);
+                return true;
             } else if (data[cur++] != ',') {
-                throw OwnException("Wrong JSON (should be comma in array) at symbol " + std::to_string(cur)
-                                         + ": \"" + data + "\"");
+                return fail(error, "should be comma in array", cur - 1);
             }
         }
-
-        if (cur == data.size()) {
-            throw OwnException("Wrong JSON (unfinished): " + data);
-        } else {
-            ++cur;
-            return JSON(arrayElements);
-        }
     } else if (data[cur] == '{') {
         ++cur;
 
         std::map<std::string, JSON> objectValues;
-        while (cur < data.size() && data[cur] != ']') {
-            for (; cur < data.size()
-                   && (data[cur] == ' ' || data[cur] == '\t' || data[cur] == '\r' || data[cur] == '\n'); ++cur);
-            if (cur == data.size()) {
-                throw OwnException("Wrong JSON (unfinished): " + data);
-            }
-
-            JSON key = _parseJSON(data, cur);
-            if (key.getType() != STRING) {
-                throw OwnException("Wrong JSON (key type isn't a string) at symbol " + std::to_string(cur)
-                                         + ": \"" + data + "\"");
+        skipWhitespace(data, cur);
+        if (cur < data.size() && data[cur] == '}') {
+            ++cur;
+            result = JSON(objectValues);
+            return true;
+        }
+        while (true) {
+            JSON key;
+            skipWhitespace(data, cur);
+            size_t keyStart = cur;
+            if (!_parseJSON(data, cur, key, error, depth + 1)) {
+                return false;
+            } else if (key.getType() != STRING) {
+                return fail(error, "key type isn't a string", keyStart);
             }
 
-            for (; cur < data.size()
-                   && (data[cur] == ' ' || data[cur] == '\t' || data[cur] == '\r' || data[cur] == '\n'); ++cur);
+            skipWhitespace(data, cur);
             if (cur == data.size()) {
-                throw OwnException("Wrong JSON (unfinished): " + data);
+                return fail(error, "unfinished", cur);
             } else if (data[cur++] != ':') {
-                throw OwnException("Wrong JSON (should be colon between key and value in object) at symbol "
-                                         + std::to_string(cur) + ": \"" + data + "\"");
-            }
-            for (; cur < data.size()
-                   && (data[cur] == ' ' || data[cur] == '\t' || data[cur] == '\r' || data[cur] == '\n'); ++cur);
-            if (cur == data.size()) {
-                throw OwnException("Wrong JSON (unfinished): " + data);
+                return fail(error, "should be colon between key and value in object", cur - 1);
             }
 
-            JSON value = _parseJSON(data, cur);
-            objectValues[key.stringValue] = value;
-
-            for (; cur < data.size()
-                   && (data[cur] == ' ' || data[cur] == '\t' || data[cur] == '\r' || data[cur] == '\n'); ++cur);
-            if (cur == data.size()) {
-                throw OwnException("Wrong JSON (unfinished): " + data);
+            if (!_parseJSON(data, cur, objectValues[key.stringValue], error, depth + 1)) {
+                return false;
             }
 
+            skipWhitespace(data, cur);
             if (cur == data.size()) {
-                throw OwnException("Wrong JSON (unfinished): " + data);
+                return fail(error, "unfinished", cur);
             } else if (data[cur] == '}') {
-                break;
+                ++cur;
+                result = JSON(objectValues);
+                return true;
             } else if (data[cur++] != ',') {
-                throw OwnException("Wrong JSON (should be comma in object) at symbol " + std::to_string(cur)
-                                         + ": \"" + data + "\"");
+                return fail(error, "should be comma in object", cur - 1);
             }
         }
-
-        if (cur == data.size()) {
-            throw OwnException("Wrong JSON (unfinished): " + data);
-        } else {
-            ++cur;
-            return JSON(objectValues);
-        }
     } else {
-        throw OwnException("Wrong JSON (new entity isn't parsable) at symbol " + std::to_string(cur) + ": \""
-                                 + data + "\"");
+        return fail(error, "new entity isn't parsable", cur);
     }
 }
 
@@ -360,17 +364,25 @@ void JSON::clear()
     type = JSON::NULL_VALUE;
 }
 
-JSON JSON::parseJSON(const std::string& data) {
+bool JSON::parseJSON(const std::string& data, JSON& result, ParseError& error) {
     size_t cur = 0;
-    JSON object = _parseJSON(data, cur);
-    for (; cur < data.size()
-           && (data[cur] == ' ' || data[cur] == '\t' || data[cur] == '\r' || data[cur] == '\n'); ++cur);
+    if (!_parseJSON(data, cur, result, error, 0)) {
+        return false;
+    }
+    skipWhitespace(data, cur);
     if (cur != data.size()) {
-        throw OwnException("Wrong JSON (unsuspected end of JSON) at symbol " + std::to_string(cur) + ": \""
-                                 + data + "\"");
-    } else {
-        return object;
+        return fail(error, "unsuspected end of JSON", cur);
+    }
+    return true;
+}
+
+JSON JSON::parseJSON(const std::string& data) {
+    JSON result;
+    ParseError error;
+    if (!parseJSON(data, result, error)) {
+        throw OwnException(error.describe(data));
     }
+    return result;
 }
 
 std::string JSON::toString() const {
@@ -10,6 +10,16 @@
 class JSON {
 public:
     enum Type {NULL_VALUE, BOOLEAN, INTEGER, DOUBLE, STRING, ARRAY, OBJECT};
+    // Arrays and objects nested deeper fail to parse; every level takes a recursive call
+    static const unsigned MAX_DEPTH = 64;
+
+    // Where parsing stopped and why; the message is only formatted on demand
+    struct ParseError {
+        const char* reason;
+        size_t position;
+
+        std::string describe(const std::string&) const;
+    };
 private:
     Type type;
 
@@ -23,8 +33,9 @@ private:
         std::map<std::string, JSON> objectValue;
     };
 
-    static JSON readNumber(const std::string&, size_t&, bool);
-    static JSON _parseJSON(const std::string&, size_t&);
+    static bool readNumber(const std::string&, size_t&, JSON&, ParseError&);
+    // Takes the depth of the value being parsed
+    static bool _parseJSON(const std::string&, size_t&, JSON&, ParseError&, unsigned);
 public:
     JSON();
     JSON(bool);
@@ -49,6 +60,7 @@ public:
     void clear();
 
     static JSON parseJSON(const std::string&);
+    static bool parseJSON(const std::string&, JSON&, ParseError&);
     std::string toString() const;
 };
 
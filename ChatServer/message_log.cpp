@@ -0,0 +1,370 @@
+#include <fcntl.h>
+#include <libgen.h>
+#include <zlib.h>
+
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "message_log.h"
+
+namespace {
+    // The type, the id, the first kept id and the room size come before the room and the data
+    const size_t BODY_PREFIX_SIZE = 18;
+    // The snapshot is written in pieces of about this size
+    const size_t COPY_BUFFER_SIZE = 1 << 20;
+
+    void appendUint(std::string& output, uint64_t value, int size) {
+        for (int i = size - 1; i >= 0; --i) {
+            output += (char) (value >> (i * 8));
+        }
+    }
+
+    uint64_t readUint(const char* data, int size) {
+        uint64_t value = 0;
+        for (int i = 0; i < size; ++i) {
+            value = (value << 8) | (uint8_t) data[i];
+        }
+        return value;
+    }
+
+    void writeAll(int fd, const char* data, size_t size, const std::string& path) {
+        while (size > 0) {
+            ssize_t writtenCount = write(fd, data, size);
+            if (writtenCount == -1 && errno == EINTR) {
+                continue;
+            }
+            _m1_system_call(writtenCount, "Couldn't write into \"" + path + "\"");
+            data += writtenCount;
+            size -= writtenCount;
+        }
+    }
+
+    void notify(int fd) {
+        uint64_t value = 1;
+        _m1_system_call(write(fd, &value, sizeof value), "Couldn't signal an event fd");
+    }
+}
+
+const size_t MessageLog::HEADER_SIZE = 8;
+const uint64_t MessageLog::MIN_COMPACTION_SIZE = 4 << 20;
+const size_t MessageLog::MAX_ROOM_SIZE = 255;
+
+MessageLog::MessageLog(const std::string& path, Poller& poller, const RecordHandler& recordHandler,
+                       const SyncHandler& syncHandler):
+        path(path), poller(poller), syncHandler(syncHandler), fd(-1), syncedFd(-1), queuedSequence(0),
+        stopping(false), syncedSequence(0), failed(false), size(0), keptSize(0) {
+    try {
+        fd = _m1_system_call(open(path.c_str(), O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644),
+                             "Couldn't open the message log \"" + path + "\"");
+        syncedFd = _m1_system_call(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC), "Couldn't create an event fd");
+
+        recover(recordHandler);
+
+        poller.setHandler(syncedFd, [this](const epoll_event&) {
+            uint64_t value;
+            if (read(syncedFd, &value, sizeof value) == -1 && errno != EAGAIN) {
+                std::cerr << "Couldn't read event fd (fd " << syncedFd << "): " << strerror(errno) << std::endl;
+            }
+            processSynced();
+        }, EPOLLIN);
+    } catch (const std::exception& exception) {
+        for (int openedFd : {fd, syncedFd}) {
+            if (openedFd != -1) {
+                close(openedFd);
+            }
+        }
+        throw;
+    }
+
+    worker = std::thread(&MessageLog::run, this);
+}
+
+MessageLog::~MessageLog() {
+    // Whatever is queued still gets written
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    queued.notify_one();
+    worker.join();
+
+    try {
+        poller.removeHandler(syncedFd);
+    } catch (const std::exception& exception) {
+        std::cerr << "Exception while removing the message log event fd: " << exception.what() << std::endl;
+    }
+    close(fd);
+    close(syncedFd);
+}
+
+void MessageLog::appendRecord(std::string& output, RecordType type, const std::string& room, uint64_t id,
+                              uint64_t firstKept, const char* data, size_t size) {
+    std::string body;
+    body.reserve(BODY_PREFIX_SIZE + room.size() + size);
+    appendUint(body, type, 1);
+    appendUint(body, id, 8);
+    appendUint(body, firstKept, 8);
+    appendUint(body, room.size(), 1);
+    body += room;
+    body.append(data, size);
+
+    appendUint(output, body.size(), 4);
+    appendUint(output, crc32(0, (const Bytef*) body.data(), body.size()), 4);
+    output += body;
+}
+
+bool MessageLog::readRecord(const char* data, size_t available, Record& record, bool verified) {
+    if (available < HEADER_SIZE) {
+        return false;
+    }
+    uint64_t bodySize = readUint(data, 4);
+    const char* body = data + HEADER_SIZE;
+    if (bodySize < BODY_PREFIX_SIZE || available - HEADER_SIZE < bodySize
+        || (!verified && crc32(0, (const Bytef*) body, bodySize) != readUint(data + 4, 4))) {
+        return false;
+    }
+    size_t roomSize = (uint8_t) body[17];
+    if (bodySize - BODY_PREFIX_SIZE < roomSize) {
+        return false;
+    }
+
+    record.type = (RecordType) (uint8_t) body[0];
+    record.id = readUint(body + 1, 8);
+    record.firstKept = readUint(body + 9, 8);
+    record.room = std::string_view(body + BODY_PREFIX_SIZE, roomSize);
+    record.data = std::string_view(body + BODY_PREFIX_SIZE + roomSize, bodySize - BODY_PREFIX_SIZE - roomSize);
+    record.size = HEADER_SIZE + bodySize;
+    return true;
+}
+
+void MessageLog::recover(const RecordHandler& recordHandler) {
+    struct stat status;
+    _m1_system_call(fstat(fd, &status), "Couldn't get the size of \"" + path + "\"");
+    if (status.st_size == 0) {
+        return;
+    }
+
+    // Faulting the whole file in at once beats taking a fault per page during the scan
+    const char* data = (const char*) mmap(NULL, status.st_size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+    if (data == MAP_FAILED) {
+        throw OwnException("Couldn't map \"" + path + "\" - " + strerror(errno));
+    }
+
+    // A crash may leave a record half-written, and the file is only good up to it
+    uint64_t end = status.st_size;
+    Record record;
+    while (readRecord(data + size, end - size, record, false)) {
+        track(record, size);
+        recordHandler(record.type, std::string(record.room), record.id, record.data.data(), record.data.size());
+        size += record.size;
+    }
+    munmap((void*) data, status.st_size);
+
+    if (size != end) {
+        std::cerr << "Message log \"" << path << "\" is damaged after byte " << size << ", cutting "
+                  << end - size << " bytes off" << std::endl;
+        _m1_system_call(ftruncate(fd, size), "Couldn't truncate \"" + path + "\"");
+    }
+}
+
+uint64_t MessageLog::append(RecordType type, const std::string& room, uint64_t id, const std::string& data,
+                            uint64_t firstKept) {
+    if (room.size() > MAX_ROOM_SIZE) {
+        throw OwnException("Room name \"" + room + "\" is too long for the message log");
+    }
+
+    uint64_t sequence;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        appendRecord(queue, type, room, id, firstKept, data.data(), data.size());
+        sequence = ++queuedSequence;
+    }
+    queued.notify_one();
+    return sequence;
+}
+
+bool MessageLog::hasFailed() {
+    std::lock_guard<std::mutex> lock(syncedMutex);
+    return failed;
+}
+
+void MessageLog::track(const Record& record, uint64_t offset) {
+    std::string roomName(record.room);
+    std::unordered_map<std::string, Room>::iterator it = rooms.find(roomName);
+    if (record.type == CLOSE) {
+        if (it != rooms.end()) {
+            for (const std::pair<uint64_t, size_t>& message : it->second.messages) {
+                keptSize -= message.second;
+            }
+            rooms.erase(it);
+        }
+        return;
+    } else if (it == rooms.end()) {
+        it = rooms.insert(std::make_pair(roomName, Room{offset, {}, {}})).first;
+    }
+
+    Room& room = it->second;
+    if (record.type == JOIN) {
+        room.joins[std::string(record.data)] = record.id;
+        return;
+    }
+
+    room.messages.push_back(std::make_pair(record.id, record.size));
+    keptSize += record.size;
+    while (!room.messages.empty() && room.messages.front().first < record.firstKept) {
+        keptSize -= room.messages.front().second;
+        room.messages.pop_front();
+    }
+}
+
+void MessageLog::compact() {
+    // Only worth it once at least half of the file is dropped messages
+    if (size < MIN_COMPACTION_SIZE || keptSize > size / 2) {
+        return;
+    }
+
+    std::string snapshot;
+    for (std::unordered_map<std::string, Room>::const_iterator room = rooms.begin(); room != rooms.end(); ++room) {
+        for (std::map<std::string, uint64_t>::const_iterator it = room->second.joins.begin();
+             it != room->second.joins.end(); ++it) {
+            appendRecord(snapshot, JOIN, room->first, it->second, 0, it->first.data(), it->first.size());
+        }
+    }
+    uint64_t snapshotSize = snapshot.size() + keptSize;
+
+    const char* data = (const char*) mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED) {
+        throw OwnException("Couldn't map \"" + path + "\" - " + strerror(errno));
+    }
+    std::string temporaryPath = path + ".tmp";
+    int snapshotFd = -1;
+    try {
+        snapshotFd = _m1_system_call(open(temporaryPath.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC,
+                                          0644), "Couldn't create \"" + temporaryPath + "\"");
+
+        // Rooms drop messages at their own pace, so the kept ones are picked record by record rather than as
+        // one range, which a quiet room would hold open back to its oldest message
+        Record record;
+        std::string roomName;
+        std::unordered_map<std::string, Room>::const_iterator room = rooms.end();
+        for (uint64_t offset = 0; offset < size; offset += record.size) {
+            if (!readRecord(data + offset, size - offset, record, true)) {
+                throw OwnException("Record at byte " + std::to_string(offset) + " of \"" + path
+                                   + "\" can't be read back");
+            }
+            if (record.type != MESSAGE) {
+                continue;
+            }
+            if (room == rooms.end() || record.room != roomName) {
+                roomName = record.room;
+                room = rooms.find(roomName);
+            }
+            // Closed rooms are gone, and one opened again only has the records after its start
+            if (room != rooms.end() && offset >= room->second.start && !room->second.messages.empty()
+                && record.id >= room->second.messages.front().first) {
+                snapshot.append(data + offset, record.size);
+            }
+            if (snapshot.size() >= COPY_BUFFER_SIZE) {
+                writeAll(snapshotFd, snapshot.data(), snapshot.size(), temporaryPath);
+                snapshot.clear();
+            }
+        }
+        writeAll(snapshotFd, snapshot.data(), snapshot.size(), temporaryPath);
+        _m1_system_call(fdatasync(snapshotFd), "Couldn't sync \"" + temporaryPath + "\"");
+        _m1_system_call(rename(temporaryPath.c_str(), path.c_str()),
+                        "Couldn't replace \"" + path + "\" with its snapshot");
+    } catch (const std::exception& exception) {
+        munmap((void*) data, size);
+        if (snapshotFd != -1) {
+            close(snapshotFd);
+            unlink(temporaryPath.c_str());
+        }
+        throw;
+    }
+    munmap((void*) data, size);
+
+    // The rename itself is only durable once the directory is synced
+    std::string directoryPath = path;
+    int directoryFd = open(dirname(&directoryPath[0]), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (directoryFd != -1) {
+        fsync(directoryFd);
+        close(directoryFd);
+    }
+
+    close(fd);
+    fd = snapshotFd;
+    for (std::unordered_map<std::string, Room>::iterator it = rooms.begin(); it != rooms.end(); ++it) {
+        it->second.start = 0;
+    }
+    std::cout << "Message log compacted from " << size << " to " << snapshotSize << " bytes" << std::endl;
+    size = snapshotSize;
+}
+
+void MessageLog::run() {
+    std::string batch;
+    while (true) {
+        uint64_t sequence;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            queued.wait(lock, [this] {
+                return !queue.empty() || stopping;
+            });
+            if (queue.empty()) {
+                return;
+            }
+            batch.clear();
+            batch.swap(queue);
+            sequence = queuedSequence;
+        }
+
+        // Everything appended meanwhile is made durable by the same sync
+        bool ok = !hasFailed();
+        if (ok) {
+            try {
+                writeAll(fd, batch.data(), batch.size(), path);
+                _m1_system_call(fdatasync(fd), "Couldn't sync \"" + path + "\"");
+            } catch (const std::exception& exception) {
+                std::cerr << "Message log stopped: " << exception.what() << std::endl;
+                ok = false;
+            }
+        }
+        if (ok) {
+            Record record;
+            for (size_t position = 0; position < batch.size(); position += record.size) {
+                readRecord(batch.data() + position, batch.size() - position, record, true);
+                track(record, size + position);
+            }
+            size += batch.size();
+        }
+
+        // Waiting writers are answered first: compacting copies the whole log and isn't what they wait for
+        {
+            std::lock_guard<std::mutex> lock(syncedMutex);
+            syncedSequence = sequence;
+            failed = failed || !ok;
+        }
+        try {
+            notify(syncedFd);
+        } catch (const std::exception& exception) {
+            std::cerr << "Exception while signaling a message log sync: " << exception.what() << std::endl;
+        }
+
+        if (ok) {
+            try {
+                compact();
+            } catch (const std::exception& exception) {
+                std::cerr << "Couldn't compact the message log: " << exception.what() << std::endl;
+            }
+        }
+    }
+}
+
+void MessageLog::processSynced() {
+    uint64_t sequence;
+    {
+        std::lock_guard<std::mutex> lock(syncedMutex);
+        sequence = syncedSequence;
+    }
+    syncHandler(sequence);
+}
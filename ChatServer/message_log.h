@@ -0,0 +1,105 @@
+#ifndef HTTPWEBCHAT_MESSAGELOG_H
+#define HTTPWEBCHAT_MESSAGELOG_H
+
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+
+#include "../poller.h"
+
+// An append-only file of chat records, each one a header of its size and CRC-32 followed by its type, id, room
+// and data; a message also carries the first id its room kept then. Appending only queues the record; a worker
+// thread writes everything queued with one write() and one fdatasync() (group commit) and then tells the event
+// loop how far the file is durable. Once most of the file is messages dropped from the histories, the worker
+// rewrites it as a snapshot: the joins, then the records of the kept messages, replacing the old file atomically
+// with rename(). So the file stays about as long as the histories, and reading it back at startup is a scan over
+// a mapping of it. A closed room drops out of the snapshot with everything of it.
+class MessageLog {
+public:
+    enum RecordType {MESSAGE = 1, JOIN, CLOSE};
+
+    // Gets every valid record in order at startup; a torn or corrupt tail is cut off
+    typedef std::function<void(RecordType, const std::string&, uint64_t, const char*, size_t)> RecordHandler;
+    // Gets the sequence of the last durable append, or of the last one at all once writing failed;
+    // always called on the poller's thread
+    typedef std::function<void(uint64_t)> SyncHandler;
+private:
+    struct Record {
+        RecordType type;
+        uint64_t id;
+        uint64_t firstKept;
+        std::string_view room;
+        std::string_view data;
+        size_t size;
+    };
+
+    // What the worker knows of a room: its joins, and the ids and sizes of its records of kept messages
+    struct Room {
+        // Where its records start in the file, as the records before are of a closed room with the same name
+        uint64_t start;
+        std::map<std::string, uint64_t> joins;
+        std::deque<std::pair<uint64_t, size_t>> messages;
+    };
+
+    std::string path;
+    Poller& poller;
+    SyncHandler syncHandler;
+    int fd;
+    // Wakes the event loop up when more records are durable
+    int syncedFd;
+
+    std::mutex mutex;
+    std::condition_variable queued;
+    std::string queue;
+    uint64_t queuedSequence;
+    bool stopping;
+
+    std::mutex syncedMutex;
+    uint64_t syncedSequence;
+    bool failed;
+
+    // Owned by the worker after the startup
+    uint64_t size;
+    uint64_t keptSize;
+    std::unordered_map<std::string, Room> rooms;
+
+    std::thread worker;
+
+    static void appendRecord(std::string&, RecordType, const std::string&, uint64_t, uint64_t, const char*, size_t);
+    // False when the data doesn't start with a whole, valid record; the checksum is only checked if the data
+    // isn't known to be good already
+    static bool readRecord(const char*, size_t, Record&, bool);
+    void recover(const RecordHandler&);
+    // Takes the record and where it is in the file
+    void track(const Record&, uint64_t);
+    void compact();
+    void run();
+    void processSynced();
+public:
+    static const size_t HEADER_SIZE;
+    // The file isn't rewritten while it's shorter than this
+    static const uint64_t MIN_COMPACTION_SIZE;
+
+    MessageLog(const std::string&, Poller&, const RecordHandler&, const SyncHandler&);
+    ~MessageLog();
+
+    // Room names can't be longer
+    static const size_t MAX_ROOM_SIZE;
+
+    // Takes the room, the id, the data and, for a message, the first id kept in its room; returns the sequence
+    // of the append, which the sync handler gets once it's on the disk
+    uint64_t append(RecordType, const std::string&, uint64_t, const std::string&, uint64_t);
+    bool hasFailed();
+
+    MessageLog(const MessageLog&) = delete;
+    MessageLog& operator=(const MessageLog&) = delete;
+};
+
+
+#endif //HTTPWEBCHAT_MESSAGELOG_H
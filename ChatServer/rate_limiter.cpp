@@ -0,0 +1,44 @@
+#include <algorithm>
+#include <cmath>
+
+#include <time.h>
+
+#include "rate_limiter.h"
+
+RateLimiter::RateLimiter(double rate, double burst): rate(rate / 1000), burst(std::max(burst, 1.0)) {}
+
+uint32_t RateLimiter::now() {
+    // The coarse clock is read from the vDSO without a system call, at the resolution of a jiffy
+    timespec time;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &time);
+    return (uint32_t) ((uint64_t) time.tv_sec * 1000 + time.tv_nsec / 1000000);
+}
+
+bool RateLimiter::isEnabled() const {
+    return rate > 0;
+}
+
+RateLimiter::Bucket RateLimiter::makeBucket(uint32_t now) const {
+    return Bucket{burst, now};
+}
+
+unsigned RateLimiter::refill(Bucket& bucket, uint32_t now) const {
+    if (rate <= 0) {
+        return 0;
+    }
+
+    bucket.tokens = std::min(burst, bucket.tokens + (float) (uint32_t) (now - bucket.time) * rate);
+    bucket.time = now;
+    if (bucket.tokens >= 1) {
+        return 0;
+    }
+    return (unsigned) std::ceil((1 - bucket.tokens) / rate / 1000);
+}
+
+void RateLimiter::take(Bucket& bucket) {
+    bucket.tokens -= 1;
+}
+
+bool RateLimiter::isFull(const Bucket& bucket, uint32_t now) const {
+    return rate <= 0 || bucket.tokens + (float) (uint32_t) (now - bucket.time) * rate >= burst;
+}
@@ -0,0 +1,39 @@
+#ifndef HTTPWEBCHAT_RATELIMITER_H
+#define HTTPWEBCHAT_RATELIMITER_H
+
+
+#include <cstdint>
+
+// Token buckets refilled lazily: a bucket is only its tokens and when it was last looked at, and it gets what it
+// earned meanwhile the next time it's looked at. Every bucket of a limiter has the limiter's rate and burst
+class RateLimiter {
+public:
+    struct Bucket {
+        float tokens;
+        // In milliseconds of now(), which wrap around
+        uint32_t time;
+    };
+private:
+    // Tokens per millisecond
+    float rate;
+    float burst;
+public:
+    // Takes tokens per second and the most a bucket holds; a rate of 0 lets everything through
+    RateLimiter(double = 0, double = 1);
+
+    // Milliseconds of a coarse monotonic clock, cheap enough to read for every request
+    static uint32_t now();
+
+    bool isEnabled() const;
+    // A full one
+    Bucket makeBucket(uint32_t) const;
+    // Adds the tokens earned since the bucket was last looked at; returns 0 if there's a token in it,
+    // or else the seconds until there is
+    unsigned refill(Bucket&, uint32_t) const;
+    static void take(Bucket&);
+    // Whether the bucket would be full by now, so forgetting it changes nothing
+    bool isFull(const Bucket&, uint32_t) const;
+};
+
+
+#endif //HTTPWEBCHAT_RATELIMITER_H
@@ -0,0 +1,69 @@
+#include "compressor.h"
+#include "../common.h"
+
+Compressor::Compressor(Coding coding, int level, int windowBits, int memoryLevel):
+        stream(), coding(coding), level(level) {
+    if (deflateInit2(&stream, level, Z_DEFLATED, (coding == GZIP) ? windowBits + 16 : windowBits, memoryLevel,
+                     Z_DEFAULT_STRATEGY) != Z_OK) {
+        throw OwnException("Couldn't initialize a deflate stream");
+    }
+}
+
+Compressor::~Compressor() {
+    deflateEnd(&stream);
+}
+
+Compressor::Coding Compressor::getCoding() const {
+    return coding;
+}
+
+void Compressor::setLevel(int newLevel) {
+    if (newLevel != level) {
+        deflateReset(&stream);
+        if (deflateParams(&stream, newLevel, Z_DEFAULT_STRATEGY) != Z_OK) {
+            throw OwnException("Couldn't change the compression level");
+        }
+        level = newLevel;
+    }
+}
+
+void Compressor::reset() {
+    deflateReset(&stream);
+}
+
+void Compressor::compress(const char* data, size_t size, std::string& output, bool finish) {
+    stream.next_in = (Bytef*) data;
+    stream.avail_in = (uInt) size;
+
+    int flush = finish ? Z_FINISH : Z_SYNC_FLUSH;
+    size_t bound = deflateBound(&stream, size) + 16;
+    int result;
+    do {
+        size_t offset = output.size();
+        output.resize(offset + bound);
+        stream.next_out = (Bytef*) &output[offset];
+        stream.avail_out = (uInt) bound;
+        result = deflate(&stream, flush);
+        output.resize(offset + bound - stream.avail_out);
+        if (result == Z_STREAM_ERROR) {
+            throw OwnException("Couldn't compress data");
+        }
+    } while (stream.avail_out == 0 || (finish && result != Z_STREAM_END));
+
+    if (finish) {
+        deflateReset(&stream);
+    }
+}
+
+Compressor& Compressor::forThread(Coding coding, int level) {
+    thread_local Compressor gzip(GZIP, level);
+    thread_local Compressor deflate(DEFLATE, level);
+
+    Compressor& compressor = (coding == GZIP) ? gzip : deflate;
+    compressor.setLevel(level);
+    return compressor;
+}
+
+const char* Compressor::codingToString(Coding coding) {
+    return (coding == GZIP) ? "gzip" : "deflate";
+}
@@ -0,0 +1,45 @@
+#ifndef HTTPWEBCHAT_COMPRESSOR_H
+#define HTTPWEBCHAT_COMPRESSOR_H
+
+
+#include <string>
+
+#include <zlib.h>
+
+// A deflate stream producing the gzip or deflate content coding. Contexts are expensive to set up, so each thread
+// keeps one per coding (see forThread) and resets it between responses. A streamed response has one of its own,
+// as its parts are sent between other responses.
+class Compressor {
+public:
+    enum Coding {GZIP, DEFLATE};
+    static const size_t CODING_COUNT = DEFLATE + 1;
+    // A smaller window and hash table for streamed responses, which may be held open by the thousand:
+    // about 32 KiB a stream instead of about 256 KiB
+    static const int STREAM_WINDOW_BITS = 12;
+    static const int STREAM_MEMORY_LEVEL = 5;
+private:
+    z_stream stream;
+    Coding coding;
+    int level;
+public:
+    // Takes the coding, the level, the window bits and the memory level
+    Compressor(Coding, int, int = 15, int = 8);
+    ~Compressor();
+
+    Coding getCoding() const;
+    void setLevel(int);
+    void reset();
+
+    // Appends compressed data to the output; a streaming response flushes every part it sends,
+    // and the last part finishes the stream
+    void compress(const char*, size_t, std::string&, bool);
+
+    static Compressor& forThread(Coding, int);
+    static const char* codingToString(Coding);
+
+    Compressor(const Compressor&) = delete;
+    Compressor& operator=(const Compressor&) = delete;
+};
+
+
+#endif //HTTPWEBCHAT_COMPRESSOR_H
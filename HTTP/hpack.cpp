@@ -0,0 +1,398 @@
+#include "hpack.h"
+
+namespace {
+    const Http::HeaderField STATIC_TABLE[] = {
+        {":authority", ""}, {":method", "GET"}, {":method", "POST"}, {":path", "/"}, {":path", "/index.html"},
+        {":scheme", "http"}, {":scheme", "https"}, {":status", "200"}, {":status", "204"}, {":status", "206"},
+        {":status", "304"}, {":status", "400"}, {":status", "404"}, {":status", "500"}, {"accept-charset", ""},
+        {"accept-encoding", "gzip, deflate"}, {"accept-language", ""}, {"accept-ranges", ""}, {"accept", ""},
+        {"access-control-allow-origin", ""}, {"age", ""}, {"allow", ""}, {"authorization", ""},
+        {"cache-control", ""}, {"content-disposition", ""}, {"content-encoding", ""}, {"content-language", ""},
+        {"content-length", ""}, {"content-location", ""}, {"content-range", ""}, {"content-type", ""},
+        {"cookie", ""}, {"date", ""}, {"etag", ""}, {"expect", ""}, {"expires", ""}, {"from", ""}, {"host", ""},
+        {"if-match", ""}, {"if-modified-since", ""}, {"if-none-match", ""}, {"if-range", ""},
+        {"if-unmodified-since", ""}, {"last-modified", ""}, {"link", ""}, {"location", ""}, {"max-forwards", ""},
+        {"proxy-authenticate", ""}, {"proxy-authorization", ""}, {"range", ""}, {"referer", ""}, {"refresh", ""},
+        {"retry-after", ""}, {"server", ""}, {"set-cookie", ""}, {"strict-transport-security", ""},
+        {"transfer-encoding", ""}, {"user-agent", ""}, {"vary", ""}, {"via", ""}, {"www-authenticate", ""}
+    };
+
+    struct HuffmanCode {
+        uint32_t code;
+        uint8_t bits;
+    };
+
+    // RFC 7541, appendix B; symbol 256 is EOS
+    const HuffmanCode HUFFMAN_CODES[257] = {
+        {0x1ff8, 13}, {0x7fffd8, 23}, {0xfffffe2, 28}, {0xfffffe3, 28},
+        {0xfffffe4, 28}, {0xfffffe5, 28}, {0xfffffe6, 28}, {0xfffffe7, 28},
+        {0xfffffe8, 28}, {0xffffea, 24}, {0x3ffffffc, 30}, {0xfffffe9, 28},
+        {0xfffffea, 28}, {0x3ffffffd, 30}, {0xfffffeb, 28}, {0xfffffec, 28},
+        {0xfffffed, 28}, {0xfffffee, 28}, {0xfffffef, 28}, {0xffffff0, 28},
+        {0xffffff1, 28}, {0xffffff2, 28}, {0x3ffffffe, 30}, {0xffffff3, 28},
+        {0xffffff4, 28}, {0xffffff5, 28}, {0xffffff6, 28}, {0xffffff7, 28},
+        {0xffffff8, 28}, {0xffffff9, 28}, {0xffffffa, 28}, {0xffffffb, 28},
+        {0x14, 6}, {0x3f8, 10}, {0x3f9, 10}, {0xffa, 12},
+        {0x1ff9, 13}, {0x15, 6}, {0xf8, 8}, {0x7fa, 11},
+        {0x3fa, 10}, {0x3fb, 10}, {0xf9, 8}, {0x7fb, 11},
+        {0xfa, 8}, {0x16, 6}, {0x17, 6}, {0x18, 6},
+        {0x0, 5}, {0x1, 5}, {0x2, 5}, {0x19, 6},
+        {0x1a, 6}, {0x1b, 6}, {0x1c, 6}, {0x1d, 6},
+        {0x1e, 6}, {0x1f, 6}, {0x5c, 7}, {0xfb, 8},
+        {0x7ffc, 15}, {0x20, 6}, {0xffb, 12}, {0x3fc, 10},
+        {0x1ffa, 13}, {0x21, 6}, {0x5d, 7}, {0x5e, 7},
+        {0x5f, 7}, {0x60, 7}, {0x61, 7}, {0x62, 7},
+        {0x63, 7}, {0x64, 7}, {0x65, 7}, {0x66, 7},
+        {0x67, 7}, {0x68, 7}, {0x69, 7}, {0x6a, 7},
+        {0x6b, 7}, {0x6c, 7}, {0x6d, 7}, {0x6e, 7},
+        {0x6f, 7}, {0x70, 7}, {0x71, 7}, {0x72, 7},
+        {0xfc, 8}, {0x73, 7}, {0xfd, 8}, {0x1ffb, 13},
+        {0x7fff0, 19}, {0x1ffc, 13}, {0x3ffc, 14}, {0x22, 6},
+        {0x7ffd, 15}, {0x3, 5}, {0x23, 6}, {0x4, 5},
+        {0x24, 6}, {0x5, 5}, {0x25, 6}, {0x26, 6},
+        {0x27, 6}, {0x6, 5}, {0x74, 7}, {0x75, 7},
+        {0x28, 6}, {0x29, 6}, {0x2a, 6}, {0x7, 5},
+        {0x2b, 6}, {0x76, 7}, {0x2c, 6}, {0x8, 5},
+        {0x9, 5}, {0x2d, 6}, {0x77, 7}, {0x78, 7},
+        {0x79, 7}, {0x7a, 7}, {0x7b, 7}, {0x7ffe, 15},
+        {0x7fc, 11}, {0x3ffd, 14}, {0x1ffd, 13}, {0xffffffc, 28},
+        {0xfffe6, 20}, {0x3fffd2, 22}, {0xfffe7, 20}, {0xfffe8, 20},
+        {0x3fffd3, 22}, {0x3fffd4, 22}, {0x3fffd5, 22}, {0x7fffd9, 23},
+        {0x3fffd6, 22}, {0x7fffda, 23}, {0x7fffdb, 23}, {0x7fffdc, 23},
+        {0x7fffdd, 23}, {0x7fffde, 23}, {0xffffeb, 24}, {0x7fffdf, 23},
+        {0xffffec, 24}, {0xffffed, 24}, {0x3fffd7, 22}, {0x7fffe0, 23},
+        {0xffffee, 24}, {0x7fffe1, 23}, {0x7fffe2, 23}, {0x7fffe3, 23},
+        {0x7fffe4, 23}, {0x1fffdc, 21}, {0x3fffd8, 22}, {0x7fffe5, 23},
+        {0x3fffd9, 22}, {0x7fffe6, 23}, {0x7fffe7, 23}, {0xffffef, 24},
+        {0x3fffda, 22}, {0x1fffdd, 21}, {0xfffe9, 20}, {0x3fffdb, 22},
+        {0x3fffdc, 22}, {0x7fffe8, 23}, {0x7fffe9, 23}, {0x1fffde, 21},
+        {0x7fffea, 23}, {0x3fffdd, 22}, {0x3fffde, 22}, {0xfffff0, 24},
+        {0x1fffdf, 21}, {0x3fffdf, 22}, {0x7fffeb, 23}, {0x7fffec, 23},
+        {0x1fffe0, 21}, {0x1fffe1, 21}, {0x3fffe0, 22}, {0x1fffe2, 21},
+        {0x7fffed, 23}, {0x3fffe1, 22}, {0x7fffee, 23}, {0x7fffef, 23},
+        {0xfffea, 20}, {0x3fffe2, 22}, {0x3fffe3, 22}, {0x3fffe4, 22},
+        {0x7ffff0, 23}, {0x3fffe5, 22}, {0x3fffe6, 22}, {0x7ffff1, 23},
+        {0x3ffffe0, 26}, {0x3ffffe1, 26}, {0xfffeb, 20}, {0x7fff1, 19},
+        {0x3fffe7, 22}, {0x7ffff2, 23}, {0x3fffe8, 22}, {0x1ffffec, 25},
+        {0x3ffffe2, 26}, {0x3ffffe3, 26}, {0x3ffffe4, 26}, {0x7ffffde, 27},
+        {0x7ffffdf, 27}, {0x3ffffe5, 26}, {0xfffff1, 24}, {0x1ffffed, 25},
+        {0x7fff2, 19}, {0x1fffe3, 21}, {0x3ffffe6, 26}, {0x7ffffe0, 27},
+        {0x7ffffe1, 27}, {0x3ffffe7, 26}, {0x7ffffe2, 27}, {0xfffff2, 24},
+        {0x1fffe4, 21}, {0x1fffe5, 21}, {0x3ffffe8, 26}, {0x3ffffe9, 26},
+        {0xffffffd, 28}, {0x7ffffe3, 27}, {0x7ffffe4, 27}, {0x7ffffe5, 27},
+        {0xfffec, 20}, {0xfffff3, 24}, {0xfffed, 20}, {0x1fffe6, 21},
+        {0x3fffe9, 22}, {0x1fffe7, 21}, {0x1fffe8, 21}, {0x7ffff3, 23},
+        {0x3fffea, 22}, {0x3fffeb, 22}, {0x1ffffee, 25}, {0x1ffffef, 25},
+        {0xfffff4, 24}, {0xfffff5, 24}, {0x3ffffea, 26}, {0x7ffff4, 23},
+        {0x3ffffeb, 26}, {0x7ffffe6, 27}, {0x3ffffec, 26}, {0x3ffffed, 26},
+        {0x7ffffe7, 27}, {0x7ffffe8, 27}, {0x7ffffe9, 27}, {0x7ffffea, 27},
+        {0x7ffffeb, 27}, {0xffffffe, 28}, {0x7ffffec, 27}, {0x7ffffed, 27},
+        {0x7ffffee, 27}, {0x7ffffef, 27}, {0x7fffff0, 27}, {0x3ffffee, 26},
+        {0x3fffffff, 30},
+    };
+
+    const int MAX_HUFFMAN_BITS = 30;
+
+    // The code is canonical, so codes of one length are consecutive, and decoding only needs the first code
+    // of every length and the symbols sorted by their codes
+    struct HuffmanDecodingTable {
+        uint32_t firstCode[MAX_HUFFMAN_BITS + 1];
+        uint32_t count[MAX_HUFFMAN_BITS + 1];
+        uint32_t offset[MAX_HUFFMAN_BITS + 1];
+        uint16_t symbols[257];
+
+        HuffmanDecodingTable(): firstCode(), count(), offset() {
+            for (const HuffmanCode& code : HUFFMAN_CODES) {
+                ++count[code.bits];
+            }
+            uint32_t code = 0;
+            uint32_t index = 0;
+            for (int bits = 1; bits <= MAX_HUFFMAN_BITS; ++bits) {
+                firstCode[bits] = code;
+                offset[bits] = index;
+                index += count[bits];
+                code = (code + count[bits]) << 1;
+            }
+
+            uint32_t filled[MAX_HUFFMAN_BITS + 1] = {};
+            for (uint16_t symbol = 0; symbol < 257; ++symbol) {
+                int bits = HUFFMAN_CODES[symbol].bits;
+                symbols[offset[bits] + filled[bits]++] = symbol;
+            }
+        }
+    };
+
+    const HuffmanDecodingTable& huffmanDecodingTable() {
+        static const HuffmanDecodingTable table;
+        return table;
+    }
+
+    void decodeString(const char*& data, const char* end, std::string& output) {
+        if (data == end) {
+            throw OwnException("HPACK string is truncated");
+        }
+        bool huffman = (*data & 0x80) != 0;
+        uint64_t size = Hpack::decodeInteger(data, end, 7);
+        if (size > (uint64_t) (end - data)) {
+            throw OwnException("HPACK string is truncated");
+        }
+
+        output.clear();
+        if (huffman) {
+            Hpack::huffmanDecode(data, size, output);
+        } else {
+            output.assign(data, size);
+        }
+        data += size;
+    }
+
+    void encodeString(const std::string& string, std::string& output) {
+        size_t huffmanSize = Hpack::huffmanEncodedSize(string);
+        if (huffmanSize < string.size()) {
+            Hpack::encodeInteger(huffmanSize, 7, 0x80, output);
+            Hpack::huffmanEncode(string, output);
+        } else {
+            Hpack::encodeInteger(string.size(), 7, 0, output);
+            output += string;
+        }
+    }
+}
+
+const size_t HpackTable::STATIC_SIZE = sizeof STATIC_TABLE / sizeof STATIC_TABLE[0];
+const size_t HpackTable::DEFAULT_MAX_SIZE = 4096;
+const size_t HpackTable::ENTRY_OVERHEAD = 32;
+
+HpackTable::HpackTable(): size(0), maxSize(DEFAULT_MAX_SIZE) {}
+
+void HpackTable::evict(size_t limit) {
+    while (size > limit) {
+        size -= entries.back().first.size() + entries.back().second.size() + ENTRY_OVERHEAD;
+        entries.pop_back();
+    }
+}
+
+const Http::HeaderField& HpackTable::get(size_t index) const {
+    if (index == 0 || index > STATIC_SIZE + entries.size()) {
+        throw OwnException("HPACK index " + std::to_string(index) + " is out of the table");
+    }
+    return (index <= STATIC_SIZE) ? STATIC_TABLE[index - 1] : entries[index - STATIC_SIZE - 1];
+}
+
+size_t HpackTable::find(const std::string& name, const std::string& value, bool& nameOnly) const {
+    size_t nameIndex = 0;
+    for (size_t i = 0; i < STATIC_SIZE + entries.size(); ++i) {
+        const Http::HeaderField& field = (i < STATIC_SIZE) ? STATIC_TABLE[i] : entries[i - STATIC_SIZE];
+        if (field.first == name) {
+            if (field.second == value) {
+                nameOnly = false;
+                return i + 1;
+            } else if (nameIndex == 0) {
+                nameIndex = i + 1;
+            }
+        }
+    }
+    nameOnly = true;
+    return nameIndex;
+}
+
+void HpackTable::add(const std::string& name, const std::string& value) {
+    size_t entrySize = name.size() + value.size() + ENTRY_OVERHEAD;
+    if (entrySize > maxSize) {
+        // An entry larger than the table empties it and isn't kept
+        evict(0);
+        return;
+    }
+    evict(maxSize - entrySize);
+    entries.push_front(Http::HeaderField(name, value));
+    size += entrySize;
+}
+
+size_t HpackTable::getMaxSize() const {
+    return maxSize;
+}
+
+void HpackTable::setMaxSize(size_t maxSize) {
+    this->maxSize = maxSize;
+    evict(maxSize);
+}
+
+HpackDecoder::HpackDecoder(): maxTableSize(HpackTable::DEFAULT_MAX_SIZE) {}
+
+bool HpackDecoder::decode(const char* data, size_t size, Http::HeaderList& fields, size_t maxListSize) {
+    const char* end = data + size;
+    std::string name, value;
+    // A few bytes referring to a large table entry over and over would otherwise expand without a bound
+    size_t listSize = 0;
+    bool tooLarge = false;
+    while (data != end) {
+        uint8_t first = (uint8_t) *data;
+        if (first & 0x80) {
+            const Http::HeaderField& field = table.get(Hpack::decodeInteger(data, end, 7));
+            listSize += field.first.size() + field.second.size() + HpackTable::ENTRY_OVERHEAD;
+            if (listSize > maxListSize) {
+                tooLarge = true;
+            } else if (!tooLarge) {
+                fields.push_back(field);
+            }
+            continue;
+        } else if ((first & 0xe0) == 0x20) {
+            uint64_t newSize = Hpack::decodeInteger(data, end, 5);
+            if (newSize > maxTableSize) {
+                throw OwnException("HPACK table size update exceeds the limit");
+            }
+            table.setMaxSize(newSize);
+            continue;
+        }
+
+        // Literals: with incremental indexing (01), without indexing (0000) or never indexed (0001)
+        bool indexing = (first & 0xc0) == 0x40;
+        uint64_t nameIndex = Hpack::decodeInteger(data, end, indexing ? 6 : 4);
+        if (nameIndex != 0) {
+            name = table.get(nameIndex).first;
+        } else {
+            decodeString(data, end, name);
+        }
+        decodeString(data, end, value);
+
+        if (indexing) {
+            table.add(name, value);
+        }
+        listSize += name.size() + value.size() + HpackTable::ENTRY_OVERHEAD;
+        if (listSize > maxListSize) {
+            tooLarge = true;
+        } else if (!tooLarge) {
+            fields.push_back(Http::HeaderField(name, value));
+        }
+    }
+
+    if (tooLarge) {
+        fields.clear();
+    }
+    return !tooLarge;
+}
+
+HpackEncoder::HpackEncoder(): sizeChanged(false) {}
+
+void HpackEncoder::setMaxTableSize(size_t maxSize) {
+    maxSize = std::min(maxSize, HpackTable::DEFAULT_MAX_SIZE);
+    if (maxSize != table.getMaxSize()) {
+        table.setMaxSize(maxSize);
+        sizeChanged = true;
+    }
+}
+
+void HpackEncoder::encode(const Http::HeaderList& fields, std::string& output) {
+    if (sizeChanged) {
+        Hpack::encodeInteger(table.getMaxSize(), 5, 0x20, output);
+        sizeChanged = false;
+    }
+
+    for (const Http::HeaderField& field : fields) {
+        bool nameOnly;
+        size_t index = table.find(field.first, field.second, nameOnly);
+        if (index != 0 && !nameOnly) {
+            Hpack::encodeInteger(index, 7, 0x80, output);
+            continue;
+        }
+
+        // Lengths differ from response to response and would only push useful entries out
+        bool indexing = field.first != "content-length";
+        Hpack::encodeInteger(index, indexing ? 6 : 4, indexing ? 0x40 : 0, output);
+        if (index == 0) {
+            encodeString(field.first, output);
+        }
+        encodeString(field.second, output);
+        if (indexing) {
+            table.add(field.first, field.second);
+        }
+    }
+}
+
+void Hpack::encodeInteger(uint64_t value, int prefixBits, uint8_t flags, std::string& output) {
+    uint64_t limit = (1u << prefixBits) - 1;
+    if (value < limit) {
+        output += (char) (flags | value);
+        return;
+    }
+
+    output += (char) (flags | limit);
+    value -= limit;
+    while (value >= 0x80) {
+        output += (char) (0x80 | (value & 0x7f));
+        value >>= 7;
+    }
+    output += (char) value;
+}
+
+uint64_t Hpack::decodeInteger(const char*& data, const char* end, int prefixBits) {
+    uint64_t limit = (1u << prefixBits) - 1;
+    uint64_t value = (uint8_t) *data++ & limit;
+    if (value < limit) {
+        return value;
+    }
+
+    for (int shift = 0; ; shift += 7) {
+        if (data == end || shift > 56) {
+            throw OwnException("HPACK integer is truncated or too large");
+        }
+        uint8_t byte = (uint8_t) *data++;
+        value += (uint64_t) (byte & 0x7f) << shift;
+        if ((byte & 0x80) == 0) {
+            return value;
+        }
+    }
+}
+
+size_t Hpack::huffmanEncodedSize(const std::string& string) {
+    size_t bits = 0;
+    for (unsigned char c : string) {
+        bits += HUFFMAN_CODES[c].bits;
+    }
+    return (bits + 7) / 8;
+}
+
+void Hpack::huffmanEncode(const std::string& string, std::string& output) {
+    uint64_t buffer = 0;
+    int bufferBits = 0;
+    for (unsigned char c : string) {
+        const HuffmanCode& code = HUFFMAN_CODES[c];
+        buffer = (buffer << code.bits) | code.code;
+        bufferBits += code.bits;
+        while (bufferBits >= 8) {
+            bufferBits -= 8;
+            output += (char) (buffer >> bufferBits);
+        }
+    }
+    // The rest of the last byte is padded with the most significant bits of EOS, which are all ones
+    if (bufferBits > 0) {
+        output += (char) ((buffer << (8 - bufferBits)) | (0xff >> bufferBits));
+    }
+}
+
+void Hpack::huffmanDecode(const char* data, size_t size, std::string& output) {
+    const HuffmanDecodingTable& table = huffmanDecodingTable();
+    uint32_t code = 0;
+    int bits = 0;
+    for (size_t i = 0; i < size; ++i) {
+        uint8_t byte = (uint8_t) data[i];
+        for (int bit = 7; bit >= 0; --bit) {
+            code = (code << 1) | ((byte >> bit) & 1);
+            ++bits;
+            if (bits > MAX_HUFFMAN_BITS) {
+                throw OwnException("Invalid Huffman code");
+            }
+            if (code - table.firstCode[bits] < table.count[bits] && code >= table.firstCode[bits]) {
+                uint16_t symbol = table.symbols[table.offset[bits] + code - table.firstCode[bits]];
+                if (symbol == 256) {
+                    throw OwnException("Huffman-encoded string contains EOS");
+                }
+                output += (char) symbol;
+                code = 0;
+                bits = 0;
+            }
+        }
+    }
+    if (bits > 7 || code != (1u << bits) - 1) {
+        throw OwnException("Invalid Huffman padding");
+    }
+}
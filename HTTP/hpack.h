@@ -0,0 +1,68 @@
+#ifndef HTTPWEBCHAT_HPACK_H
+#define HTTPWEBCHAT_HPACK_H
+
+
+#include <deque>
+
+#include "http_common.h"
+
+// Header compression of HTTP/2 (RFC 7541). Both directions of a connection keep a table of recently sent
+// fields, so a repeated header costs a byte or two; malformed blocks throw OwnException, which is fatal
+// for the connection, as the tables can't be kept in sync after it.
+class HpackTable {
+    std::deque<Http::HeaderField> entries;
+    size_t size;
+    size_t maxSize;
+
+    void evict(size_t);
+public:
+    static const size_t STATIC_SIZE;
+    static const size_t DEFAULT_MAX_SIZE;
+    // Every entry costs its name and value plus this much
+    static const size_t ENTRY_OVERHEAD;
+
+    HpackTable();
+
+    // Indices start at 1 with the static table, and the dynamic one follows it, newest first
+    const Http::HeaderField& get(size_t) const;
+    // 0 if neither the field nor its name is there
+    size_t find(const std::string&, const std::string&, bool&) const;
+    void add(const std::string&, const std::string&);
+    size_t getMaxSize() const;
+    void setMaxSize(size_t);
+};
+
+class HpackDecoder {
+    HpackTable table;
+    size_t maxTableSize;
+public:
+    HpackDecoder();
+
+    // Fields are appended in their order; names come lowercase, as HTTP/2 requires. Takes the most the list
+    // may add up to, counted as for SETTINGS_MAX_HEADER_LIST_SIZE; past it the rest of the block is only
+    // decoded into the table, without a field being copied, and false is returned
+    bool decode(const char*, size_t, Http::HeaderList&, size_t);
+};
+
+class HpackEncoder {
+    HpackTable table;
+    bool sizeChanged;
+public:
+    HpackEncoder();
+
+    // The peer's SETTINGS_HEADER_TABLE_SIZE; the next block starts with the update
+    void setMaxTableSize(size_t);
+    // Names have to be lowercase
+    void encode(const Http::HeaderList&, std::string&);
+};
+
+namespace Hpack {
+    void encodeInteger(uint64_t, int, uint8_t, std::string&);
+    uint64_t decodeInteger(const char*&, const char*, int);
+    void huffmanEncode(const std::string&, std::string&);
+    size_t huffmanEncodedSize(const std::string&);
+    void huffmanDecode(const char*, size_t, std::string&);
+}
+
+
+#endif //HTTPWEBCHAT_HPACK_H
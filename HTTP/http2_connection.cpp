@@ -0,0 +1,751 @@
+#include "http2_connection.h"
+
+namespace {
+    const size_t FRAME_HEADER_SIZE = 9;
+    // The largest frame accepted from clients, which is also the smallest a peer may allow
+    const uint32_t DEFAULT_FRAME_SIZE = 16384;
+    const uint32_t DEFAULT_WINDOW = 65535;
+    const int64_t MAX_WINDOW = 0x7fffffff;
+
+    const uint8_t FLAG_END_STREAM = 0x1;
+    const uint8_t FLAG_ACK = 0x1;
+    const uint8_t FLAG_END_HEADERS = 0x4;
+    const uint8_t FLAG_PADDED = 0x8;
+    const uint8_t FLAG_PRIORITY = 0x20;
+
+    uint32_t readUint32(const char* data) {
+        return ((uint32_t) (uint8_t) data[0] << 24) | ((uint32_t) (uint8_t) data[1] << 16)
+               | ((uint32_t) (uint8_t) data[2] << 8) | (uint32_t) (uint8_t) data[3];
+    }
+
+    void appendUint32(std::string& output, uint32_t value) {
+        output += (char) (value >> 24);
+        output += (char) (value >> 16);
+        output += (char) (value >> 8);
+        output += (char) value;
+    }
+
+    void appendSetting(std::string& output, uint16_t id, uint32_t value) {
+        output += (char) (id >> 8);
+        output += (char) id;
+        appendUint32(output, value);
+    }
+
+    // HTTP2-Settings is base64url without padding
+    bool base64UrlDecode(const std::string& input, std::string& output) {
+        uint32_t buffer = 0;
+        int bits = 0;
+        for (char c : input) {
+            int value;
+            if (c >= 'A' && c <= 'Z') {
+                value = c - 'A';
+            } else if (c >= 'a' && c <= 'z') {
+                value = c - 'a' + 26;
+            } else if (c >= '0' && c <= '9') {
+                value = c - '0' + 52;
+            } else if (c == '-' || c == '+') {
+                value = 62;
+            } else if (c == '_' || c == '/') {
+                value = 63;
+            } else if (c == '=') {
+                break;
+            } else {
+                return false;
+            }
+            buffer = (buffer << 6) | value;
+            bits += 6;
+            if (bits >= 8) {
+                bits -= 8;
+                output += (char) (buffer >> bits);
+            }
+        }
+        return true;
+    }
+}
+
+const std::string HttpServer::Http2Connection::PREFACE = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+
+HttpServer::Http2Connection::Error::Error(ErrorCode code, const std::string& message):
+        OwnException(message), code(code) {}
+
+HttpServer::Http2Connection::ErrorCode HttpServer::Http2Connection::Error::getCode() const {
+    return code;
+}
+
+HttpServer::Http2Connection::Stream::Stream(int64_t window): receiving(true), responded(false),
+                                                             receiveWindow(DEFAULT_WINDOW), window(window),
+                                                             compress(false), coding(Compressor::GZIP),
+                                                             streaming(false), next(NULL), remaining(0) {}
+
+HttpServer::Http2Connection::Http2Connection(Connection& connection):
+        connection(connection), server(connection.server), socket(connection.socket), prefaceReceived(false),
+        goingAway(false), lastStreamId(0), headerStream(0), headerEndStream(false), connectionWindow(DEFAULT_WINDOW),
+        receiveWindow(DEFAULT_WINDOW), peerInitialWindow(DEFAULT_WINDOW), peerMaxFrameSize(DEFAULT_FRAME_SIZE) {
+    // The server's preface is its SETTINGS, sent before anything else
+    std::string settings;
+    appendSetting(settings, MAX_CONCURRENT_STREAMS, (uint32_t) server.settings.maxConcurrentStreams);
+    appendSetting(settings, MAX_HEADER_LIST_SIZE, (uint32_t) server.settings.maxHeaderSize);
+    writeFrame(SETTINGS, 0, 0, settings.data(), settings.size());
+}
+
+void HttpServer::Http2Connection::writeFrame(FrameType type, uint8_t flags, uint32_t stream,
+                                             const char* payload, size_t size) {
+    char header[FRAME_HEADER_SIZE] = {(char) (size >> 16), (char) (size >> 8), (char) size, (char) type,
+                                      (char) flags, (char) (stream >> 24), (char) (stream >> 16),
+                                      (char) (stream >> 8), (char) stream};
+    frames.append(header, FRAME_HEADER_SIZE);
+    frames.append(payload, size);
+}
+
+void HttpServer::Http2Connection::flushFrames() {
+    // Frames go out together, as separate small writes would wait for acknowledgements (Nagle's algorithm)
+    if (!frames.empty() && socket->isOpened()) {
+        socket->write(frames);
+    }
+    frames.clear();
+}
+
+void HttpServer::Http2Connection::writeHeaders(uint32_t stream, int statusCode, const Http::HeaderList& fields,
+                                               bool endStream) {
+    Http::HeaderList all;
+    all.reserve(fields.size() + 2);
+    all.push_back(Http::HeaderField(":status", std::to_string(statusCode)));
+    all.push_back(Http::HeaderField("date", HttpResponse::getDate()));
+    all.insert(all.end(), fields.begin(), fields.end());
+
+    output.clear();
+    encoder.encode(all, output);
+
+    // Blocks larger than a frame go on in CONTINUATION frames, which nothing may be sent between
+    size_t offset = 0;
+    do {
+        size_t size = std::min<size_t>(output.size() - offset, peerMaxFrameSize);
+        bool last = offset + size == output.size();
+        uint8_t flags = (last ? FLAG_END_HEADERS : 0) | ((offset == 0 && endStream) ? FLAG_END_STREAM : 0);
+        writeFrame((offset == 0) ? HEADERS : CONTINUATION, flags, stream, output.data() + offset, size);
+        offset += size;
+    } while (offset < output.size());
+}
+
+void HttpServer::Http2Connection::writeWindowUpdate(uint32_t stream, uint32_t increment) {
+    std::string payload;
+    appendUint32(payload, increment);
+    writeFrame(WINDOW_UPDATE, 0, stream, payload.data(), payload.size());
+}
+
+void HttpServer::Http2Connection::resetStream(uint32_t stream, ErrorCode code) {
+    std::string payload;
+    appendUint32(payload, code);
+    writeFrame(RST_STREAM, 0, stream, payload.data(), payload.size());
+    streams.erase(stream);
+}
+
+void HttpServer::Http2Connection::goAway(ErrorCode code) {
+    std::string payload;
+    appendUint32(payload, lastStreamId);
+    appendUint32(payload, code);
+    writeFrame(GOAWAY, 0, 0, payload.data(), payload.size());
+    flushFrames();
+
+    goingAway = true;
+    streams.clear();
+    connection.closing = true;
+    socket->getInputBuffer().clear();
+    socket->closeAfterWrite();
+}
+
+void HttpServer::Http2Connection::shutdown() {
+    goAway(NO_ERROR);
+}
+
+void HttpServer::Http2Connection::upgrade(HttpRequest& request, const std::string& http2Settings) {
+    frame.clear();
+    try {
+        if (!base64UrlDecode(http2Settings, frame)) {
+            throw Error(PROTOCOL_ERROR, "Invalid HTTP2-Settings");
+        }
+        applySettings(frame);
+    } catch (const Error& error) {
+        std::cerr << "HTTP/2 connection error: " << error.what() << std::endl;
+        goAway(error.getCode());
+        return;
+    }
+
+    // The request was sent over HTTP/1.1, so the stream is half-closed from the client's side already
+    lastStreamId = 1;
+    streams.emplace(1, Stream(peerInitialWindow)).first->second.receiving = false;
+    dispatch(1, request);
+    flushFrames();
+}
+
+void HttpServer::Http2Connection::processData(std::deque<char>& dataDeque) {
+    receiveFrames(dataDeque);
+    flushFrames();
+}
+
+void HttpServer::Http2Connection::receiveFrames(std::deque<char>& dataDeque) {
+    if (!prefaceReceived) {
+        if (dataDeque.size() < PREFACE.size()) {
+            if (!std::equal(dataDeque.begin(), dataDeque.end(), PREFACE.begin())) {
+                goAway(PROTOCOL_ERROR);
+            }
+            return;
+        } else if (!std::equal(PREFACE.begin(), PREFACE.end(), dataDeque.begin())) {
+            goAway(PROTOCOL_ERROR);
+            return;
+        }
+        dataDeque.erase(dataDeque.begin(), dataDeque.begin() + PREFACE.size());
+        prefaceReceived = true;
+    }
+
+    char header[FRAME_HEADER_SIZE];
+    while (dataDeque.size() >= FRAME_HEADER_SIZE && socket->isOpened() && !connection.closing) {
+        std::copy(dataDeque.begin(), dataDeque.begin() + FRAME_HEADER_SIZE, header);
+        uint32_t size = ((uint32_t) (uint8_t) header[0] << 16) | ((uint32_t) (uint8_t) header[1] << 8)
+                        | (uint32_t) (uint8_t) header[2];
+        if (size > DEFAULT_FRAME_SIZE) {
+            goAway(FRAME_SIZE_ERROR);
+            return;
+        } else if (dataDeque.size() < FRAME_HEADER_SIZE + size) {
+            return;
+        }
+
+        frame.assign(dataDeque.begin() + FRAME_HEADER_SIZE, dataDeque.begin() + FRAME_HEADER_SIZE + size);
+        dataDeque.erase(dataDeque.begin(), dataDeque.begin() + FRAME_HEADER_SIZE + size);
+        try {
+            processFrame((uint8_t) header[3], (uint8_t) header[4], readUint32(header + 5) & 0x7fffffff);
+        } catch (const Error& error) {
+            std::cerr << "HTTP/2 connection error: " << error.what() << std::endl;
+            goAway(error.getCode());
+            return;
+        } catch (const std::exception& exception) {
+            std::cerr << "Exception in an HTTP/2 connection: " << exception.what() << std::endl;
+            goAway(INTERNAL_ERROR);
+            return;
+        }
+    }
+}
+
+void HttpServer::Http2Connection::processFrame(uint8_t type, uint8_t flags, uint32_t stream) {
+    if (headerStream != 0 && (type != CONTINUATION || stream != headerStream)) {
+        throw Error(PROTOCOL_ERROR, "A header block was interrupted");
+    }
+
+    switch (type) {
+        case DATA:
+            processDataFrame(flags, stream);
+            break;
+        case HEADERS:
+            processHeadersFrame(flags, stream);
+            break;
+        case PRIORITY:
+            if (stream == 0 || frame.size() != 5) {
+                throw Error(PROTOCOL_ERROR, "Invalid PRIORITY");
+            }
+            break;
+        case RST_STREAM:
+            if (stream == 0 || frame.size() != 4) {
+                throw Error(PROTOCOL_ERROR, "Invalid RST_STREAM");
+            } else if (stream > lastStreamId) {
+                throw Error(PROTOCOL_ERROR, "RST_STREAM of an idle stream");
+            }
+            streams.erase(stream);
+            break;
+        case SETTINGS:
+            processSettings(flags, stream);
+            break;
+        case PUSH_PROMISE:
+            throw Error(PROTOCOL_ERROR, "Clients can't push");
+        case PING:
+            if (stream != 0 || frame.size() != 8) {
+                throw Error(FRAME_SIZE_ERROR, "Invalid PING");
+            } else if (!(flags & FLAG_ACK)) {
+                writeFrame(PING, FLAG_ACK, 0, frame.data(), frame.size());
+            }
+            break;
+        case GOAWAY:
+            goingAway = true;
+            if (streams.empty()) {
+                connection.closing = true;
+                flushFrames();
+                socket->closeAfterWrite();
+            }
+            break;
+        case WINDOW_UPDATE:
+            processWindowUpdate(stream);
+            break;
+        case CONTINUATION:
+            if (stream == 0 || stream != headerStream) {
+                throw Error(PROTOCOL_ERROR, "Unexpected CONTINUATION");
+            }
+            headerBlock += frame;
+            if (headerBlock.size() > server.settings.maxHeaderSize) {
+                throw Error(ENHANCE_YOUR_CALM, "Header block is too large");
+            }
+            if (flags & FLAG_END_HEADERS) {
+                endHeaders();
+            }
+            break;
+        default:
+            // Unknown frame types are ignored
+            break;
+    }
+}
+
+void HttpServer::Http2Connection::processHeadersFrame(uint8_t flags, uint32_t stream) {
+    if (stream == 0 || stream % 2 == 0) {
+        throw Error(PROTOCOL_ERROR, "HEADERS on an invalid stream");
+    }
+
+    size_t begin = 0, end = frame.size();
+    if (flags & FLAG_PADDED) {
+        if (frame.empty() || (uint8_t) frame[0] >= frame.size()) {
+            throw Error(PROTOCOL_ERROR, "Invalid padding");
+        }
+        end -= (uint8_t) frame[0];
+        begin = 1;
+    }
+    if (flags & FLAG_PRIORITY) {
+        begin += 5;
+        if (begin > end) {
+            throw Error(FRAME_SIZE_ERROR, "HEADERS is too short");
+        }
+    }
+
+    headerStream = stream;
+    headerEndStream = (flags & FLAG_END_STREAM) != 0;
+    headerBlock.assign(frame, begin, end - begin);
+    if (flags & FLAG_END_HEADERS) {
+        endHeaders();
+    }
+}
+
+void HttpServer::Http2Connection::endHeaders() {
+    uint32_t id = headerStream;
+    headerStream = 0;
+
+    // Every block has to be decoded, even of a refused stream, to keep the table in sync
+    Http::HeaderList fields;
+    bool fitting;
+    try {
+        fitting = decoder.decode(headerBlock.data(), headerBlock.size(), fields, server.settings.maxHeaderSize);
+    } catch (const OwnException& exception) {
+        throw Error(COMPRESSION_ERROR, exception.what());
+    }
+
+    std::map<uint32_t, Stream>::iterator it = streams.find(id);
+    if (it != streams.end()) {
+        // Trailers, which are of no use here
+        if (!it->second.receiving || !headerEndStream) {
+            throw Error(PROTOCOL_ERROR, "Unexpected HEADERS");
+        } else if (!it->second.responded) {
+            dispatch(id);
+        }
+        return;
+    } else if (id <= lastStreamId) {
+        throw Error(STREAM_CLOSED, "HEADERS on a closed stream");
+    }
+
+    lastStreamId = id;
+    if (goingAway) {
+        return;
+    } else if (streams.size() >= server.settings.maxConcurrentStreams) {
+        resetStream(id, REFUSED_STREAM);
+        return;
+    }
+
+    Stream& stream = streams.emplace(id, Stream(peerInitialWindow)).first->second;
+    stream.fields.swap(fields);
+    if (!fitting) {
+        respond(id, 431, "Request Header Fields Too Large");
+    } else if (headerEndStream) {
+        dispatch(id);
+    }
+}
+
+void HttpServer::Http2Connection::processDataFrame(uint8_t flags, uint32_t id) {
+    if (id == 0) {
+        throw Error(PROTOCOL_ERROR, "DATA on stream 0");
+    }
+
+    size_t begin = 0, end = frame.size();
+    if (flags & FLAG_PADDED) {
+        if (frame.empty() || (uint8_t) frame[0] >= frame.size()) {
+            throw Error(PROTOCOL_ERROR, "Invalid padding");
+        }
+        end -= (uint8_t) frame[0];
+        begin = 1;
+    }
+
+    // The whole frame counts against the windows, padding included. The connection's is given back once half
+    // of it is used, as everything received is taken off it right away
+    if ((int64_t) frame.size() > receiveWindow) {
+        throw Error(FLOW_CONTROL_ERROR, "DATA exceeds the connection window");
+    }
+    receiveWindow -= frame.size();
+    if (receiveWindow <= DEFAULT_WINDOW / 2) {
+        writeWindowUpdate(0, (uint32_t) (DEFAULT_WINDOW - receiveWindow));
+        receiveWindow = DEFAULT_WINDOW;
+    }
+
+    std::map<uint32_t, Stream>::iterator it = streams.find(id);
+    if (it == streams.end() || !it->second.receiving) {
+        if (id > lastStreamId) {
+            throw Error(PROTOCOL_ERROR, "DATA on an idle stream");
+        }
+        if (it == streams.end()) {
+            resetStream(id, STREAM_CLOSED);
+        }
+        return;
+    }
+
+    Stream& stream = it->second;
+    if ((int64_t) frame.size() > stream.receiveWindow) {
+        resetStream(id, FLOW_CONTROL_ERROR);
+        return;
+    }
+    stream.receiveWindow -= frame.size();
+    if (stream.responded) {
+        // Rejected already, the rest is dropped, and the window isn't given back
+        return;
+    }
+    stream.body.append(frame, begin, end - begin);
+    if (stream.body.size() > server.settings.maxBodySize) {
+        respond(id, 413, "Payload Too Large");
+        return;
+    }
+
+    if (flags & FLAG_END_STREAM) {
+        dispatch(id);
+    } else if (stream.receiveWindow <= DEFAULT_WINDOW / 2) {
+        writeWindowUpdate(id, (uint32_t) (DEFAULT_WINDOW - stream.receiveWindow));
+        stream.receiveWindow = DEFAULT_WINDOW;
+    }
+}
+
+void HttpServer::Http2Connection::processSettings(uint8_t flags, uint32_t stream) {
+    if (stream != 0) {
+        throw Error(PROTOCOL_ERROR, "SETTINGS on a stream");
+    } else if (flags & FLAG_ACK) {
+        if (!frame.empty()) {
+            throw Error(FRAME_SIZE_ERROR, "SETTINGS acknowledgement with a payload");
+        }
+        return;
+    }
+
+    applySettings(frame);
+    writeFrame(SETTINGS, FLAG_ACK, 0, NULL, 0);
+    sendData();
+}
+
+void HttpServer::Http2Connection::applySettings(const std::string& settings) {
+    if (settings.size() % 6 != 0) {
+        throw Error(FRAME_SIZE_ERROR, "Invalid SETTINGS size");
+    }
+
+    for (size_t i = 0; i < settings.size(); i += 6) {
+        uint16_t id = (uint16_t) (((uint8_t) settings[i] << 8) | (uint8_t) settings[i + 1]);
+        uint32_t value = readUint32(settings.data() + i + 2);
+        switch (id) {
+            case HEADER_TABLE_SIZE:
+                encoder.setMaxTableSize(value);
+                break;
+            case ENABLE_PUSH:
+                if (value > 1) {
+                    throw Error(PROTOCOL_ERROR, "Invalid SETTINGS_ENABLE_PUSH");
+                }
+                break;
+            case INITIAL_WINDOW_SIZE: {
+                if (value > MAX_WINDOW) {
+                    throw Error(FLOW_CONTROL_ERROR, "Invalid SETTINGS_INITIAL_WINDOW_SIZE");
+                }
+                int64_t delta = (int64_t) value - peerInitialWindow;
+                for (std::map<uint32_t, Stream>::iterator it = streams.begin(); it != streams.end(); ++it) {
+                    it->second.window += delta;
+                }
+                peerInitialWindow = value;
+                break;
+            }
+            case MAX_FRAME_SIZE:
+                if (value < DEFAULT_FRAME_SIZE || value > 0xffffff) {
+                    throw Error(PROTOCOL_ERROR, "Invalid SETTINGS_MAX_FRAME_SIZE");
+                }
+                peerMaxFrameSize = value;
+                break;
+            default:
+                break;
+        }
+    }
+}
+
+void HttpServer::Http2Connection::processWindowUpdate(uint32_t id) {
+    if (frame.size() != 4) {
+        throw Error(FRAME_SIZE_ERROR, "Invalid WINDOW_UPDATE");
+    }
+    uint32_t increment = readUint32(frame.data()) & 0x7fffffff;
+
+    if (id == 0) {
+        if (increment == 0 || connectionWindow + increment > MAX_WINDOW) {
+            throw Error(increment == 0 ? PROTOCOL_ERROR : FLOW_CONTROL_ERROR, "Invalid connection WINDOW_UPDATE");
+        }
+        connectionWindow += increment;
+    } else {
+        std::map<uint32_t, Stream>::iterator it = streams.find(id);
+        if (it == streams.end()) {
+            return;
+        } else if (increment == 0 || it->second.window + increment > MAX_WINDOW) {
+            resetStream(id, increment == 0 ? PROTOCOL_ERROR : FLOW_CONTROL_ERROR);
+            return;
+        }
+        it->second.window += increment;
+    }
+    sendData();
+}
+
+void HttpServer::Http2Connection::respond(uint32_t id, int statusCode, const std::string& reasonPhrase) {
+    HttpResponse response(Http::Method::GET, Http::VERSION1_1, statusCode, reasonPhrase);
+    complete(id, response);
+}
+
+void HttpServer::Http2Connection::dispatch(uint32_t id) {
+    Stream& stream = streams.at(id);
+    stream.receiving = false;
+
+    std::string method, path, authority;
+    Http::HeaderList headers;
+    for (const Http::HeaderField& field : stream.fields) {
+        if (field.first == ":method") {
+            method = field.second;
+        } else if (field.first == ":path") {
+            path = field.second;
+        } else if (field.first == ":authority") {
+            authority = field.second;
+        } else if (field.first[0] != ':') {
+            headers.push_back(field);
+        }
+    }
+
+    Http::Method requestMethod;
+    if (!Http::parseMethod(method, requestMethod) || path.empty()) {
+        respond(id, 400, "Bad Request");
+        return;
+    }
+
+    HttpRequest request(requestMethod, path, Http::VERSION2_0);
+    if (!authority.empty()) {
+        request.setHeader("Host", authority);
+    }
+    for (const Http::HeaderField& field : headers) {
+        // Fields repeated in HTTP/2 are joined as in HTTP/1.1, and cookies may be split into one per pair
+        std::string value = request.getHeader(field.first);
+        if (value.empty()) {
+            request.setHeader(field.first, field.second);
+        } else {
+            request.setHeader(field.first, value + (field.first == "cookie" ? "; " : ", ") + field.second);
+        }
+    }
+    if (requestMethod == Http::Method::POST) {
+        request.setHeader("Content-Length", std::to_string(stream.body.size()));
+        request.swapBody(stream.body);
+    }
+    stream.fields.clear();
+    stream.body.clear();
+    request.finish();
+
+    dispatch(id, request);
+}
+
+void HttpServer::Http2Connection::dispatch(uint32_t id, HttpRequest& request) {
+    Stream& stream = streams.at(id);
+    server.chooseCoding(request, stream.compress, stream.coding);
+    try {
+        server.processRequest(request, ResponseSocket(connection.shared_from_this(), id));
+    } catch (const std::exception& exception) {
+        std::cerr << "Couldn't process a request: " << exception.what() << std::endl;
+        if (streams.count(id) != 0) {
+            resetStream(id, INTERNAL_ERROR);
+        }
+    }
+}
+
+void HttpServer::Http2Connection::sendData() {
+    bool sent = true;
+    while (sent && connectionWindow > 0 && socket->isOpened()) {
+        sent = false;
+        // Streams take turns, a frame each
+        for (std::map<uint32_t, Stream>::iterator it = streams.begin(); it != streams.end() && connectionWindow > 0;) {
+            Stream& stream = it->second;
+            if (!stream.responded || (stream.remaining == 0 && stream.streaming)
+                || (stream.remaining != 0 && stream.window <= 0)) {
+                ++it;
+                continue;
+            }
+
+            // A closed stream ends with an empty frame once its body is sent
+            size_t size = std::min<size_t>({stream.remaining, peerMaxFrameSize,
+                                            (size_t) std::max<int64_t>(stream.window, 0),
+                                            (size_t) connectionWindow});
+            bool last = size == stream.remaining && !stream.streaming;
+            writeFrame(DATA, last ? FLAG_END_STREAM : 0, it->first, stream.next, size);
+            stream.next += size;
+            stream.remaining -= size;
+            stream.window -= size;
+            connectionWindow -= size;
+            sent = true;
+
+            if (last) {
+                // Responding early to a request still being sent asks the client to stop sending it
+                if (stream.receiving) {
+                    std::string payload;
+                    appendUint32(payload, NO_ERROR);
+                    writeFrame(RST_STREAM, 0, it->first, payload.data(), payload.size());
+                }
+                streams.erase(it++);
+            } else {
+                ++it;
+            }
+        }
+    }
+
+    if (goingAway && streams.empty() && !connection.closing) {
+        connection.closing = true;
+        flushFrames();
+        socket->closeAfterWrite();
+    }
+}
+
+bool HttpServer::Http2Connection::isIdle() const {
+    return streams.empty() && headerStream == 0;
+}
+
+bool HttpServer::Http2Connection::isPending(uint32_t id) const {
+    std::map<uint32_t, Stream>::const_iterator it = streams.find(id);
+    return it != streams.end() && !it->second.responded;
+}
+
+void HttpServer::Http2Connection::complete(uint32_t id, HttpResponse& response) {
+    std::map<uint32_t, Stream>::iterator it = streams.find(id);
+    if (!socket->isOpened() || it == streams.end()) {
+        // The client has reset the stream
+        return;
+    } else if (it->second.responded) {
+        throw OwnException("The response can't be sent twice");
+    }
+
+    Stream& stream = it->second;
+    server.compress(response, stream.compress, stream.coding);
+    Http::HeaderList fields;
+    response.getFields(fields);
+
+    stream.responded = true;
+    if (response.getBodySize() != 0) {
+        response.swapBody(stream.data);
+        stream.next = stream.data.data();
+        stream.remaining = stream.data.size();
+    }
+    writeHeaders(id, response.getStatusCode(), fields, stream.remaining == 0);
+    connection.lastActivity = std::chrono::steady_clock::now();
+    if (stream.remaining == 0) {
+        if (stream.receiving) {
+            resetStream(id, NO_ERROR);
+        } else {
+            streams.erase(it);
+        }
+    }
+    sendData();
+    flushFrames();
+}
+
+void HttpServer::Http2Connection::complete(uint32_t id, const HttpResponse::Prepared& response) {
+    std::map<uint32_t, Stream>::iterator it = streams.find(id);
+    if (!socket->isOpened() || it == streams.end()) {
+        return;
+    } else if (it->second.responded) {
+        throw OwnException("The response can't be sent twice");
+    }
+
+    Stream& stream = it->second;
+    stream.responded = true;
+    stream.next = response.getBody();
+    stream.remaining = response.getBodySize();
+    stream.owner = response.getOwner();
+    writeHeaders(id, response.getStatusCode(), response.getFields(), stream.remaining == 0);
+    connection.lastActivity = std::chrono::steady_clock::now();
+    if (stream.remaining == 0) {
+        if (stream.receiving) {
+            resetStream(id, NO_ERROR);
+        } else {
+            streams.erase(it);
+        }
+    }
+    sendData();
+    flushFrames();
+}
+
+void HttpServer::Http2Connection::close(uint32_t id) {
+    std::map<uint32_t, Stream>::iterator it = streams.find(id);
+    if (!socket->isOpened() || it == streams.end()) {
+        return;
+    } else if (it->second.streaming) {
+        Stream& stream = it->second;
+        if (stream.compressor != NULL) {
+            stream.data.erase(0, stream.next - stream.data.data());
+            stream.compressor->compress(NULL, 0, stream.data, true);
+            stream.next = stream.data.data();
+            stream.remaining = stream.data.size();
+            stream.compressor.reset();
+        }
+        stream.streaming = false;
+        sendData();
+    } else {
+        resetStream(id, INTERNAL_ERROR);
+    }
+    flushFrames();
+}
+
+void HttpServer::Http2Connection::startStream(uint32_t id, HttpResponse& response) {
+    std::map<uint32_t, Stream>::iterator it = streams.find(id);
+    if (!socket->isOpened() || it == streams.end()) {
+        return;
+    } else if (it->second.responded) {
+        throw OwnException("The response can't be sent twice");
+    }
+
+    Stream& stream = it->second;
+    stream.compressor = server.compressStream(response, stream.compress, stream.coding);
+    Http::HeaderList fields;
+    response.getFields(fields, false);
+
+    stream.responded = true;
+    stream.streaming = true;
+    response.swapBody(stream.data);
+    stream.next = stream.data.data();
+    stream.remaining = stream.data.size();
+    writeHeaders(id, response.getStatusCode(), fields, false);
+    connection.lastActivity = std::chrono::steady_clock::now();
+    sendData();
+    flushFrames();
+}
+
+bool HttpServer::Http2Connection::sendStream(uint32_t id, const std::string& data) {
+    std::map<uint32_t, Stream>::iterator it = streams.find(id);
+    if (!socket->isOpened() || it == streams.end() || !it->second.streaming) {
+        return false;
+    }
+
+    // What's been sent already is dropped, what the windows held back stays in front
+    Stream& stream = it->second;
+    stream.data.erase(0, stream.next - stream.data.data());
+    server.appendStream(stream.compressor.get(), data.data(), data.size(), stream.data, false);
+    stream.next = stream.data.data();
+    stream.remaining = stream.data.size();
+    connection.lastActivity = std::chrono::steady_clock::now();
+    sendData();
+    flushFrames();
+    return true;
+}
+
+size_t HttpServer::Http2Connection::getOutputSize(uint32_t id) const {
+    std::map<uint32_t, Stream>::const_iterator it = streams.find(id);
+    return socket->getOutputSize() + ((it != streams.end()) ? it->second.remaining : 0);
+}
@@ -0,0 +1,121 @@
+#ifndef HTTPWEBCHAT_HTTP2CONNECTION_H
+#define HTTPWEBCHAT_HTTP2CONNECTION_H
+
+
+#include <map>
+
+#include "hpack.h"
+#include "http_server.h"
+
+// The HTTP/2 side of a connection (RFC 7540), which a Connection hands its data to once the client sent the
+// connection preface, either right away (prior knowledge) or after upgrading from HTTP/1.1 with "Upgrade: h2c".
+// Requests of every stream go through the same routes and handlers, and their ResponseSockets carry the stream
+// id in place of the sequence number.
+class HttpServer::Http2Connection {
+    enum FrameType {DATA, HEADERS, PRIORITY, RST_STREAM, SETTINGS, PUSH_PROMISE, PING, GOAWAY, WINDOW_UPDATE,
+                    CONTINUATION};
+    enum ErrorCode {NO_ERROR, PROTOCOL_ERROR, INTERNAL_ERROR, FLOW_CONTROL_ERROR, SETTINGS_TIMEOUT, STREAM_CLOSED,
+                    FRAME_SIZE_ERROR, REFUSED_STREAM, CANCEL, COMPRESSION_ERROR, CONNECT_ERROR, ENHANCE_YOUR_CALM};
+    enum Setting {HEADER_TABLE_SIZE = 1, ENABLE_PUSH, MAX_CONCURRENT_STREAMS, INITIAL_WINDOW_SIZE, MAX_FRAME_SIZE,
+                  MAX_HEADER_LIST_SIZE};
+
+    // Fails the whole connection with GOAWAY
+    class Error: public OwnException {
+        ErrorCode code;
+    public:
+        Error(ErrorCode, const std::string&);
+
+        ErrorCode getCode() const;
+    };
+
+    struct Stream {
+        // The request is still being received
+        bool receiving;
+        bool responded;
+        Http::HeaderList fields;
+        std::string body;
+        // What the client may still send of the body before it's given more
+        int64_t receiveWindow;
+
+        int64_t window;
+        bool compress;
+        Compressor::Coding coding;
+        // A started stream gets its body piece by piece and stays open until it's closed
+        bool streaming;
+        std::unique_ptr<Compressor> compressor;
+        // What's left of the response body, held by data or the owner
+        std::string data;
+        const char* next;
+        size_t remaining;
+        std::shared_ptr<const void> owner;
+
+        Stream(int64_t);
+    };
+
+    Connection& connection;
+    HttpServer& server;
+    TcpServerSocket* socket;
+
+    bool prefaceReceived;
+    bool goingAway;
+    HpackDecoder decoder;
+    HpackEncoder encoder;
+    std::map<uint32_t, Stream> streams;
+    uint32_t lastStreamId;
+
+    // A header block split into CONTINUATION frames
+    uint32_t headerStream;
+    bool headerEndStream;
+    std::string headerBlock;
+
+    int64_t connectionWindow;
+    int64_t receiveWindow;
+    uint32_t peerInitialWindow;
+    uint32_t peerMaxFrameSize;
+    std::string frame;
+    std::string output;
+    // Frames written since the last flush
+    std::string frames;
+
+    void writeFrame(FrameType, uint8_t, uint32_t, const char*, size_t);
+    void flushFrames();
+    void writeHeaders(uint32_t, int, const Http::HeaderList&, bool);
+    void writeWindowUpdate(uint32_t, uint32_t);
+    void resetStream(uint32_t, ErrorCode);
+    void goAway(ErrorCode);
+
+    void receiveFrames(std::deque<char>&);
+    void processFrame(uint8_t, uint8_t, uint32_t);
+    void processHeadersFrame(uint8_t, uint32_t);
+    void processDataFrame(uint8_t, uint32_t);
+    void processSettings(uint8_t, uint32_t);
+    void processWindowUpdate(uint32_t);
+    void endHeaders();
+    void applySettings(const std::string&);
+    void respond(uint32_t, int, const std::string&);
+    void dispatch(uint32_t);
+    void dispatch(uint32_t, HttpRequest&);
+    void sendData();
+public:
+    static const std::string PREFACE;
+
+    Http2Connection(Connection&);
+
+    // Takes over after "101 Switching Protocols"; the upgraded request becomes stream 1
+    void upgrade(HttpRequest&, const std::string&);
+    void processData(std::deque<char>&);
+    void shutdown();
+
+    bool isIdle() const;
+    bool isPending(uint32_t) const;
+    void complete(uint32_t, HttpResponse&);
+    void complete(uint32_t, const HttpResponse::Prepared&);
+    void close(uint32_t);
+
+    void startStream(uint32_t, HttpResponse&);
+    bool sendStream(uint32_t, const std::string&);
+    size_t getOutputSize(uint32_t) const;
+};
+
+
+#endif //HTTPWEBCHAT_HTTP2CONNECTION_H
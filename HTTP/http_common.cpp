@@ -1,3 +1,5 @@
+#include <charconv>
+
 #include "http_common.h"
 
 std::string Http::methodToString(Http::Method method) {
@@ -16,239 +18,369 @@ std::string Http::methodToString(Http::Method method) {
 }
 
 Http::Method Http::stringToMethod(const std::string& string) {
+    Method method;
+    if (!parseMethod(string, method)) {
+        throw OwnException("Invalid HTTP method: " + string);
+    }
+    return method;
+}
+
+bool Http::parseMethod(std::string_view string, Method& method) {
     if (string == "GET") {
-        return GET;
+        method = GET;
     } else if (string == "HEAD") {
-        return HEAD;
+        method = HEAD;
     } else if (string == "OPTIONS") {
-        return OPTIONS;
+        method = OPTIONS;
     } else if (string == "POST") {
-        return POST;
+        method = POST;
     } else {
-        throw OwnException("Invalid HTTP method: " + string);
+        return false;
     }
+    return true;
 }
 
-std::string Http::uriEncode(const std::string& toEncode) {
-    std::string result = "";
-    for (std::string::const_iterator it = toEncode.begin(); it != toEncode.end(); ++it) {
-        switch (*it) {
-            case '\t': {
-                result += "%09";
-                break;
-            } case '\n': {
-                result += "%0A";
-                break;
-            } case '\r': {
-                result += "%0D";
-                break;
-            } case ' ': {
-                result += "%20";
-                break;
-            } case '!': {
-                result += "%21";
-                break;
-            } case '\"': {
-                result += "%22";
-                break;
-            } case '#': {
-                result += "%23";
-                break;
-            } case '$': {
-                result += "%24";
-                break;
-            } case '%': {
-                result += "%25";
-                break;
-            } case '&': {
-                result += "%26";
-                break;
-            } case '\'': {
-                result += "%27";
-                break;
-            } case '(': {
-                result += "%28";
-                break;
-            } case ')': {
-                result += "%29";
-                break;
-            } case '*': {
-                result += "%2A";
-                break;
-            } case '+': {
-                result += "%2B";
-                break;
-            } case ',': {
-                result += "%2C";
-                break;
-            } case '-': {
-                result += "%2D";
-                break;
-            } case '.': {
-                result += "%2E";
-                break;
-            } case '/': {
-                result += "%2F";
-                break;
-            } case ':': {
-                result += "%3A";
-                break;
-            } case ';': {
-                result += "%3B";
-                break;
-            } case '<': {
-                result += "%3C";
-                break;
-            } case '=': {
-                result += "%3D";
-                break;
-            } case '>': {
-                result += "%3E";
-                break;
-            } case '?': {
-                result += "%3F";
-                break;
-            } case '@': {
-                result += "%40";
-                break;
-            } case '[': {
-                result += "%5B";
-                break;
-            } case '\\': {
-                result += "%5C";
-                break;
-            } case ']': {
-                result += "%5D";
-                break;
-            } case '^': {
-                result += "%5E";
-                break;
-            } case '_': {
-                result += "%5F";
-                break;
-            } case '`': {
-                result += "%60";
-                break;
-            } case '{': {
-                result += "%7B";
-                break;
-            } case '|': {
-                result += "%7C";
-                break;
-            } case '}': {
-                result += "%7D";
-                break;
-            } case '~': {
-                result += "%7E";
-                break;
-            } default: {
-                result += *it;
+namespace {
+    // Bytes which stay as they are when percent-encoding: the unreserved characters of RFC 3986
+    struct UriTables {
+        bool unreserved[256];
+        signed char hexValue[256];
+
+        UriTables() {
+            for (int c = 0; c < 256; ++c) {
+                unreserved[c] = (c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z') || (c >= '0' && c <= '9')
+                                || c == '-' || c == '.' || c == '_' || c == '~';
+                hexValue[c] = (c >= '0' && c <= '9') ? (signed char) (c - '0')
+                              : (c >= 'A' && c <= 'F') ? (signed char) (c - 'A' + 10)
+                              : (c >= 'a' && c <= 'f') ? (signed char) (c - 'a' + 10)
+                              : (signed char) -1;
             }
         }
-    }
-    return result;
-}
+    };
+
+    const UriTables uriTables;
+    const char HEX_DIGITS[] = "0123456789ABCDEF";
 
-std::string Http::uriDecode(const std::string& toDecode) {
-    std::string result = "";
-    size_t faps = 0;
-    for (size_t cur = 0; cur < toDecode.size(); ++cur) {
-        if (toDecode[cur] == '%') {
-            if (cur > toDecode.size() - 3) {
-                throw OwnException("Invalid URL-encoded string (percent encoding near the end): " + toDecode);
+    // Decodes size bytes from input to output, which may be the same buffer; returns the decoded size
+    // or std::string::npos for an invalid percent escape
+    size_t decode(const char* input, size_t size, char* output, bool plusAsSpace) {
+        size_t in = 0, out = 0;
+#ifdef __SSE2__
+        const __m128i percent = _mm_set1_epi8('%');
+        const __m128i plus = _mm_set1_epi8(plusAsSpace ? '+' : '%');
+        while (in + 16 <= size) {
+            __m128i chunk = _mm_loadu_si128((const __m128i*) (input + in));
+            int mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(chunk, percent), _mm_cmpeq_epi8(chunk, plus)));
+            if (mask == 0) {
+                if (output + out != input + in) {
+                    _mm_storeu_si128((__m128i*) (output + out), chunk);
+                }
+                in += 16;
+                out += 16;
+                continue;
             }
-            if (faps < cur) {
-                result += toDecode.substr(faps, cur - faps);
+
+            size_t run = __builtin_ctz(mask);
+            if (output + out != input + in) {
+                memmove(output + out, input + in, run);
             }
+            in += run;
+            out += run;
 
-            char fst = toDecode[cur + 1];
-            char snd = toDecode[cur + 2];
-            if (fst == '0' && snd == '9') {
-                result += '\t';
-            } else if (fst == '0' && snd == 'A') {
-                result += '\n';
-            } else if (fst == '0' && snd == 'D') {
-                result += '\r';
-            } else if (fst == '2' && snd == '0') {
-                result += ' ';
-            } else if (fst == '2' && snd == '1') {
-                result += '!';
-            } else if (fst == '2' && snd == '2') {
-                result += '\"';
-            } else if (fst == '2' && snd == '3') {
-                result += '#';
-            } else if (fst == '2' && snd == '4') {
-                result += '$';
-            } else if (fst == '2' && snd == '5') {
-                result += '%';
-            } else if (fst == '2' && snd == '6') {
-                result += '&';
-            } else if (fst == '2' && snd == '7') {
-                result += '\'';
-            } else if (fst == '2' && snd == '8') {
-                result += '(';
-            } else if (fst == '2' && snd == '9') {
-                result += ')';
-            } else if (fst == '2' && snd == 'A') {
-                result += '*';
-            } else if (fst == '2' && snd == 'B') {
-                result += '+';
-            } else if (fst == '2' && snd == 'C') {
-                result += ',';
-            } else if (fst == '2' && snd == 'D') {
-                result += '-';
-            } else if (fst == '2' && snd == 'E') {
-                result += '.';
-            } else if (fst == '2' && snd == 'F') {
-                result += '/';
-            } else if (fst == '3' && snd == 'A') {
-                result += ':';
-            } else if (fst == '3' && snd == 'B') {
-                result += ';';
-            } else if (fst == '3' && snd == 'C') {
-                result += '<';
-            } else if (fst == '3' && snd == 'D') {
-                result += '=';
-            } else if (fst == '3' && snd == 'E') {
-                result += '>';
-            } else if (fst == '3' && snd == 'F') {
-                result += '?';
-            } else if (fst == '4' && snd == '0') {
-                result += '@';
-            } else if (fst == '5' && snd == 'B') {
-                result += '[';
-            } else if (fst == '5' && snd == 'C') {
-                result += '\\';
-            } else if (fst == '5' && snd == 'D') {
-                result += ']';
-            } else if (fst == '5' && snd == 'E') {
-                result += '^';
-            } else if (fst == '5' && snd == 'F') {
-                result += '_';
-            } else if (fst == '6' && snd == '0') {
-                result += '`';
-            } else if (fst == '7' && snd == 'B') {
-                result += '{';
-            } else if (fst == '7' && snd == 'C') {
-                result += '|';
-            } else if (fst == '7' && snd == 'D') {
-                result += '}';
-            } else if (fst == '7' && snd == 'E') {
-                result += '~';
+            if (input[in] == '+') {
+                output[out++] = ' ';
+                ++in;
+            } else if (in + 2 < size) {
+                int high = uriTables.hexValue[(unsigned char) input[in + 1]];
+                int low = uriTables.hexValue[(unsigned char) input[in + 2]];
+                if (high < 0 || low < 0) {
+                    return std::string::npos;
+                }
+                output[out++] = (char) (high << 4 | low);
+                in += 3;
             } else {
-                throw OwnException("Invalid URL-encoded string (invalid percent encoding "
-                                         + toDecode.substr(cur, 3) + "): " + toDecode);
+                return std::string::npos;
             }
-            faps = cur + 3;
         }
+#endif
+        for (; in < size; ++in) {
+            char c = input[in];
+            if (c == '%') {
+                if (in + 2 >= size) {
+                    return std::string::npos;
+                }
+                int high = uriTables.hexValue[(unsigned char) input[in + 1]];
+                int low = uriTables.hexValue[(unsigned char) input[in + 2]];
+                if (high < 0 || low < 0) {
+                    return std::string::npos;
+                }
+                output[out++] = (char) (high << 4 | low);
+                in += 2;
+            } else if (c == '+' && plusAsSpace) {
+                output[out++] = ' ';
+            } else {
+                output[out++] = c;
+            }
+        }
+        return out;
     }
-    if (faps < toDecode.size()) {
-        result += toDecode.substr(faps, toDecode.size() - faps);
+}
+
+std::string Http::uriEncode(std::string_view toEncode) {
+    size_t escaped = 0;
+    for (size_t i = 0; i < toEncode.size(); ++i) {
+        escaped += !uriTables.unreserved[(unsigned char) toEncode[i]];
     }
 
+    std::string result(toEncode.size() + 2 * escaped, '\0');
+    char* output = &result[0];
+    for (size_t i = 0; i < toEncode.size(); ++i) {
+        unsigned char c = (unsigned char) toEncode[i];
+        if (uriTables.unreserved[c]) {
+            *output++ = (char) c;
+        } else {
+            *output++ = '%';
+            *output++ = HEX_DIGITS[c >> 4];
+            *output++ = HEX_DIGITS[c & 15];
+        }
+    }
+    return result;
+}
+
+std::string Http::uriDecode(std::string_view toDecode, bool plusAsSpace) {
+    std::string result(toDecode.size(), '\0');
+    size_t size = decode(toDecode.data(), toDecode.size(), &result[0], plusAsSpace);
+    if (size == std::string::npos) {
+        throw OwnException("Invalid URL-encoded string: " + std::string(toDecode));
+    }
+    result.resize(size);
     return result;
 }
 
+bool Http::uriDecodeInPlace(std::string& string, bool plusAsSpace) {
+    if (string.empty()) {
+        return true;
+    }
+
+    size_t size = decode(string.data(), string.size(), &string[0], plusAsSpace);
+    if (size == std::string::npos) {
+        return false;
+    }
+    string.resize(size);
+    return true;
+}
+
+std::string Http::reasonPhrase(int statusCode) {
+    switch (statusCode) {
+        case 100: return "Continue";
+        case 101: return "Switching Protocols";
+        case 200: return "OK";
+        case 201: return "Created";
+        case 204: return "No Content";
+        case 206: return "Partial Content";
+        case 301: return "Moved Permanently";
+        case 302: return "Found";
+        case 304: return "Not Modified";
+        case 400: return "Bad Request";
+        case 401: return "Unauthorized";
+        case 403: return "Forbidden";
+        case 404: return "Not Found";
+        case 405: return "Method Not Allowed";
+        case 408: return "Request Timeout";
+        case 411: return "Length Required";
+        case 413: return "Payload Too Large";
+        case 414: return "URI Too Long";
+        case 415: return "Unsupported Media Type";
+        case 429: return "Too Many Requests";
+        case 431: return "Request Header Fields Too Large";
+        case 500: return "Internal Server Error";
+        case 501: return "Not Implemented";
+        case 503: return "Service Unavailable";
+        case 505: return "HTTP Version Not Supported";
+        default: return "";
+    }
+}
+
+std::string Http::contentTypeToString(Http::ContentType contentType) {
+    switch (contentType) {
+        case NO_CONTENT_TYPE:
+            return "";
+        case TEXT_HTML:
+            return "text/html; charset=UTF-8";
+        case TEXT_CSS:
+            return "text/css; charset=UTF-8";
+        case TEXT_PLAIN:
+            return "text/plain; charset=UTF-8";
+        case APPLICATION_JAVASCRIPT:
+            return "application/javascript; charset=UTF-8";
+        case APPLICATION_JSON:
+            return "application/json; charset=UTF-8";
+        case IMAGE_PNG:
+            return "image/png";
+        case IMAGE_X_ICON:
+            return "image/x-icon";
+        case TEXT_EVENT_STREAM:
+            return "text/event-stream";
+        default:
+            throw OwnException("Invalid content type");
+    }
+}
+
+bool Http::isCompressible(Http::ContentType contentType) {
+    // Images are compressed already; event streams are compressed piece by piece, flushing every piece
+    return contentType != NO_CONTENT_TYPE && contentType != IMAGE_PNG && contentType != IMAGE_X_ICON;
+}
+
+void Http::appendNumber(std::string& output, uint64_t number) {
+    char digits[20];
+    size_t count = 0;
+    do {
+        digits[count++] = (char) ('0' + number % 10);
+        number /= 10;
+    } while (number != 0);
+
+    size_t size = output.size();
+    output.resize(size + count);
+    for (size_t i = 0; i < count; ++i) {
+        output[size + i] = digits[count - 1 - i];
+    }
+}
+
+bool Http::parseNumber(std::string_view string, uint64_t& number) {
+    if (string.empty()) {
+        return false;
+    }
+    std::from_chars_result parsed = std::from_chars(string.data(), string.data() + string.size(), number);
+    return parsed.ec == std::errc() && parsed.ptr == string.data() + string.size();
+}
+
+bool Http::hasToken(const std::string& list, const std::string& token) {
+    size_t begin = 0;
+    while (begin < list.size()) {
+        size_t end = list.find(',', begin);
+        if (end == std::string::npos) {
+            end = list.size();
+        }
+
+        size_t first = begin, last = end;
+        for (; first < last && (list[first] == ' ' || list[first] == '\t'); ++first);
+        for (; last > first && (list[last - 1] == ' ' || list[last - 1] == '\t'); --last);
+        if (last - first == token.size() && strncasecmp(list.data() + first, token.data(), token.size()) == 0) {
+            return true;
+        }
+
+        begin = end + 1;
+    }
+    return false;
+}
+
+std::string_view Http::findCookie(std::string_view cookies, std::string_view name) {
+    // Pairs are separated by "; " (RFC 6265, section 4.2.1), though some clients leave the space out
+    while (!cookies.empty()) {
+        size_t end = cookies.find(';');
+        std::string_view pair = cookies.substr(0, end);
+        cookies = (end == std::string_view::npos) ? std::string_view() : cookies.substr(end + 1);
+
+        size_t first = pair.find_first_not_of(" \t");
+        if (first == std::string_view::npos) {
+            continue;
+        }
+        pair.remove_prefix(first);
+        size_t equal = pair.find('=');
+        if (equal != std::string_view::npos && pair.substr(0, equal) == name) {
+            std::string_view value = pair.substr(equal + 1);
+            return value.substr(0, value.find_last_not_of(" \t") + 1);
+        }
+    }
+    return std::string_view();
+}
+
+bool Http::etagMatches(const std::string& ifNoneMatch, const std::string& etag) {
+    std::string_view tag = etag;
+    if (tag.substr(0, 2) == "W/") {
+        tag.remove_prefix(2);
+    }
+
+    std::string_view list = ifNoneMatch;
+    while (!list.empty()) {
+        size_t comma = list.find(',');
+        std::string_view item = list.substr(0, comma);
+        list = (comma == std::string_view::npos) ? std::string_view() : list.substr(comma + 1);
+
+        size_t first = item.find_first_not_of(" \t");
+        if (first == std::string_view::npos) {
+            continue;
+        }
+        item = item.substr(first, item.find_last_not_of(" \t") - first + 1);
+        if (item.substr(0, 2) == "W/") {
+            item.remove_prefix(2);
+        }
+        if (item == "*" || item == tag) {
+            return true;
+        }
+    }
+    return false;
+}
+
+std::string Http::formatDate(time_t time) {
+    tm fields;
+    gmtime_r(&time, &fields);
+
+    char buffer[32];
+    size_t size = strftime(buffer, sizeof buffer, "%a, %d %b %Y %H:%M:%S GMT", &fields);
+    return std::string(buffer, size);
+}
+
+time_t Http::parseDate(const std::string& date) {
+    tm fields = {};
+    const char* end = strptime(date.c_str(), "%a, %d %b %Y %H:%M:%S GMT", &fields);
+    if (end == NULL || *end != '\0') {
+        return -1;
+    }
+    return timegm(&fields);
+}
+
+double Http::encodingQuality(const std::string& acceptEncoding, std::string_view coding) {
+    double quality = -1, anyQuality = -1;
+    std::string_view list = acceptEncoding;
+    while (!list.empty()) {
+        size_t comma = list.find(',');
+        std::string_view item = list.substr(0, comma);
+        list = (comma == std::string_view::npos) ? std::string_view() : list.substr(comma + 1);
+
+        size_t semicolon = item.find(';');
+        std::string_view name = item.substr(0, semicolon);
+        size_t first = name.find_first_not_of(" \t");
+        if (first == std::string_view::npos) {
+            continue;
+        }
+        name = name.substr(first, name.find_last_not_of(" \t") - first + 1);
+
+        double itemQuality = 1;
+        if (semicolon != std::string_view::npos) {
+            std::string_view parameters = item.substr(semicolon + 1);
+            size_t q = parameters.find("q=");
+            if (q != std::string_view::npos) {
+                itemQuality = strtod(std::string(parameters.substr(q + 2)).c_str(), NULL);
+            }
+        }
+
+        if (name.size() == coding.size() && strncasecmp(name.data(), coding.data(), coding.size()) == 0) {
+            quality = itemQuality;
+        } else if (name == "*") {
+            anyQuality = itemQuality;
+        }
+    }
+
+    if (quality >= 0) {
+        return quality;
+    } else if (anyQuality >= 0) {
+        return anyQuality;
+    } else {
+        return (coding == "identity") ? 1 : 0;
+    }
+}
+
 std::string Http::getUriPath(const std::string& uri) {
     std::string path = uri;
     size_t authority = path.find("//");
@@ -279,44 +411,19 @@ std::string Http::getUriPath(const std::string& uri) {
     }
 }
 
-std::map<std::string, std::string> Http::queryParameters(const std::string& uri) {
-    size_t question = uri.find('?');
-    if (question == std::string::npos) {
-        return std::map<std::string, std::string>();
-    }
-
-    std::map<std::string, std::string> parameters;
-    std::string query = uri.substr(question + 1, uri.size() - question - 1);
-    size_t ampersand;
-    size_t hash;
-    while ((ampersand = query.find('&')) != std::string::npos
-           && ((hash = query.find('#')) == std::string::npos || ampersand < hash)) {
-        std::string parameter = query.substr(0, ampersand);
-        query.erase(0, ampersand + 1);
-
-        size_t equal = parameter.find('=');
-        if (equal == std::string::npos || equal == 0 || equal == parameter.size() - 1) {
-            throw OwnException("Wrong query parameter: " + parameter);
-        }
-        std::string value = parameter.substr(equal + 1, parameter.size() - equal - 1);
-        if (value.find('=') != std::string::npos) {
-            throw OwnException("Wrong query parameter: " + parameter);
+std::string_view Http::getUriPathView(std::string_view uri) {
+    size_t begin = 0;
+    if (uri.empty() || uri[0] != '/') {
+        size_t authority = uri.find("//");
+        begin = (authority != std::string_view::npos) ? uri.find('/', authority + 2) : uri.find('/');
+        if (begin == std::string_view::npos) {
+            return "/";
         }
-        parameters[uriDecode(parameter.substr(0, equal))] = uriDecode(value);
     }
 
-    if (hash != std::string::npos) {
-        query = query.substr(0, hash);
-    }
-    size_t equal = query.find('=');
-    if (equal == std::string::npos || equal == 0 || equal == query.size() - 1) {
-        throw OwnException("Wrong query parameter: " + query);
+    size_t end = uri.find_first_of("?#", begin);
+    if (end == std::string_view::npos) {
+        end = uri.size();
     }
-    std::string value = query.substr(equal + 1, query.size() - equal - 1);
-    if (value.find('=') != std::string::npos) {
-        throw OwnException("Wrong query parameter: " + query);
-    }
-    parameters[uriDecode(query.substr(0, equal))] = uriDecode(value);
-
-    return parameters;
+    return uri.substr(begin, end - begin);
 }
@@ -3,23 +3,89 @@
 
 
 #include <map>
+#include <string_view>
+#include <vector>
+
+#include <ctime>
+
+#include <strings.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #include "../common.h"
 
 namespace Http {
     enum Method {GET, HEAD, OPTIONS, POST};
+    const size_t METHOD_COUNT = POST + 1;
+    enum ContentType {NO_CONTENT_TYPE, TEXT_HTML, TEXT_CSS, TEXT_PLAIN, APPLICATION_JAVASCRIPT, APPLICATION_JSON,
+                      IMAGE_PNG, IMAGE_X_ICON, TEXT_EVENT_STREAM};
+    const size_t CONTENT_TYPE_COUNT = TEXT_EVENT_STREAM + 1;
 
     const std::string VERSION1_0 = "HTTP/1.0";
     const std::string VERSION1_1 = "HTTP/1.1";
+    const std::string VERSION2_0 = "HTTP/2.0";
+
+    // Header fields as HTTP/2 sends them, in order and with lowercase names
+    typedef std::pair<std::string, std::string> HeaderField;
+    typedef std::vector<HeaderField> HeaderList;
 
     std::string methodToString(Method);
     Method stringToMethod(const std::string&);
+    // Like stringToMethod, for untrusted input: false instead of an exception
+    bool parseMethod(std::string_view, Method&);
+
+    // Percent-encoding of every byte outside the unreserved set; decoding turns '+' into a space by default,
+    // as in query strings
+    std::string uriEncode(std::string_view);
+    std::string uriDecode(std::string_view, bool = true);
+    bool uriDecodeInPlace(std::string&, bool = true);
+
+    std::string reasonPhrase(int);
+
+    // Usable in constant expressions, so the generated resource table can have the types of its files
+    constexpr ContentType contentTypeByExtension(std::string_view filename) {
+        size_t dot = filename.rfind('.');
+        std::string_view extension = (dot != std::string_view::npos) ? filename.substr(dot + 1) : "";
+        if (extension == "js") {
+            return APPLICATION_JAVASCRIPT;
+        } else if (extension == "html" || extension == "htm") {
+            return TEXT_HTML;
+        } else if (extension == "css") {
+            return TEXT_CSS;
+        } else if (extension == "json") {
+            return APPLICATION_JSON;
+        } else if (extension == "txt") {
+            return TEXT_PLAIN;
+        } else if (extension == "png") {
+            return IMAGE_PNG;
+        } else if (extension == "ico") {
+            return IMAGE_X_ICON;
+        } else {
+            return NO_CONTENT_TYPE;
+        }
+    }
+    std::string contentTypeToString(ContentType);
+    bool isCompressible(ContentType);
+
+    void appendNumber(std::string&, uint64_t);
+    // Only digits, without a sign or spaces, that fit into the result
+    bool parseNumber(std::string_view, uint64_t&);
+    bool hasToken(const std::string&, const std::string&);
+    // Whether an If-None-Match header lists the entity tag, comparing weakly as RFC 7232 asks
+    bool etagMatches(const std::string&, const std::string&);
+    // The value of the named cookie in a Cookie header, or an empty view when it's not there
+    std::string_view findCookie(std::string_view, std::string_view);
 
-    std::string uriEncode(const std::string&);
-    std::string uriDecode(const std::string&);
+    std::string formatDate(time_t);
+    // Parses an IMF-fixdate; returns -1 for anything else
+    time_t parseDate(const std::string&);
+    // The q-value an Accept-Encoding header gives to a content coding
+    double encodingQuality(const std::string&, std::string_view);
 
     std::string getUriPath(const std::string&);
-    std::map<std::string, std::string> queryParameters(const std::string&);
+    std::string_view getUriPathView(std::string_view);
 }
 
 
@@ -1,8 +1,9 @@
 #include "http_message.h"
 
-HttpMessage::HttpMessage(): state(START), isParsed(true) {}
+HttpMessage::HttpMessage(): state(START), isParsed(true), isChunked(false), declaredBodySize(0) {}
 
-HttpMessage::HttpMessage(const std::string& version): state(START), isParsed(false), version(version) {}
+HttpMessage::HttpMessage(const std::string& version): state(START), isParsed(false), isChunked(false),
+                                                      version(version), declaredBodySize(0) {}
 
 void HttpMessage::parseHeader(const std::string& header) {
     if (!isParsed) {
@@ -10,32 +11,42 @@ void HttpMessage::parseHeader(const std::string& header) {
     }
 
     if (header.empty()) {
-        state = shouldHaveBody() ? BODY : FINISHED;
+        if (!shouldHaveBody()) {
+            state = FINISHED;
+            return;
+        }
+        // Chunked bodies aren't supported
+        uint64_t size;
+        if (isChunked || !Http::parseNumber(getHeader("content-length"), size)) {
+            state = INVALID;
+            return;
+        }
+        declaredBodySize = size;
+        state = (declaredBodySize == 0) ? FINISHED : BODY;
         return;
     }
 
     size_t colon = header.find(':');
-    if (colon == std::string::npos) {
-        throw OwnException("Invalid header: there is no colon");
-    } else if (colon == 0) {
-        throw OwnException("Invalid header: empty name");
+    if (colon == std::string::npos || colon == 0) {
+        state = INVALID;
+        return;
     }
     std::string name = header.substr(0, colon);
     if (name.find(' ') != std::string::npos) {
-        throw OwnException("Invalid header: there is a space in the name");
+        state = INVALID;
+        return;
     }
 
-    std::string value = header.substr(colon + 1);
     size_t fns;
-    for (fns = 0; fns < value.size() && (value[fns] == ' ' || value[fns] == '\t'); ++fns);
-    if (fns == value.size()) {
-        throw OwnException("Invalid header: empty value");
+    for (fns = colon + 1; fns < header.size() && (header[fns] == ' ' || header[fns] == '\t'); ++fns);
+    if (fns == header.size()) {
+        state = INVALID;
+        return;
     }
     size_t lns;
-    for (lns = value.size() - 1; value[lns] == ' ' || value[lns] == '\t'; --lns);
-    value = value.substr(fns, lns - fns + 1);
+    for (lns = header.size() - 1; header[lns] == ' ' || header[lns] == '\t'; --lns);
 
-    setHeader(name, value);
+    setHeader(name, header.substr(fns, lns - fns + 1));
 }
 
 std::string HttpMessage::getVersion() const {
@@ -46,15 +57,16 @@ const HttpMessage::HeaderMap& HttpMessage::getHeaders() const {
     return headers;
 }
 
+bool HttpMessage::hasHeader(const std::string& name) const {
+    return headers.find(toLowerCase(name)) != headers.end();
+}
+
 std::string HttpMessage::getHeader(const std::string& name) const {
-    try {
-        return headers.at(toLowerCase(name));
-    } catch (const std::out_of_range& oor) {
-        return "";
-    }
+    HeaderMap::const_iterator it = headers.find(toLowerCase(name));
+    return (it != headers.end()) ? it->second : "";
 }
 
-std::string HttpMessage::getBody() const {
+const std::string& HttpMessage::getBody() const {
     return body;
 }
 
@@ -80,6 +92,14 @@ void HttpMessage::appendBody(const std::string& data) {
     body += data;
 }
 
+void HttpMessage::swapBody(std::string& data) {
+    if (!shouldHaveBody()) {
+        throw OwnException("The message shouldn't have a body");
+    }
+
+    body.swap(data);
+}
+
 HttpMessage::State HttpMessage::getState() const {
     return state;
 }
@@ -89,9 +109,6 @@ void HttpMessage::finish() {
         throw OwnException("Only constructed messages can be finished");
     }
 
-    if (shouldHaveBody()) {
-        setHeader("Content-Length", std::to_string(body.size()));
-    }
     state = FINISHED;
 }
 
@@ -104,6 +121,11 @@ std::string HttpMessage::to_string() const {
     for (HeaderMap::const_iterator it = headers.begin(); it != headers.end(); ++it) {
         representation += it->first + ": " + it->second + CRLF;
     }
+    if (shouldHaveBody() && !isParsed) {
+        representation += "content-length: ";
+        Http::appendNumber(representation, body.size());
+        representation += CRLF;
+    }
     representation += CRLF;
     if (shouldHaveBody()) {
         representation += body;
@@ -112,27 +134,21 @@ std::string HttpMessage::to_string() const {
 }
 
 size_t HttpMessage::getDeclaredBodySize() const {
-    if (isParsed) {
-        if (state == BODY || state == FINISHED) {
-            std::string resultAsString;
-            if (isChunked) {
-                resultAsString = getHeader("transfer-encoding");
-            } else {
-                resultAsString = getHeader("content-length");
-            }
-            if (resultAsString == "") {
-                throw OwnException("The body length wasn't initialized");
-            } else {
-                return std::stoul(resultAsString);
-            }
-        } else {
-            throw OwnException("The message headers aren't finished receiving");
-        }
-    } else {
+    if (!isParsed) {
         throw OwnException("The body length will be set after finishing the message");
+    } else if (state != BODY && state != FINISHED) {
+        throw OwnException("The message headers aren't finished receiving");
     }
+    return declaredBodySize;
 }
 
 bool HttpMessage::shouldKeepAlive() const {
-    return toLowerCase(getHeader("Connection")) == "keep-alive";
+    std::string connection = getHeader("Connection");
+    if (Http::hasToken(connection, "close")) {
+        return false;
+    } else if (Http::hasToken(connection, "keep-alive")) {
+        return true;
+    } else {
+        return version != Http::VERSION1_0;
+    }
 }
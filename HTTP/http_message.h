@@ -19,26 +19,31 @@ protected:
     std::string version;
     HeaderMap headers;
     std::string body;
+    // Of a parsed message, known when its headers end
+    size_t declaredBodySize;
 
     HttpMessage();
     HttpMessage(const std::string&);
 
     virtual bool shouldHaveBody() const = 0;
+    // Malformed headers make the message INVALID rather than throwing, as they're common in hostile traffic
     void parseHeader(const std::string&);
 public:
     std::string getVersion() const;
     const HeaderMap& getHeaders() const;
     std::string getHeader(const std::string&) const;
-    std::string getBody() const;
+    bool hasHeader(const std::string&) const;
+    const std::string& getBody() const;
     size_t getBodySize() const;
 
     void setHeader(const std::string&, const std::string&);
     void appendBody(const std::string&);
+    void swapBody(std::string&);
 
     State getState() const;
     virtual std::string firstLine() const = 0;
     void finish();
-    std::string to_string() const;
+    virtual std::string to_string() const;
 
     size_t getDeclaredBodySize() const;
     bool shouldKeepAlive() const;
@@ -24,60 +24,71 @@ std::string HttpRequest::getUri() const {
     return uri;
 }
 
+std::string_view HttpRequest::getUriView() const {
+    return uri;
+}
+
 std::string HttpRequest::getUriDecoded() const {
-    return Http::uriDecode(uri);
+    return Http::uriDecode(uri, false);
+}
+
+std::string_view HttpRequest::getUriPath() const {
+    return Http::getUriPathView(uri);
+}
+
+const RouteParameters& HttpRequest::getRouteParameters() const {
+    return routeParameters;
+}
+
+std::string_view HttpRequest::getRouteParameter(std::string_view name) const {
+    return routeParameters.get(name);
+}
+
+void HttpRequest::setRouteParameters(const RouteParameters& parameters) {
+    routeParameters = parameters;
 }
 
 void HttpRequest::append(std::string data) {
     if (!isParsed) {
-        throw "The message is constructed, not parsed";
+        throw OwnException("The message is constructed, not parsed");
     }
 
-    try {
-        switch (state) {
-            case START: {
-                size_t space = data.find(' ');
-                std::string method = data.substr(0, space);
-                this->method = Http::stringToMethod(method);
-                data.erase(0, space + 1);
-
-                space = data.find(' ');
-                uri = data.substr(0, space);
-                data.erase(0, space + 1);
-
-                if (data.size() != 8
-                    || data[0] != 'H' || data[1] != 'T' || data[2] != 'T' || data[3] != 'P' || data[4] != '/'
-                    || data[6] != '.' || data[5] < '0' || data[5] > '9' || data[7] < '0' || data[7] > '9') {
-                    state = INVALID;
-                    return;
-                }
-                version = data;
-                state = HEADER;
+    switch (state) {
+        case START: {
+            size_t space = data.find(' ');
+            if (space == std::string::npos || !Http::parseMethod(std::string_view(data).substr(0, space), method)) {
+                state = INVALID;
                 return;
             }
-            case HEADER: {
-                parseHeader(data);
+            data.erase(0, space + 1);
+
+            space = data.find(' ');
+            uri = data.substr(0, space);
+            data.erase(0, space + 1);
+
+            if (data.size() != 8
+                || data[0] != 'H' || data[1] != 'T' || data[2] != 'T' || data[3] != 'P' || data[4] != '/'
+                || data[6] != '.' || data[5] < '0' || data[5] > '9' || data[7] < '0' || data[7] > '9') {
+                state = INVALID;
                 return;
             }
-            case BODY: {
-                appendBody(data);
-                if (getBodySize() == getDeclaredBodySize()) {
-                    state = FINISHED;
-                    return;
-                } else {
-                    return;
-                }
-            }
-            default: {
-                throw OwnException("The message is finished");
+            version = data;
+            state = HEADER;
+            return;
+        }
+        case HEADER: {
+            parseHeader(data);
+            return;
+        }
+        case BODY: {
+            body += data;
+            if (getBodySize() >= getDeclaredBodySize()) {
+                state = (getBodySize() == getDeclaredBodySize()) ? FINISHED : INVALID;
             }
+            return;
         }
-    } catch (const std::exception& exception) {
-        if (strcmp(exception.what(), "The message is finished")) {
-//        if (exception.what() == "The message is finished") {
-            throw exception;
-        } else {
-            state = INVALID;
+        default: {
+            throw OwnException("The message is finished");
         }
     }
 }
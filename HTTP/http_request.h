@@ -3,10 +3,12 @@
 
 
 #include "http_message.h"
+#include "router.h"
 
 class HttpRequest: public HttpMessage {
     Http::Method method;
     std::string uri;
+    RouteParameters routeParameters;
 
     virtual bool shouldHaveBody() const;
 public:
@@ -17,7 +19,13 @@ public:
     Http::Method getMethod() const;
     std::string getMethodAsString() const;
     std::string getUri() const;
+    std::string_view getUriView() const;
     std::string getUriDecoded() const;
+    std::string_view getUriPath() const;
+    const RouteParameters& getRouteParameters() const;
+    std::string_view getRouteParameter(std::string_view) const;
+
+    void setRouteParameters(const RouteParameters&);
 
     void append(std::string);
     virtual std::string firstLine() const;
@@ -1,15 +1,21 @@
 #include "http_response.h"
 
-HttpResponse::HttpResponse(): HttpMessage() {}
+const std::string HttpResponse::SERVER_HEADER = "server: HttpWebChat" + CRLF;
+std::string HttpResponse::date;
+std::string HttpResponse::dateHeader;
+
+HttpResponse::HttpResponse(): HttpMessage(), contentType(Http::NO_CONTENT_TYPE) {}
 
 HttpResponse::HttpResponse(Http::Method requestedMethod,
                            const std::string& version, int statusCode, const std::string& reasonPhrase):
-        HttpMessage(version), requestedMethod(requestedMethod), statusCode(statusCode), reasonPhrase(reasonPhrase) {
+        HttpMessage(version), requestedMethod(requestedMethod), statusCode(statusCode), reasonPhrase(reasonPhrase),
+        contentType(Http::NO_CONTENT_TYPE) {
 }
 
 bool HttpResponse::shouldHaveBody() const {
     return (isParsed && (getHeader("Content-Length") != "" || getHeader("Transfer-Encoding") != ""))
-           || (!isParsed && requestedMethod != Http::Method::HEAD);
+           || (!isParsed && requestedMethod != Http::Method::HEAD
+               && statusCode >= 200 && statusCode != 204 && statusCode != 304);
 }
 
 Http::Method HttpResponse::getRequestedMethod() const {
@@ -27,6 +33,10 @@ std::string HttpResponse::getReasonPhrase() const {
     return reasonPhrase;
 }
 
+Http::ContentType HttpResponse::getContentType() const {
+    return contentType;
+}
+
 void HttpResponse::setRequestedMethod(Http::Method method) {
     if (!isParsed) {
         throw OwnException("Requested method was set during construction");
@@ -34,54 +44,52 @@ void HttpResponse::setRequestedMethod(Http::Method method) {
     requestedMethod = method;
 }
 
+void HttpResponse::setContentType(Http::ContentType type) {
+    contentType = type;
+}
+
 void HttpResponse::append(std::string data) {
     if (!isParsed) {
         throw OwnException("The message is constructed, not parsed");
     }
 
-    try {
-        switch (state) {
-            case START: {
-                size_t space = data.find(' ');
-                std::string version = data.substr(0, space);
-                if (version.size() != 8
-                    || version[0] != 'H' || version[1] != 'T' || version[2] != 'T' || version[3] != 'P'
-                    || version[4] != '/' || version[6] != '.' || version[5] < '0' || version[5] > '9'
-                    || version[7] < '0' || version[7] > '9') {
-                    state = INVALID;
-                    return;
-                }
-                this->version = version;
-                data.erase(0, space + 1);
-
-                space = data.find(' ');
-                statusCode = std::stoi(data.substr(0, space));
-                data.erase(0, space + 1);
-
-                reasonPhrase = data;
-                state = HEADER;
+    switch (state) {
+        case START: {
+            size_t space = data.find(' ');
+            std::string version = data.substr(0, space);
+            if (version.size() != 8
+                || version[0] != 'H' || version[1] != 'T' || version[2] != 'T' || version[3] != 'P'
+                || version[4] != '/' || version[6] != '.' || version[5] < '0' || version[5] > '9'
+                || version[7] < '0' || version[7] > '9') {
+                state = INVALID;
                 return;
-            } case HEADER: {
-                parseHeader(data);
+            }
+            this->version = version;
+            data.erase(0, space + 1);
+
+            space = data.find(' ');
+            uint64_t code;
+            if (!Http::parseNumber(std::string_view(data).substr(0, space), code) || code < 100 || code > 999) {
+                state = INVALID;
                 return;
-            } case BODY: {
-                appendBody(data);
-                if (getBodySize() == getDeclaredBodySize()) {
-                    state = FINISHED;
-                    return;
-                } else {
-                    return;
-                }
-            } default: {
-                throw OwnException("The message is finished");
             }
-        }
-    } catch (const std::exception& exception) {
-        if (strcmp(exception.what(), "The message is finished")) {
-//        if (exception.what() == "The message is finished") {
-            throw exception;
-        } else {
-            state = INVALID;
+            statusCode = (int) code;
+            data.erase(0, (space == std::string::npos) ? data.size() : space + 1);
+
+            reasonPhrase = data;
+            state = HEADER;
+            return;
+        } case HEADER: {
+            parseHeader(data);
+            return;
+        } case BODY: {
+            body += data;
+            if (getBodySize() >= getDeclaredBodySize()) {
+                state = (getBodySize() == getDeclaredBodySize()) ? FINISHED : INVALID;
+            }
+            return;
+        } default: {
+            throw OwnException("The message is finished");
         }
     }
 }
@@ -89,3 +97,197 @@ void HttpResponse::append(std::string data) {
 std::string HttpResponse::firstLine() const {
     return version + " " + std::to_string(statusCode) + " " + reasonPhrase + CRLF;
 }
+
+std::string HttpResponse::to_string() const {
+    std::string representation;
+    serialize(representation, "");
+    return representation;
+}
+
+namespace {
+    const int MAX_STATUS_CODE = 600;
+
+    // "HTTP/1.1 <code> <reason>\r\n" for every code with a known reason phrase
+    const std::vector<std::string>& statusLines() {
+        static std::vector<std::string> lines;
+        if (lines.empty()) {
+            lines.resize(MAX_STATUS_CODE);
+            for (int code = 100; code < MAX_STATUS_CODE; ++code) {
+                std::string reasonPhrase = Http::reasonPhrase(code);
+                if (!reasonPhrase.empty()) {
+                    lines[code] = Http::VERSION1_1 + " " + std::to_string(code) + " " + reasonPhrase + CRLF;
+                }
+            }
+        }
+        return lines;
+    }
+
+    const std::vector<std::string>& contentTypeHeaders() {
+        static std::vector<std::string> headers;
+        if (headers.empty()) {
+            for (size_t type = Http::NO_CONTENT_TYPE; type < Http::CONTENT_TYPE_COUNT; ++type) {
+                headers.push_back((type == Http::NO_CONTENT_TYPE)
+                                  ? ""
+                                  : "content-type: " + Http::contentTypeToString((Http::ContentType) type) + CRLF);
+            }
+        }
+        return headers;
+    }
+}
+
+void HttpResponse::serialize(std::string& output, const std::string& extraHeaders) const {
+    if (state != FINISHED) {
+        throw OwnException("Message isn't finished yet");
+    }
+    if (dateHeader.empty()) {
+        updateDate(time(NULL));
+    }
+
+    bool hasBody = shouldHaveBody();
+    output.reserve(output.size() + 256 + (hasBody ? body.size() : 0));
+
+    appendStatusLine(output);
+    output += dateHeader;
+    appendHeaders(output);
+    output += extraHeaders;
+    if (hasBody) {
+        output += "content-length: ";
+        Http::appendNumber(output, body.size());
+        output += CRLF;
+    }
+    output += CRLF;
+    if (hasBody) {
+        output += body;
+    }
+}
+
+void HttpResponse::serializeHead(std::string& output, const std::string& extraHeaders) const {
+    if (dateHeader.empty()) {
+        updateDate(time(NULL));
+    }
+
+    appendStatusLine(output);
+    output += dateHeader;
+    appendHeaders(output);
+    output += extraHeaders;
+    output += CRLF;
+}
+
+void HttpResponse::appendStatusLine(std::string& output) const {
+    const std::vector<std::string>& lines = statusLines();
+    if (version == Http::VERSION1_1 && statusCode >= 0 && statusCode < MAX_STATUS_CODE
+        && !lines[statusCode].empty() && lines[statusCode].compare(13, reasonPhrase.size(), reasonPhrase) == 0
+        && lines[statusCode].size() == 15 + reasonPhrase.size()) {
+        output += lines[statusCode];
+    } else {
+        output += firstLine();
+    }
+}
+
+void HttpResponse::appendHeaders(std::string& output) const {
+    output += SERVER_HEADER;
+    output += contentTypeHeaders()[contentType];
+    for (HeaderMap::const_iterator it = headers.begin(); it != headers.end(); ++it) {
+        output += it->first;
+        output += ": ";
+        output += it->second;
+        output += CRLF;
+    }
+}
+
+void HttpResponse::appendFields(Http::HeaderList& fields) const {
+    fields.push_back(Http::HeaderField("server", "HttpWebChat"));
+    if (contentType != Http::NO_CONTENT_TYPE) {
+        fields.push_back(Http::HeaderField("content-type", Http::contentTypeToString(contentType)));
+    }
+    for (HeaderMap::const_iterator it = headers.begin(); it != headers.end(); ++it) {
+        // Connection-specific headers aren't allowed in HTTP/2
+        if (it->first != "connection" && it->first != "keep-alive" && it->first != "transfer-encoding"
+            && it->first != "upgrade") {
+            fields.push_back(*it);
+        }
+    }
+}
+
+void HttpResponse::getFields(Http::HeaderList& fields, bool withLength) const {
+    appendFields(fields);
+    if (withLength && shouldHaveBody()) {
+        std::string length;
+        Http::appendNumber(length, body.size());
+        fields.push_back(Http::HeaderField("content-length", length));
+    }
+}
+
+const std::string& HttpResponse::getDate() {
+    if (date.empty()) {
+        updateDate(time(NULL));
+    }
+    return date;
+}
+
+HttpResponse::Prepared HttpResponse::prepare(const char* data, size_t size,
+                                             const std::shared_ptr<const void>& owner) const {
+    return Prepared(*this, data, size, owner);
+}
+
+void HttpResponse::updateDate(time_t now) {
+    date = Http::formatDate(now);
+    dateHeader = "date: " + date + CRLF;
+}
+
+HttpResponse::Prepared::Prepared(): statusCode(0), body(NULL), bodySize(0) {}
+
+HttpResponse::Prepared::Prepared(const HttpResponse& response, const char* data, size_t size,
+                                 const std::shared_ptr<const void>& owner):
+        statusCode(response.statusCode), body(NULL), bodySize(0) {
+    if (response.isParsed || response.getBodySize() != 0) {
+        throw OwnException("Only constructed responses without a body can be prepared");
+    }
+
+    response.appendStatusLine(statusLine);
+    response.appendHeaders(headers);
+    response.appendFields(fields);
+    if (response.statusCode >= 200 && response.statusCode != 204 && response.statusCode != 304) {
+        std::string length;
+        Http::appendNumber(length, size);
+        headers += "content-length: " + length + CRLF;
+        fields.push_back(Http::HeaderField("content-length", length));
+    }
+    if (response.shouldHaveBody()) {
+        body = data;
+        bodySize = size;
+        this->owner = owner;
+    }
+}
+
+void HttpResponse::Prepared::serializeHead(std::string& output, const std::string& extraHeaders) const {
+    if (dateHeader.empty()) {
+        updateDate(time(NULL));
+    }
+
+    output += statusLine;
+    output += dateHeader;
+    output += headers;
+    output += extraHeaders;
+    output += CRLF;
+}
+
+const char* HttpResponse::Prepared::getBody() const {
+    return body;
+}
+
+size_t HttpResponse::Prepared::getBodySize() const {
+    return bodySize;
+}
+
+const std::shared_ptr<const void>& HttpResponse::Prepared::getOwner() const {
+    return owner;
+}
+
+int HttpResponse::Prepared::getStatusCode() const {
+    return statusCode;
+}
+
+const Http::HeaderList& HttpResponse::Prepared::getFields() const {
+    return fields;
+}
@@ -2,15 +2,53 @@
 #define HTTPWEBCHAT_HTTPRESPONSE_H
 
 
+#include <ctime>
+#include <memory>
+#include <vector>
+
 #include "http_message.h"
 
 class HttpResponse: public HttpMessage {
     Http::Method requestedMethod;
     int statusCode;
     std::string reasonPhrase;
+    Http::ContentType contentType;
+
+    static std::string date;
+    static std::string dateHeader;
 
     virtual bool shouldHaveBody() const;
+    void appendStatusLine(std::string&) const;
+    void appendHeaders(std::string&) const;
+    void appendFields(Http::HeaderList&) const;
 public:
+    static const std::string SERVER_HEADER;
+
+    // A response serialized once and sent any number of times: only the date and the connection headers
+    // are added per request, and the body is referenced rather than copied, so it has to outlive the object
+    // unless the owner keeping it alive is given
+    class Prepared {
+        std::string statusLine;
+        std::string headers;
+        // The same for HTTP/2, without the status and the date
+        int statusCode;
+        Http::HeaderList fields;
+        const char* body;
+        size_t bodySize;
+        std::shared_ptr<const void> owner;
+    public:
+        Prepared();
+        // The response itself has no body; a response to HEAD still gets the Content-Length of the given one
+        Prepared(const HttpResponse&, const char*, size_t, const std::shared_ptr<const void>& = nullptr);
+
+        void serializeHead(std::string&, const std::string&) const;
+        const char* getBody() const;
+        size_t getBodySize() const;
+        const std::shared_ptr<const void>& getOwner() const;
+        int getStatusCode() const;
+        const Http::HeaderList& getFields() const;
+    };
+
     HttpResponse();
     HttpResponse(Http::Method, const std::string&, int, const std::string&);
 
@@ -18,10 +56,24 @@ public:
     int getStatusCode() const;
     std::string getReasonPhrase() const;
 
+    Http::ContentType getContentType() const;
+
     void setRequestedMethod(Http::Method);
+    void setContentType(Http::ContentType);
 
     void append(std::string);
     virtual std::string firstLine() const;
+    virtual std::string to_string() const;
+    void serialize(std::string&, const std::string&) const;
+    // Only the status line and headers, without Content-Length, of a response whose body is streamed after it
+    void serializeHead(std::string&, const std::string&) const;
+    Prepared prepare(const char*, size_t, const std::shared_ptr<const void>& = nullptr) const;
+    // The header fields of an HTTP/2 response, apart from the status and the date; content-length is left out
+    // for streamed bodies
+    void getFields(Http::HeaderList&, bool = true) const;
+
+    static void updateDate(time_t);
+    static const std::string& getDate();
 };
 
 
@@ -1,94 +1,602 @@
+#include "http2_connection.h"
 #include "http_server.h"
+#include "websocket_connection.h"
 
-HttpServer::ResponseSocket::ResponseSocket(TcpServerSocket& socket): socket(socket) {
-    valid = true;
+HttpServer::Settings::Settings(): maxPipelineDepth(16), idleTimeout(15), maxRequestsPerConnection(1000),
+                                  headerTimeout(10), bodyTimeout(30), maxRequestLineLength(8192), maxHeaderCount(100),
+                                  maxHeaderSize(16384), maxBodySize(1 << 20), compressionLevel(6),
+                                  compressionMinSize(1024), compressionMaxSize(4 << 20), maxCompressionRatio(0.9),
+                                  enableHttp2(true), maxConcurrentStreams(100),
+                                  maxWebSocketMessageSize(1 << 16) {}
+
+HttpServer::WebSocket::WebSocket(const std::shared_ptr<Connection>& connection): connection(connection) {}
+
+void HttpServer::WebSocket::encodeText(const std::string& text, std::string& frame) {
+    WebSocketConnection::encodeFrame(WebSocketConnection::TEXT, text.data(), text.size(), frame);
+}
+
+bool HttpServer::WebSocket::isOpened() const {
+    WebSocketConnection* webSocket = connection->getWebSocket();
+    return webSocket != NULL && webSocket->isOpened();
+}
+
+bool HttpServer::WebSocket::sendText(const std::string& text) {
+    WebSocketConnection* webSocket = connection->getWebSocket();
+    return webSocket != NULL && webSocket->send(WebSocketConnection::TEXT, text);
+}
+
+bool HttpServer::WebSocket::sendFrame(const std::string& frame) {
+    WebSocketConnection* webSocket = connection->getWebSocket();
+    return webSocket != NULL && webSocket->sendFrame(frame);
+}
+
+void HttpServer::WebSocket::close(uint16_t code) {
+    WebSocketConnection* webSocket = connection->getWebSocket();
+    if (webSocket != NULL) {
+        webSocket->close(code);
+    }
+}
+
+size_t HttpServer::WebSocket::getOutputSize() const {
+    return connection->getOutputSize(0);
+}
+
+HttpServer::ResponseSocket::ResponseSocket(const std::shared_ptr<Connection>& connection, uint64_t sequence):
+        connection(connection), sequence(sequence) {}
+
+bool HttpServer::ResponseSocket::isValid() const {
+    return connection->isPending(sequence);
 }
 
 void HttpServer::ResponseSocket::close() {
-    socket.close();
-    valid = false;
+    connection->close(sequence);
 }
 
 void HttpServer::ResponseSocket::end(HttpResponse& response) {
-    if (!valid) {
-        throw OwnException("The response can't be sent twice");
+    connection->complete(sequence, response);
+}
+
+void HttpServer::ResponseSocket::end(const HttpResponse::Prepared& response) {
+    connection->complete(sequence, response);
+}
+
+void HttpServer::ResponseSocket::start(HttpResponse& response) {
+    connection->startStream(sequence, response);
+}
+
+bool HttpServer::ResponseSocket::send(const std::string& data) {
+    return connection->sendStream(sequence, data);
+}
+
+size_t HttpServer::ResponseSocket::getOutputSize() const {
+    return connection->getOutputSize(sequence);
+}
+
+const std::string& HttpServer::ResponseSocket::getRemoteHost() const {
+    return connection->getRemoteHost();
+}
+
+HttpServer::WebSocket HttpServer::ResponseSocket::acceptWebSocket(const HttpRequest& request,
+                                                                  const WebSocket::MessageHandler& handler) {
+    connection->acceptWebSocket(sequence, request, handler);
+    return WebSocket(connection);
+}
+
+HttpServer::Connection::PendingResponse::PendingResponse(bool keepAlive, bool http10):
+        ready(false), close(false), keepAlive(keepAlive), http10(http10), compress(false),
+        coding(Compressor::GZIP), streaming(false), body(NULL), bodySize(0) {}
+
+HttpServer::Connection::Connection(HttpServer& server, TcpServerSocket* socket):
+        server(server), socket(socket), request(NULL), processing(false), closing(false), nextSequence(0),
+        lastActivity(std::chrono::steady_clock::now()) {}
+
+HttpServer::Connection::~Connection() {
+    delete request;
+    delete socket;
+}
+
+bool HttpServer::Connection::isOpened() const {
+    return socket->isOpened();
+}
+
+bool HttpServer::Connection::isIdle() const {
+    if (webSocket != NULL) {
+        return false;
+    } else if (http2 != NULL) {
+        return http2->isIdle() && socket->getOutputSize() == 0;
     }
+    return request == NULL && pending.empty() && socket->getOutputSize() == 0;
+}
 
-    response.finish();
-    socket.write(response.to_string());
-    valid = false;
+HttpServer::Connection::PendingResponse* HttpServer::Connection::getPending(uint64_t sequence) {
+    uint64_t firstSequence = nextSequence - pending.size();
+    if (sequence < firstSequence || sequence >= nextSequence) {
+        return NULL;
+    }
+    return &pending[sequence - firstSequence];
 }
 
-HttpServer::RequestHandler HttpServer::defaultHandler = [](const HttpRequest& request, ResponseSocket responseSocket) {
-    HttpResponse response(request.getMethod(),
-                          (request.getVersion() == Http::VERSION1_0) ? Http::VERSION1_0 : Http::VERSION1_1,
-                          405, "Method Not Allowed");
-    responseSocket.end(response);
-};
+bool HttpServer::Connection::isPending(uint64_t sequence) const {
+    if (!socket->isOpened()) {
+        return false;
+    } else if (http2 != NULL) {
+        return http2->isPending((uint32_t) sequence);
+    }
+    uint64_t firstSequence = nextSequence - pending.size();
+    return sequence >= firstSequence && sequence < nextSequence && !pending[sequence - firstSequence].ready;
+}
 
-HttpServer::HttpServer(uint16_t port, Poller& poller): listener(TcpAcceptSocket("127.0.0.1", port, [this](TcpServerSocket* socket) {
-    HttpRequest* request = NULL;
+void HttpServer::Connection::processData(std::deque<char>& dataDeque) {
+    if (processing) {
+        return;
+    }
+    processing = true;
+    std::shared_ptr<Connection> self = shared_from_this();
+    lastActivity = std::chrono::steady_clock::now();
+
+    if (webSocket != NULL) {
+        webSocket->processData(dataDeque);
+        processing = false;
+        return;
+    } else if (http2 == NULL && detectHttp2(dataDeque)) {
+        processing = false;
+        return;
+    } else if (http2 != NULL) {
+        http2->processData(dataDeque);
+        processing = false;
+        return;
+    }
 
-    socket->setReceivedDataHandler([=](std::deque<char>& dataDeque) mutable {
-        while (!dataDeque.empty() && socket->isOpened()) {
-            if (request == NULL) {
-                request = new HttpRequest();
+    const Settings& settings = server.settings;
+    while (!dataDeque.empty() && socket->isOpened() && !closing && pending.size() < settings.maxPipelineDepth) {
+        if (request == NULL) {
+            request = new HttpRequest();
+            requestStart = lastActivity;
+            headerSize = 0;
+            headerCount = 0;
+        }
+
+        while (request->getState() == HttpMessage::State::START
+               || request->getState() == HttpMessage::State::HEADER) {
+            std::deque<char>::iterator lf = std::find(dataDeque.begin(), dataDeque.end(), '\n');
+            size_t lineSize = lf - dataDeque.begin();
+            if (request->getState() == HttpMessage::State::START) {
+                if (lineSize > settings.maxRequestLineLength) {
+                    reject(414, "URI Too Long");
+                    break;
+                }
+            } else if (headerSize + lineSize > settings.maxHeaderSize) {
+                reject(431, "Request Header Fields Too Large");
+                break;
+            }
+            if (lf == dataDeque.end()) {
+                break;
             }
 
-            if (request->getState() == HttpMessage::State::START
-                || request->getState() == HttpMessage::State::HEADER) {
-                std::deque<char>::iterator lf;
-                while ((request->getState() == HttpMessage::State::START
-                        || request->getState() == HttpMessage::State::HEADER)
-                       && (lf = std::find(dataDeque.begin(), dataDeque.end(), '\n')) != dataDeque.end()) {
-                    request->append(std::string(dataDeque.begin(), lf - 1));
-                    dataDeque.erase(dataDeque.begin(), lf + 1);
+            std::deque<char>::iterator lineEnd = (lf != dataDeque.begin() && *(lf - 1) == '\r') ? lf - 1 : lf;
+            bool isHeader = request->getState() == HttpMessage::State::HEADER && lineEnd != dataDeque.begin();
+            request->append(std::string(dataDeque.begin(), lineEnd));
+            dataDeque.erase(dataDeque.begin(), lf + 1);
+
+            if (isHeader) {
+                headerSize += lineSize + 1;
+                if (++headerCount > settings.maxHeaderCount) {
+                    reject(431, "Request Header Fields Too Large");
+                    break;
                 }
             }
 
             if (request->getState() == HttpMessage::State::BODY) {
-                size_t currentBodySize = request->getBodySize();
-                size_t declaredBodySize = request->getDeclaredBodySize();
-                size_t charsToGet = std::min(declaredBodySize - currentBodySize, dataDeque.size());
+                if (request->getDeclaredBodySize() > settings.maxBodySize) {
+                    reject(413, "Payload Too Large");
+                    break;
+                }
+                bodyStart = std::chrono::steady_clock::now();
+            }
+        }
+        if (closing) {
+            break;
+        }
 
-                request->append(std::string(dataDeque.begin(), dataDeque.begin() + charsToGet));
-                dataDeque.erase(dataDeque.begin(), dataDeque.begin() + charsToGet);
+        if (request->getState() == HttpMessage::State::BODY) {
+            size_t currentBodySize = request->getBodySize();
+            size_t declaredBodySize = request->getDeclaredBodySize();
+            size_t charsToGet = std::min(declaredBodySize - currentBodySize, dataDeque.size());
+
+            request->append(std::string(dataDeque.begin(), dataDeque.begin() + charsToGet));
+            dataDeque.erase(dataDeque.begin(), dataDeque.begin() + charsToGet);
+        }
+
+        if (request->getState() == HttpMessage::State::FINISHED) {
+            HttpRequest* finished = request;
+            request = NULL;
+            if (upgradeToHttp2(*finished)) {
+                delete finished;
+                http2->processData(dataDeque);
+                break;
             }
 
-            if (request->getState() == HttpMessage::State::FINISHED) {
-                try {
-                    processRequest(socket, *request);
-                } catch (const std::exception& exception) {
-                    std::cerr << "Couldn't process a request: " << exception.what() << std::endl;
-                    socket->close();
-                }
-                delete request;
-                request = NULL;
-            } else if (request->getState() == HttpMessage::State::INVALID) {
-                delete request;
-                request = NULL;
+            uint64_t sequence = nextSequence++;
+            bool keepAlive = finished->shouldKeepAlive() && nextSequence < settings.maxRequestsPerConnection;
+            if (!keepAlive) {
+                closing = true;
+                dataDeque.clear();
             }
+            pending.push_back(PendingResponse(keepAlive, finished->getVersion() == Http::VERSION1_0));
+            server.chooseCoding(*finished, pending.back().compress, pending.back().coding);
+            try {
+                server.processRequest(*finished, ResponseSocket(self, sequence));
+            } catch (const std::exception& exception) {
+                std::cerr << "Couldn't process a request: " << exception.what() << std::endl;
+                socket->close();
+            }
+            delete finished;
+
+            if (webSocket != NULL) {
+                webSocket->processData(dataDeque);
+                break;
+            }
+        } else if (request->getState() == HttpMessage::State::INVALID) {
+            reject(400, "Bad Request");
+        } else {
+            break;
         }
-    });
+    }
+
+    processing = false;
+}
+
+bool HttpServer::Connection::detectHttp2(std::deque<char>& dataDeque) {
+    // With prior knowledge the client starts with the HTTP/2 preface instead of a request
+    const std::string& preface = Http2Connection::PREFACE;
+    size_t size = std::min(dataDeque.size(), preface.size());
+    if (!server.settings.enableHttp2 || nextSequence != 0 || request != NULL
+        || !std::equal(dataDeque.begin(), dataDeque.begin() + size, preface.begin())) {
+        return false;
+    } else if (size < preface.size()) {
+        return true;
+    }
+
+    http2.reset(new Http2Connection(*this));
+    return false;
+}
+
+bool HttpServer::Connection::upgradeToHttp2(HttpRequest& request) {
+    if (!server.settings.enableHttp2 || !pending.empty() || !request.shouldKeepAlive()
+        || !Http::hasToken(request.getHeader("Upgrade"), "h2c") || !request.hasHeader("HTTP2-Settings")
+        || !Http::hasToken(request.getHeader("Connection"), "upgrade")) {
+        return false;
+    }
+
+    socket->write("HTTP/1.1 101 Switching Protocols" + CRLF + "connection: Upgrade" + CRLF + "upgrade: h2c"
+                  + CRLF + CRLF);
+    http2.reset(new Http2Connection(*this));
+    http2->upgrade(request, request.getHeader("HTTP2-Settings"));
+    return true;
+}
+
+void HttpServer::Connection::reject(int statusCode, const std::string& reasonPhrase) {
+    delete request;
+    request = NULL;
+
+    closing = true;
+    socket->getInputBuffer().clear();
+
+    uint64_t sequence = nextSequence++;
+    pending.push_back(PendingResponse(false, false));
+    HttpResponse response(Http::Method::GET, Http::VERSION1_1, statusCode, reasonPhrase);
+    complete(sequence, response);
+}
+
+void HttpServer::Connection::flush() {
+    if (!socket->isOpened()) {
+        pending.clear();
+        return;
+    }
+
+    size_t depth = pending.size();
+    while (!pending.empty() && pending.front().ready) {
+        PendingResponse& response = pending.front();
+        if (!response.data.empty() || response.bodySize != 0) {
+            iovec parts[2] = {{&response.data[0], response.data.size()},
+                              {const_cast<char*>(response.body), response.bodySize}};
+            socket->write(parts, 2);
+        }
+        lastActivity = std::chrono::steady_clock::now();
+
+        if (response.streaming) {
+            // The rest of its body goes straight to the socket
+            response.data.clear();
+            response.body = NULL;
+            response.bodySize = 0;
+            response.bodyOwner.reset();
+            break;
+        }
+        if (pending.front().close) {
+            pending.clear();
+            closing = true;
+            socket->closeAfterWrite();
+            return;
+        }
+        pending.pop_front();
+    }
+
+    if (!processing && depth >= server.settings.maxPipelineDepth && pending.size() < depth) {
+        socket->processReceivedData();
+    }
+}
+
+void HttpServer::Connection::checkTimeouts(std::chrono::steady_clock::time_point now) {
+    if (!socket->isOpened()) {
+        return;
+    } else if (webSocket != NULL) {
+        webSocket->checkTimeouts(now);
+    } else if (http2 != NULL) {
+        if (!closing && isIdle() && now - lastActivity >= std::chrono::seconds(server.settings.idleTimeout)) {
+            http2->shutdown();
+        }
+    } else if (request != NULL) {
+        if (request->getState() == HttpMessage::State::BODY) {
+            if (now - bodyStart >= std::chrono::seconds(server.settings.bodyTimeout)) {
+                reject(408, "Request Timeout");
+            }
+        } else if (now - requestStart >= std::chrono::seconds(server.settings.headerTimeout)) {
+            reject(408, "Request Timeout");
+        }
+    } else if (isIdle() && now - lastActivity >= std::chrono::seconds(server.settings.idleTimeout)) {
+        closing = true;
+        socket->close();
+    }
+}
 
-    sockets.insert(socket);
+HttpServer::Connection::PendingResponse* HttpServer::Connection::startCompletion(uint64_t sequence,
+                                                                                std::string& connectionHeaders) {
+    if (!socket->isOpened()) {
+        pending.clear();
+        return NULL;
+    }
+
+    PendingResponse* pendingResponse = getPending(sequence);
+    if (pendingResponse == NULL || pendingResponse->ready) {
+        throw OwnException("The response can't be sent twice");
+    }
+
+    if (pendingResponse->keepAlive) {
+        connectionHeaders = pendingResponse->http10 ? "connection: keep-alive" + CRLF : "";
+        connectionHeaders += server.keepAliveHeader;
+        Http::appendNumber(connectionHeaders, server.settings.maxRequestsPerConnection - sequence - 1);
+        connectionHeaders += CRLF;
+    } else {
+        connectionHeaders = "connection: close" + CRLF;
+        pendingResponse->close = true;
+    }
+    return pendingResponse;
+}
+
+void HttpServer::Connection::complete(uint64_t sequence, HttpResponse& response) {
+    if (http2 != NULL) {
+        http2->complete((uint32_t) sequence, response);
+        return;
+    }
+    std::string connectionHeaders;
+    PendingResponse* pendingResponse = startCompletion(sequence, connectionHeaders);
+    if (pendingResponse == NULL) {
+        return;
+    }
+
+    server.compress(response, pendingResponse->compress, pendingResponse->coding);
+    response.finish();
+
+    pendingResponse->ready = true;
+    if (pendingResponse == &pending.front()) {
+        std::string& output = server.outputBuffer;
+        output.clear();
+        response.serialize(output, connectionHeaders);
+        socket->write(output);
+    } else {
+        response.serialize(pendingResponse->data, connectionHeaders);
+    }
+    flush();
+}
+
+void HttpServer::Connection::complete(uint64_t sequence, const HttpResponse::Prepared& response) {
+    if (http2 != NULL) {
+        http2->complete((uint32_t) sequence, response);
+        return;
+    }
+    std::string connectionHeaders;
+    PendingResponse* pendingResponse = startCompletion(sequence, connectionHeaders);
+    if (pendingResponse == NULL) {
+        return;
+    }
+
+    pendingResponse->ready = true;
+    if (pendingResponse == &pending.front()) {
+        std::string& output = server.outputBuffer;
+        output.clear();
+        response.serializeHead(output, connectionHeaders);
+        iovec parts[2] = {{&output[0], output.size()},
+                          {const_cast<char*>(response.getBody()), response.getBodySize()}};
+        socket->write(parts, 2);
+    } else {
+        response.serializeHead(pendingResponse->data, connectionHeaders);
+        pendingResponse->body = response.getBody();
+        pendingResponse->bodySize = response.getBodySize();
+        pendingResponse->bodyOwner = response.getOwner();
+    }
+    flush();
+}
+
+void HttpServer::Connection::close(uint64_t sequence) {
+    if (http2 != NULL) {
+        http2->close((uint32_t) sequence);
+        return;
+    }
+    PendingResponse* response = getPending(sequence);
+    if (response == NULL || (response->ready && !response->streaming)) {
+        return;
+    }
+
+    // Closing ends a stream, whose body is delimited by the end of the connection
+    if (response->streaming && response->compressor != NULL) {
+        std::string& output = (response == &pending.front()) ? server.outputBuffer : response->data;
+        if (response == &pending.front()) {
+            output.clear();
+        }
+        response->compressor->compress(NULL, 0, output, true);
+        if (response == &pending.front()) {
+            socket->write(output);
+        }
+        response->compressor.reset();
+    }
+    response->ready = true;
+    response->streaming = false;
+    response->close = true;
+    flush();
+}
+
+void HttpServer::Connection::startStream(uint64_t sequence, HttpResponse& response) {
+    if (http2 != NULL) {
+        http2->startStream((uint32_t) sequence, response);
+        return;
+    }
+
+    PendingResponse* pendingResponse = getPending(sequence);
+    if (pendingResponse != NULL) {
+        pendingResponse->keepAlive = false;
+    }
+    std::string connectionHeaders;
+    pendingResponse = startCompletion(sequence, connectionHeaders);
+    if (pendingResponse == NULL) {
+        return;
+    }
+    closing = true;
+    pendingResponse->compressor = server.compressStream(response, pendingResponse->compress, pendingResponse->coding);
+    response.finish();
+
+    pendingResponse->ready = true;
+    pendingResponse->close = false;
+    pendingResponse->streaming = true;
+    if (pendingResponse == &pending.front()) {
+        std::string& output = server.outputBuffer;
+        output.clear();
+        response.serializeHead(output, connectionHeaders);
+        output += response.getBody();
+        socket->write(output);
+    } else {
+        response.serializeHead(pendingResponse->data, connectionHeaders);
+        pendingResponse->data += response.getBody();
+    }
+    flush();
+}
+
+bool HttpServer::Connection::sendStream(uint64_t sequence, const std::string& data) {
+    if (http2 != NULL) {
+        return http2->sendStream((uint32_t) sequence, data);
+    }
+
+    PendingResponse* response = getPending(sequence);
+    if (!socket->isOpened() || response == NULL || !response->streaming) {
+        return false;
+    }
+    if (response == &pending.front()) {
+        std::string& output = server.outputBuffer;
+        output.clear();
+        server.appendStream(response->compressor.get(), data.data(), data.size(), output, false);
+        socket->write(output);
+    } else {
+        server.appendStream(response->compressor.get(), data.data(), data.size(), response->data, false);
+    }
+    lastActivity = std::chrono::steady_clock::now();
+    return true;
+}
+
+size_t HttpServer::Connection::getOutputSize(uint64_t sequence) const {
+    if (http2 != NULL) {
+        return http2->getOutputSize((uint32_t) sequence);
+    }
+
+    uint64_t firstSequence = nextSequence - pending.size();
+    size_t size = socket->getOutputSize();
+    if (sequence >= firstSequence && sequence < nextSequence) {
+        size += pending[sequence - firstSequence].data.size();
+    }
+    return size;
+}
+
+bool HttpServer::Connection::acceptWebSocket(uint64_t sequence, const HttpRequest& request,
+                                             const WebSocket::MessageHandler& handler) {
+    // Only the request being handled may switch protocols, as the data after it is the first frames then
+    std::string accept;
+    int statusCode = WebSocketConnection::checkHandshake(request, accept);
+    if (statusCode == 101 && (http2 != NULL || closing || !processing || pending.size() != 1
+                              || sequence != nextSequence - 1 || pending.front().ready)) {
+        statusCode = 400;
+    }
+    if (statusCode != 101) {
+        HttpResponse response(request.getMethod(), Http::VERSION1_1, statusCode,
+                              (statusCode == 426) ? "Upgrade Required" : "Bad Request");
+        if (statusCode == 426) {
+            response.setHeader("Sec-WebSocket-Version", "13");
+        }
+        complete(sequence, response);
+        return false;
+    }
+
+    pending.clear();
+    socket->write("HTTP/1.1 101 Switching Protocols" + CRLF + "connection: Upgrade" + CRLF + "upgrade: websocket"
+                  + CRLF + "sec-websocket-accept: " + accept + CRLF + CRLF);
+    webSocket.reset(new WebSocketConnection(*this, handler));
+    return true;
+}
+
+HttpServer::WebSocketConnection* HttpServer::Connection::getWebSocket() const {
+    return webSocket.get();
+}
+
+const std::string& HttpServer::Connection::getRemoteHost() const {
+    return socket->getHost();
+}
+
+HttpServer::RequestHandler HttpServer::defaultHandler = [](const HttpRequest& request, ResponseSocket responseSocket) {
+    HttpResponse response(request.getMethod(),
+                          (request.getVersion() == Http::VERSION1_0) ? Http::VERSION1_0 : Http::VERSION1_1,
+                          405, "Method Not Allowed");
+    responseSocket.end(response);
+};
+
+HttpServer::HttpServer(uint16_t port, Poller& poller, const Settings& settings): settings(settings),
+        keepAliveHeader("keep-alive: timeout=" + std::to_string(settings.idleTimeout) + ", max="),
+        listener(TcpAcceptSocket("127.0.0.1", port, [this](TcpServerSocket* socket) {
+    std::shared_ptr<Connection> connection = std::make_shared<Connection>(*this, socket);
+    connections.insert(connection);
+
+    Connection* rawConnection = connection.get();
+    socket->setReceivedDataHandler([rawConnection](std::deque<char>& dataDeque) {
+        rawConnection->processData(dataDeque);
+    });
 }, poller)), poller(poller) {
     try {
         tfd = _m1_system_call(timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK), "Couldn't create a timer fd");
 
         struct itimerspec its = {};
-        its.it_interval.tv_sec = 5;
-        its.it_interval.tv_nsec = 0;
-        its.it_value.tv_sec = 5;
+        its.it_interval.tv_sec = 1;
         its.it_interval.tv_nsec = 0;
+        its.it_value.tv_sec = 1;
+        its.it_value.tv_nsec = 0;
         _m1_system_call(timerfd_settime(tfd, 0, &its, NULL), "Couldn't run the timer fd");
 
+        HttpResponse::updateDate(time(NULL));
         poller.setHandler(tfd, [=](epoll_event event) {
-            for (std::set<TcpServerSocket*>::iterator it = sockets.begin(); it != sockets.end(); ++it) {
-                TcpServerSocket* socket = *it;
-                if (!socket->isOpened()) {
-                    delete socket;
-                    sockets.erase(it++);
+            HttpResponse::updateDate(time(NULL));
+
+            std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+            for (std::set<std::shared_ptr<Connection>>::iterator it = connections.begin(); it != connections.end();) {
+                (*it)->checkTimeouts(now);
+                if (!(*it)->isOpened()) {
+                    connections.erase(it++);
+                } else {
+                    ++it;
                 }
             }
 
@@ -102,9 +610,7 @@ HttpServer::HttpServer(uint16_t port, Poller& poller): listener(TcpAcceptSocket(
 }
 
 HttpServer::~HttpServer() {
-    for (std::set<TcpServerSocket*>::iterator it = sockets.begin(); it != sockets.end(); ++it) {
-        delete *it;
-    }
+    connections.clear();
 
     try {
         poller.removeHandler(tfd);
@@ -114,35 +620,100 @@ HttpServer::~HttpServer() {
     }
 }
 
-void HttpServer::processRequest(TcpServerSocket* socket, const HttpRequest& request) {
-    bool ok = false;
-    for (size_t i = 0; i < matchers.size(); ++i) {
-        if (matchers[i].first.match(request)) {
-            matchers[i].second(request, ResponseSocket(*socket));
-            ok = true;
-            break;
-        }
+const HttpServer::Settings& HttpServer::getSettings() const {
+    return settings;
+}
+
+void HttpServer::processRequest(HttpRequest& request, const ResponseSocket& responseSocket) {
+    RouteParameters parameters;
+    size_t handler = router.find(request.getMethod(), request.getUriPath(), parameters);
+    if (handler != Router::NONE) {
+        request.setRouteParameters(parameters);
+        handlers[handler](request, responseSocket);
+    } else {
+        defaultHandler(request, responseSocket);
     }
+}
 
-    if (!ok) {
-        for (size_t i = 0; i < commonMatchers.size(); ++i) {
-            if (commonMatchers[i].first.match(request)) {
-                commonMatchers[i].second(request, ResponseSocket(*socket));
-                ok = true;
-                break;
-            }
-        }
+void HttpServer::chooseCoding(const HttpRequest& request, bool& compress, Compressor::Coding& coding) const {
+    compress = false;
+    if (settings.compressionLevel == 0) {
+        return;
     }
 
-    if (!ok) {
-        defaultHandler(request, ResponseSocket(*socket));
+    std::string acceptEncoding = request.getHeader("Accept-Encoding");
+    if (acceptEncoding.empty()) {
+        return;
+    }
+    double gzipQuality = Http::encodingQuality(acceptEncoding, "gzip");
+    double deflateQuality = Http::encodingQuality(acceptEncoding, "deflate");
+    if (gzipQuality > 0 || deflateQuality > 0) {
+        compress = true;
+        coding = (gzipQuality >= deflateQuality) ? Compressor::GZIP : Compressor::DEFLATE;
     }
 }
 
-void HttpServer::addRouteMatcher(const RouteMatcher& matcher, const HttpServer::RequestHandler& requestHandler) {
-    if (matcher.getUri() == "*") {
-        commonMatchers.push_back(std::make_pair(matcher, requestHandler));
+bool HttpServer::isCompressible(const HttpResponse& response) const {
+    return settings.compressionLevel != 0 && response.getStatusCode() == 200
+           && Http::isCompressible(response.getContentType()) && response.getHeader("Content-Encoding") == "";
+}
+
+void HttpServer::compress(HttpResponse& response, bool accepted, Compressor::Coding coding) {
+    if (!isCompressible(response)) {
+        return;
+    }
+
+    // Whatever the size: a cache mustn't serve this response to other clients once the resource grows
+    if (response.getHeader("Vary") == "") {
+        response.setHeader("Vary", "Accept-Encoding");
+    }
+    const std::string& body = response.getBody();
+    if (!accepted || body.size() < settings.compressionMinSize || body.size() > settings.compressionMaxSize) {
+        return;
+    }
+
+    compressionBuffer.clear();
+    Compressor& compressor = Compressor::forThread(coding, settings.compressionLevel);
+    compressor.compress(body.data(), body.size(), compressionBuffer, true);
+    if (compressionBuffer.size() <= body.size() * settings.maxCompressionRatio) {
+        response.swapBody(compressionBuffer);
+        response.setHeader("Content-Encoding", Compressor::codingToString(coding));
+    }
+}
+
+std::unique_ptr<Compressor> HttpServer::compressStream(HttpResponse& response, bool accepted,
+                                                       Compressor::Coding coding) {
+    if (!isCompressible(response)) {
+        return NULL;
+    }
+    if (response.getHeader("Vary") == "") {
+        response.setHeader("Vary", "Accept-Encoding");
+    }
+    if (!accepted) {
+        return NULL;
+    }
+
+    // The stream's parts go out as they come, each flushed, so there's no size to check
+    std::unique_ptr<Compressor> compressor(new Compressor(coding, settings.compressionLevel,
+                                                          Compressor::STREAM_WINDOW_BITS,
+                                                          Compressor::STREAM_MEMORY_LEVEL));
+    compressionBuffer.clear();
+    compressor->compress(response.getBody().data(), response.getBodySize(), compressionBuffer, false);
+    response.swapBody(compressionBuffer);
+    response.setHeader("Content-Encoding", Compressor::codingToString(coding));
+    return compressor;
+}
+
+void HttpServer::appendStream(Compressor* compressor, const char* data, size_t size, std::string& output,
+                              bool finish) {
+    if (compressor != NULL) {
+        compressor->compress(data, size, output, finish);
     } else {
-        matchers.push_back(std::make_pair(matcher, requestHandler));
+        output.append(data, size);
     }
 }
+
+void HttpServer::addRouteMatcher(const RouteMatcher& matcher, const HttpServer::RequestHandler& requestHandler) {
+    router.add(matcher.getMethod(), matcher.getUri(), handlers.size());
+    handlers.push_back(requestHandler);
+}
@@ -2,47 +2,241 @@
 #define HTTPWEBCHAT_HTTPSERVER_H
 
 
+#include <chrono>
+#include <memory>
 #include <set>
 #include <vector>
 
 #include <sys/timerfd.h>
 
 #include "../TCPSocket/tcp_accept_socket.h"
+#include "compressor.h"
 #include "http_response.h"
+#include "parameter_binder.h"
 #include "route_matcher.h"
 
 class HttpServer {
+    class Connection;
+    class Http2Connection;
+    class WebSocketConnection;
 public:
+    struct Settings {
+        // How many requests of one connection may wait for their responses at the same time;
+        // the rest of the received data isn't parsed until the oldest responses are sent
+        size_t maxPipelineDepth;
+        // A persistent connection without requests in progress is closed after this many seconds
+        unsigned idleTimeout;
+        // A connection is closed after responding to this many requests
+        size_t maxRequestsPerConnection;
+
+        // Seconds a client may take to send the request line and headers, and then the body,
+        // before it gets 408 and the connection is closed
+        unsigned headerTimeout;
+        unsigned bodyTimeout;
+        // Requests exceeding these get 414, 431 or 413 and the connection is closed
+        size_t maxRequestLineLength;
+        size_t maxHeaderCount;
+        size_t maxHeaderSize;
+        size_t maxBodySize;
+
+        // Dynamic bodies of compressible types between the two sizes are compressed with gzip or deflate
+        // at this level (0 turns compression off) for clients accepting it, unless the result isn't smaller
+        // than maxCompressionRatio of the original
+        int compressionLevel;
+        size_t compressionMinSize;
+        size_t compressionMaxSize;
+        double maxCompressionRatio;
+
+        // Clients may switch to HTTP/2 over cleartext (h2c), with prior knowledge or "Upgrade: h2c",
+        // and open this many streams at a time
+        bool enableHttp2;
+        size_t maxConcurrentStreams;
+
+        // Longer WebSocket messages close the connection with status 1009
+        size_t maxWebSocketMessageSize;
+
+        Settings();
+    };
+
+    // An accepted WebSocket connection; it stays open while anything holds it or until either side closes it
+    class WebSocket {
+        friend class HttpServer;
+
+        std::shared_ptr<Connection> connection;
+
+        WebSocket(const std::shared_ptr<Connection>&);
+    public:
+        // Gets every whole text or binary message
+        typedef std::function<void(WebSocket&, const std::string&)> MessageHandler;
+
+        // Frames a text message once, for sending the same bytes to any number of sockets with sendFrame()
+        static void encodeText(const std::string&, std::string&);
+
+        bool isOpened() const;
+        // False once the connection is closed or closing
+        bool sendText(const std::string&);
+        bool sendFrame(const std::string&);
+        void close(uint16_t = 1000);
+        // What's been sent and not taken by the client yet
+        size_t getOutputSize() const;
+    };
+
     class ResponseSocket {
         friend class HttpServer;
 
-        bool valid;
-        TcpServerSocket& socket;
+        std::shared_ptr<Connection> connection;
+        uint64_t sequence;
 
-        ResponseSocket(TcpServerSocket&);
+        ResponseSocket(const std::shared_ptr<Connection>&, uint64_t);
     public:
+        bool isValid() const;
         void close();
         void end(HttpResponse&);
+        void end(const HttpResponse::Prepared&);
+
+        // Starts a streamed response: the head and the body so far are sent now, and the rest of the body goes
+        // with send() until close(). Over HTTP/1.x the body ends with the connection.
+        void start(HttpResponse&);
+        // False once the stream is gone
+        bool send(const std::string&);
+        // What's been sent and not taken by the client yet
+        size_t getOutputSize() const;
+
+        // The numeric address of the client
+        const std::string& getRemoteHost() const;
+
+        // Answers the WebSocket handshake of the request being handled with 101, after which its messages go to
+        // the handler; requests which aren't handshakes get 400 or 426, and the returned socket is closed then
+        WebSocket acceptWebSocket(const HttpRequest&, const WebSocket::MessageHandler&);
     };
 
     typedef std::function<void(const HttpRequest&, ResponseSocket)> RequestHandler;
 
     static RequestHandler defaultHandler;
 private:
+    class Connection: public std::enable_shared_from_this<Connection> {
+        friend class Http2Connection;
+        friend class WebSocketConnection;
+
+        struct PendingResponse {
+            bool ready;
+            bool close;
+            bool keepAlive;
+            bool http10;
+            bool compress;
+            Compressor::Coding coding;
+            // A started stream, kept at the front until it's closed
+            bool streaming;
+            // Of a compressed stream
+            std::unique_ptr<Compressor> compressor;
+            std::string data;
+            // The body of a prepared response, sent after data
+            const char* body;
+            size_t bodySize;
+            std::shared_ptr<const void> bodyOwner;
+
+            PendingResponse(bool, bool);
+        };
+
+        HttpServer& server;
+        TcpServerSocket* socket;
+        HttpRequest* request;
+        bool processing;
+        bool closing;
+
+        uint64_t nextSequence;
+        std::deque<PendingResponse> pending;
+        std::chrono::steady_clock::time_point lastActivity;
+
+        size_t headerSize;
+        size_t headerCount;
+        std::chrono::steady_clock::time_point requestStart;
+        std::chrono::steady_clock::time_point bodyStart;
+
+        // Set once the connection speaks HTTP/2; sequences are stream ids then
+        std::unique_ptr<Http2Connection> http2;
+        // Set once a handler accepted a WebSocket handshake
+        std::unique_ptr<WebSocketConnection> webSocket;
+
+        PendingResponse* getPending(uint64_t);
+        // Fills the connection headers of the response in
+        PendingResponse* startCompletion(uint64_t, std::string&);
+        void flush();
+        void reject(int, const std::string&);
+        // True while the data so far may still be the start of the HTTP/2 preface
+        bool detectHttp2(std::deque<char>&);
+        bool upgradeToHttp2(HttpRequest&);
+    public:
+        Connection(HttpServer&, TcpServerSocket*);
+        ~Connection();
+
+        bool isOpened() const;
+        bool isIdle() const;
+        void processData(std::deque<char>&);
+        void checkTimeouts(std::chrono::steady_clock::time_point);
+
+        bool isPending(uint64_t) const;
+        void complete(uint64_t, HttpResponse&);
+        void complete(uint64_t, const HttpResponse::Prepared&);
+        void close(uint64_t);
+
+        void startStream(uint64_t, HttpResponse&);
+        bool sendStream(uint64_t, const std::string&);
+        size_t getOutputSize(uint64_t) const;
+
+        bool acceptWebSocket(uint64_t, const HttpRequest&, const WebSocket::MessageHandler&);
+        WebSocketConnection* getWebSocket() const;
+        const std::string& getRemoteHost() const;
+
+        Connection(const Connection&) = delete;
+        Connection& operator=(const Connection&) = delete;
+    };
+
     int tfd;
-    std::set<TcpServerSocket*> sockets;
-    std::vector<std::pair<RouteMatcher, RequestHandler>> matchers;
-    std::vector<std::pair<RouteMatcher, RequestHandler>> commonMatchers;
+    Settings settings;
+    std::string keepAliveHeader;
+    std::string outputBuffer;
+    std::string compressionBuffer;
+    std::set<std::shared_ptr<Connection>> connections;
+    std::vector<RequestHandler> handlers;
+    Router router;
 
     TcpAcceptSocket listener;
     Poller& poller;
 
-    void processRequest(TcpServerSocket*, const HttpRequest&);
+    void processRequest(HttpRequest&, const ResponseSocket&);
+    void chooseCoding(const HttpRequest&, bool&, Compressor::Coding&) const;
+    bool isCompressible(const HttpResponse&) const;
+    void compress(HttpResponse&, bool, Compressor::Coding);
+    // Compresses the start of a streamed response, returning the compressor for the rest of it, or NULL when
+    // it's sent as it is
+    std::unique_ptr<Compressor> compressStream(HttpResponse&, bool, Compressor::Coding);
+    // Appends the next part of a stream, compressed if there's a compressor; the last part finishes it
+    void appendStream(Compressor*, const char*, size_t, std::string&, bool);
 public:
-    HttpServer(uint16_t, Poller&);
+    HttpServer(uint16_t, Poller&, const Settings& = Settings());
     ~HttpServer();
 
+    const Settings& getSettings() const;
     void addRouteMatcher(const RouteMatcher&, const RequestHandler&);
+
+    // Adds a route whose handler gets its route and query parameters bound into a Parameters struct
+    // (see Http::ParameterBinder); requests with missing or malformed parameters get 400
+    template <typename Parameters, typename Handler>
+    void addRoute(const RouteMatcher& matcher, Handler handler) {
+        addRouteMatcher(matcher, [handler](const HttpRequest& request, ResponseSocket responseSocket) {
+            Parameters parameters;
+            const char* failed = Http::ParameterBinder<Parameters>::bind(request, parameters);
+            if (failed != NULL) {
+                HttpResponse response(request.getMethod(), Http::VERSION1_1, 400, "Bad Request");
+                response.setContentType(Http::TEXT_PLAIN);
+                response.appendBody("Missing or invalid parameter \"" + std::string(failed) + "\"");
+                responseSocket.end(response);
+                return;
+            }
+            handler(request, parameters, responseSocket);
+        });
+    }
 };
 
 
@@ -0,0 +1,18 @@
+#include "parameter_binder.h"
+
+bool Http::parseValue(std::string_view value, std::string& result) {
+    result.assign(value.data(), value.size());
+    return uriDecodeInPlace(result);
+}
+
+bool Http::parseValue(std::string_view value, bool& result) {
+    if (value == "true" || value == "1") {
+        result = true;
+        return true;
+    } else if (value == "false" || value == "0") {
+        result = false;
+        return true;
+    } else {
+        return false;
+    }
+}
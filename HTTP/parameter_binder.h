@@ -0,0 +1,120 @@
+#ifndef HTTPWEBCHAT_PARAMETERBINDER_H
+#define HTTPWEBCHAT_PARAMETERBINDER_H
+
+
+#include <charconv>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+#include "http_request.h"
+
+// Binding of route captures and query parameters straight into a struct. The struct lists its fields with
+//
+//     static constexpr auto parameters() {
+//         return std::make_tuple(Http::parameter("name", &Struct::field, required), ...);
+//     }
+//
+// and gets its defaults from its own member initializers; unknown parameters are ignored.
+namespace Http {
+    template <typename Struct, typename T>
+    struct Parameter {
+        const char* name;
+        T Struct::* member;
+        bool required;
+    };
+
+    template <typename Struct, typename T>
+    constexpr Parameter<Struct, T> parameter(const char* name, T Struct::* member, bool required = false) {
+        return Parameter<Struct, T>{name, member, required};
+    }
+
+    bool parseValue(std::string_view, std::string&);
+    bool parseValue(std::string_view, bool&);
+
+    template <typename T>
+    typename std::enable_if<std::is_integral<T>::value && !std::is_same<T, bool>::value, bool>::type
+    parseValue(std::string_view value, T& result) {
+        std::from_chars_result parsed = std::from_chars(value.data(), value.data() + value.size(), result);
+        return !value.empty() && parsed.ec == std::errc() && parsed.ptr == value.data() + value.size();
+    }
+
+    template <typename Struct>
+    class ParameterBinder {
+        typedef decltype(Struct::parameters()) Parameters;
+        static constexpr size_t COUNT = std::tuple_size<Parameters>::value;
+        static_assert(COUNT <= 64, "Too many parameters to bind");
+
+        // Parses the value into the field with the given name; returns false only for a malformed value
+        template <size_t I = 0>
+        static bool assign(const Parameters& parameters, std::string_view name, std::string_view value,
+                           Struct& result, uint64_t& seen, const char*& failed) {
+            if constexpr (I == COUNT) {
+                return true;
+            } else {
+                const auto& parameter = std::get<I>(parameters);
+                if (name != parameter.name) {
+                    return assign<I + 1>(parameters, name, value, result, seen, failed);
+                }
+                seen |= (uint64_t) 1 << I;
+                if (!parseValue(value, result.*(parameter.member))) {
+                    failed = parameter.name;
+                    return false;
+                }
+                return true;
+            }
+        }
+
+        template <size_t I = 0>
+        static const char* findMissing(const Parameters& parameters, uint64_t seen) {
+            if constexpr (I == COUNT) {
+                return NULL;
+            } else {
+                if (std::get<I>(parameters).required && !(seen & ((uint64_t) 1 << I))) {
+                    return std::get<I>(parameters).name;
+                }
+                return findMissing<I + 1>(parameters, seen);
+            }
+        }
+    public:
+        // Returns NULL on success or the name of the missing or malformed parameter
+        static const char* bind(const HttpRequest& request, Struct& result) {
+            static constexpr Parameters parameters = Struct::parameters();
+            uint64_t seen = 0;
+            const char* failed = NULL;
+
+            const RouteParameters& routeParameters = request.getRouteParameters();
+            for (size_t i = 0; i < routeParameters.size(); ++i) {
+                if (!assign(parameters, routeParameters.getName(i), routeParameters.getValue(i),
+                            result, seen, failed)) {
+                    return failed;
+                }
+            }
+
+            std::string_view uri = request.getUriView();
+            size_t question = uri.find('?');
+            if (question != std::string_view::npos) {
+                std::string_view query = uri.substr(question + 1);
+                query = query.substr(0, query.find('#'));
+                while (!query.empty()) {
+                    size_t ampersand = query.find('&');
+                    std::string_view pair = query.substr(0, ampersand);
+                    query = (ampersand == std::string_view::npos) ? std::string_view() : query.substr(ampersand + 1);
+
+                    size_t equal = pair.find('=');
+                    std::string_view name = pair.substr(0, equal);
+                    std::string_view value = (equal == std::string_view::npos)
+                                             ? std::string_view() : pair.substr(equal + 1);
+                    if (!assign(parameters, name, value, result, seen, failed)) {
+                        return failed;
+                    }
+                }
+            }
+
+            return findMissing(parameters, seen);
+        }
+    };
+}
+
+
+#endif //HTTPWEBCHAT_PARAMETERBINDER_H
@@ -15,8 +15,6 @@ public:
     Http::Method getMethod() const;
     std::string getMethodAsString() const;
     std::string getUri() const;
-
-    bool match(const HttpRequest&) const;
 };
 
 
@@ -0,0 +1,169 @@
+#include "router.h"
+
+RouteParameters::RouteParameters(): count(0) {}
+
+size_t RouteParameters::size() const {
+    return count;
+}
+
+std::string_view RouteParameters::getName(size_t index) const {
+    return names[index];
+}
+
+std::string_view RouteParameters::getValue(size_t index) const {
+    return values[index];
+}
+
+std::string_view RouteParameters::get(std::string_view name) const {
+    for (size_t i = 0; i < count; ++i) {
+        if (names[i] == name) {
+            return values[i];
+        }
+    }
+    return std::string_view();
+}
+
+bool RouteParameters::has(std::string_view name) const {
+    for (size_t i = 0; i < count; ++i) {
+        if (names[i] == name) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool RouteParameters::add(std::string_view name, std::string_view value) {
+    if (count == MAX_PARAMETERS) {
+        return false;
+    }
+    names[count] = name;
+    values[count] = value;
+    ++count;
+    return true;
+}
+
+void RouteParameters::truncate(size_t size) {
+    if (size < count) {
+        count = size;
+    }
+}
+
+const size_t Router::NONE = (size_t) -1;
+
+Router::Node::Node(): wildcardValue(NONE), value(NONE) {}
+
+bool Router::nextSegment(std::string_view& path, std::string_view& segment) {
+    size_t begin = path.find_first_not_of('/');
+    if (begin == std::string_view::npos) {
+        return false;
+    }
+
+    size_t end = path.find('/', begin);
+    if (end == std::string_view::npos) {
+        end = path.size();
+    }
+    segment = path.substr(begin, end - begin);
+    path.remove_prefix(end);
+    return true;
+}
+
+void Router::add(Http::Method method, const std::string& pattern, size_t value) {
+    Node* node = &roots[method];
+    if (pattern == "*") {
+        if (node->wildcardValue != NONE) {
+            throw OwnException("Route \"" + pattern + "\" is already registered");
+        }
+        node->wildcardValue = value;
+        return;
+    }
+
+    std::string_view rest = pattern;
+    std::string_view segment;
+    while (nextSegment(rest, segment)) {
+        if (segment[0] == '*') {
+            if (rest.find_first_not_of('/') != std::string_view::npos) {
+                throw OwnException("A wildcard should be the last segment of route \"" + pattern + "\"");
+            } else if (node->wildcardValue != NONE) {
+                throw OwnException("Route \"" + pattern + "\" is already registered");
+            }
+            node->wildcardName = std::string(segment.substr(1));
+            node->wildcardValue = value;
+            return;
+        } else if (segment[0] == ':') {
+            std::string name(segment.substr(1));
+            if (!node->parameterChild) {
+                node->parameterChild.reset(new Node());
+                node->parameterName = name;
+            } else if (node->parameterName != name) {
+                throw OwnException("Route \"" + pattern + "\" names parameter \"" + name + "\" differently from "
+                                   + "another route (\"" + node->parameterName + "\")");
+            }
+            node = node->parameterChild.get();
+        } else {
+            std::vector<std::pair<std::string, std::unique_ptr<Node>>>::iterator it =
+                    std::lower_bound(node->children.begin(), node->children.end(), segment,
+                                     [](const std::pair<std::string, std::unique_ptr<Node>>& child,
+                                        std::string_view segment) {
+                                         return child.first < segment;
+                                     });
+            if (it == node->children.end() || it->first != segment) {
+                it = node->children.insert(it, std::make_pair(std::string(segment), std::unique_ptr<Node>(new Node())));
+            }
+            node = it->second.get();
+        }
+    }
+
+    if (node->value != NONE) {
+        throw OwnException("Route \"" + pattern + "\" is already registered");
+    }
+    node->value = value;
+}
+
+size_t Router::match(const Node& node, std::string_view path, RouteParameters& parameters) {
+    std::string_view rest = path;
+    std::string_view segment;
+    if (!nextSegment(rest, segment)) {
+        if (node.value != NONE) {
+            return node.value;
+        } else if (node.wildcardValue != NONE && parameters.add(node.wildcardName, std::string_view())) {
+            return node.wildcardValue;
+        } else {
+            return NONE;
+        }
+    }
+
+    std::vector<std::pair<std::string, std::unique_ptr<Node>>>::const_iterator it =
+            std::lower_bound(node.children.begin(), node.children.end(), segment,
+                             [](const std::pair<std::string, std::unique_ptr<Node>>& child,
+                                std::string_view segment) {
+                                 return child.first < segment;
+                             });
+    if (it != node.children.end() && it->first == segment) {
+        size_t result = match(*it->second, rest, parameters);
+        if (result != NONE) {
+            return result;
+        }
+    }
+
+    if (node.parameterChild) {
+        size_t mark = parameters.size();
+        if (parameters.add(node.parameterName, segment)) {
+            size_t result = match(*node.parameterChild, rest, parameters);
+            if (result != NONE) {
+                return result;
+            }
+            parameters.truncate(mark);
+        }
+    }
+
+    if (node.wildcardValue != NONE
+        && parameters.add(node.wildcardName, path.substr(path.find_first_not_of('/')))) {
+        return node.wildcardValue;
+    }
+    return NONE;
+}
+
+size_t Router::find(Http::Method method, std::string_view path, RouteParameters& parameters) const {
+    parameters.truncate(0);
+    return match(roots[method], path, parameters);
+}
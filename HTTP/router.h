@@ -0,0 +1,59 @@
+#ifndef HTTPWEBCHAT_ROUTER_H
+#define HTTPWEBCHAT_ROUTER_H
+
+
+#include <memory>
+#include <string_view>
+#include <vector>
+
+#include "http_common.h"
+
+class RouteParameters {
+public:
+    static const size_t MAX_PARAMETERS = 8;
+private:
+    size_t count;
+    std::string_view names[MAX_PARAMETERS];
+    std::string_view values[MAX_PARAMETERS];
+public:
+    RouteParameters();
+
+    size_t size() const;
+    std::string_view getName(size_t) const;
+    std::string_view getValue(size_t) const;
+    std::string_view get(std::string_view) const;
+    bool has(std::string_view) const;
+
+    bool add(std::string_view, std::string_view);
+    void truncate(size_t);
+};
+
+// Per-method tree of route patterns split on '/'. A pattern segment is either static text, ":name" capturing
+// one segment or "*name" (only the last one) capturing the rest of the path; "*" alone catches every path.
+// Static segments are preferred over captures, and matching works on views into the request URI.
+class Router {
+public:
+    static const size_t NONE;
+private:
+    struct Node {
+        std::vector<std::pair<std::string, std::unique_ptr<Node>>> children;
+        std::unique_ptr<Node> parameterChild;
+        std::string parameterName;
+        std::string wildcardName;
+        size_t wildcardValue;
+        size_t value;
+
+        Node();
+    };
+
+    Node roots[Http::METHOD_COUNT];
+
+    static bool nextSegment(std::string_view&, std::string_view&);
+    static size_t match(const Node&, std::string_view, RouteParameters&);
+public:
+    void add(Http::Method, const std::string&, size_t);
+    size_t find(Http::Method, std::string_view, RouteParameters&) const;
+};
+
+
+#endif //HTTPWEBCHAT_ROUTER_H
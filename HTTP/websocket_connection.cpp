@@ -0,0 +1,384 @@
+#include "websocket_connection.h"
+
+namespace {
+    const std::string HANDSHAKE_GUID = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+    // Control frames can't be longer, nor fragmented
+    const size_t MAX_CONTROL_PAYLOAD = 125;
+
+    const uint8_t FLAG_FIN = 0x80;
+    const uint8_t FLAG_MASK = 0x80;
+    const uint8_t RESERVED_BITS = 0x70;
+
+    uint32_t rotateLeft(uint32_t value, int bits) {
+        return (value << bits) | (value >> (32 - bits));
+    }
+
+    // Only the handshake needs it, so it's the plain FIPS 180-4 algorithm
+    void sha1(const std::string& input, unsigned char (&digest)[20]) {
+        uint32_t h[5] = {0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0};
+
+        std::string data = input;
+        data += (char) 0x80;
+        while (data.size() % 64 != 56) {
+            data += (char) 0;
+        }
+        uint64_t bitLength = (uint64_t) input.size() * 8;
+        for (int i = 7; i >= 0; --i) {
+            data += (char) (bitLength >> (i * 8));
+        }
+
+        for (size_t chunk = 0; chunk < data.size(); chunk += 64) {
+            uint32_t w[80];
+            for (int i = 0; i < 16; ++i) {
+                const unsigned char* word = (const unsigned char*) &data[chunk + i * 4];
+                w[i] = ((uint32_t) word[0] << 24) | ((uint32_t) word[1] << 16) | ((uint32_t) word[2] << 8) | word[3];
+            }
+            for (int i = 16; i < 80; ++i) {
+                w[i] = rotateLeft(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+            }
+
+            uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
+            for (int i = 0; i < 80; ++i) {
+                uint32_t f, k;
+                if (i < 20) {
+                    f = (b & c) | (~b & d);
+                    k = 0x5A827999;
+                } else if (i < 40) {
+                    f = b ^ c ^ d;
+                    k = 0x6ED9EBA1;
+                } else if (i < 60) {
+                    f = (b & c) | (b & d) | (c & d);
+                    k = 0x8F1BBCDC;
+                } else {
+                    f = b ^ c ^ d;
+                    k = 0xCA62C1D6;
+                }
+                uint32_t temp = rotateLeft(a, 5) + f + e + k + w[i];
+                e = d;
+                d = c;
+                c = rotateLeft(b, 30);
+                b = a;
+                a = temp;
+            }
+            h[0] += a;
+            h[1] += b;
+            h[2] += c;
+            h[3] += d;
+            h[4] += e;
+        }
+
+        for (int i = 0; i < 20; ++i) {
+            digest[i] = (unsigned char) (h[i / 4] >> (24 - (i % 4) * 8));
+        }
+    }
+
+    std::string base64Encode(const unsigned char* data, size_t size) {
+        static const char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+        std::string output;
+        for (size_t i = 0; i < size; i += 3) {
+            uint32_t group = (uint32_t) data[i] << 16;
+            if (i + 1 < size) {
+                group |= (uint32_t) data[i + 1] << 8;
+            }
+            if (i + 2 < size) {
+                group |= data[i + 2];
+            }
+            output += alphabet[(group >> 18) & 0x3F];
+            output += alphabet[(group >> 12) & 0x3F];
+            output += (i + 1 < size) ? alphabet[(group >> 6) & 0x3F] : '=';
+            output += (i + 2 < size) ? alphabet[group & 0x3F] : '=';
+        }
+        return output;
+    }
+
+    // Text messages have to be valid UTF-8 (RFC 3629): no overlong forms, surrogates or code points past U+10FFFF
+    bool isValidUtf8(const std::string& text) {
+        const unsigned char* next = (const unsigned char*) text.data();
+        const unsigned char* end = next + text.size();
+        while (next < end) {
+            unsigned char c = *next++;
+            if (c < 0x80) {
+                continue;
+            }
+
+            int length;
+            uint32_t codePoint;
+            if ((c & 0xE0) == 0xC0) {
+                length = 1;
+                codePoint = c & 0x1F;
+            } else if ((c & 0xF0) == 0xE0) {
+                length = 2;
+                codePoint = c & 0x0F;
+            } else if ((c & 0xF8) == 0xF0) {
+                length = 3;
+                codePoint = c & 0x07;
+            } else {
+                return false;
+            }
+            if (end - next < length) {
+                return false;
+            }
+            for (int i = 0; i < length; ++i) {
+                if ((next[i] & 0xC0) != 0x80) {
+                    return false;
+                }
+                codePoint = (codePoint << 6) | (next[i] & 0x3F);
+            }
+            next += length;
+
+            static const uint32_t minimum[] = {0, 0x80, 0x800, 0x10000};
+            if (codePoint < minimum[length] || codePoint > 0x10FFFF
+                || (codePoint >= 0xD800 && codePoint <= 0xDFFF)) {
+                return false;
+            }
+        }
+        return true;
+    }
+}
+
+HttpServer::WebSocketConnection::WebSocketConnection(Connection& connection,
+                                                     const WebSocket::MessageHandler& handler):
+        connection(connection), server(connection.server), socket(connection.socket), handler(handler),
+        closeSent(false), pingSent(false), fragmented(false), messageOpcode(TEXT) {}
+
+int HttpServer::WebSocketConnection::checkHandshake(const HttpRequest& request, std::string& accept) {
+    if (request.getMethod() != Http::Method::GET || request.getVersion() != Http::VERSION1_1
+        || !Http::hasToken(request.getHeader("Upgrade"), "websocket")
+        || !Http::hasToken(request.getHeader("Connection"), "upgrade")) {
+        return 400;
+    } else if (request.getHeader("Sec-WebSocket-Version") != "13") {
+        return 426;
+    }
+
+    // The key is 16 random bytes in base64
+    std::string key = request.getHeader("Sec-WebSocket-Key");
+    if (key.size() != 24 || key.compare(22, 2, "==") != 0) {
+        return 400;
+    }
+    unsigned char digest[20];
+    sha1(key + HANDSHAKE_GUID, digest);
+    accept = base64Encode(digest, sizeof digest);
+    return 101;
+}
+
+void HttpServer::WebSocketConnection::encodeFrame(Opcode opcode, const char* data, size_t size,
+                                                  std::string& output) {
+    output += (char) (FLAG_FIN | opcode);
+    if (size < 126) {
+        output += (char) size;
+    } else if (size <= 0xFFFF) {
+        output += (char) 126;
+        output += (char) (size >> 8);
+        output += (char) size;
+    } else {
+        output += (char) 127;
+        for (int i = 7; i >= 0; --i) {
+            output += (char) ((uint64_t) size >> (i * 8));
+        }
+    }
+    output.append(data, size);
+}
+
+bool HttpServer::WebSocketConnection::isOpened() const {
+    return socket->isOpened() && !closeSent;
+}
+
+void HttpServer::WebSocketConnection::writeFrame(Opcode opcode, const char* data, size_t size) {
+    // The payload goes along with the header without being copied
+    char header[10];
+    size_t headerSize = 2;
+    header[0] = (char) (FLAG_FIN | opcode);
+    if (size < 126) {
+        header[1] = (char) size;
+    } else if (size <= 0xFFFF) {
+        header[1] = (char) 126;
+        header[2] = (char) (size >> 8);
+        header[3] = (char) size;
+        headerSize = 4;
+    } else {
+        header[1] = (char) 127;
+        for (int i = 0; i < 8; ++i) {
+            header[2 + i] = (char) ((uint64_t) size >> ((7 - i) * 8));
+        }
+        headerSize = 10;
+    }
+    iovec parts[2] = {{header, headerSize}, {const_cast<char*>(data), size}};
+    socket->write(parts, 2);
+}
+
+void HttpServer::WebSocketConnection::fail(CloseCode code, const std::string& reason) {
+    std::cerr << "WebSocket connection error: " << reason << std::endl;
+    close(code);
+}
+
+void HttpServer::WebSocketConnection::processData(std::deque<char>& dataDeque) {
+    pingSent = false;
+    try {
+        while (socket->isOpened() && processFrame(dataDeque)) {}
+    } catch (const std::exception& exception) {
+        std::cerr << "Exception while processing a WebSocket message: " << exception.what() << std::endl;
+        close(INTERNAL_ERROR);
+    }
+    // Nothing after our close frame matters anymore
+    if (closeSent) {
+        dataDeque.clear();
+    }
+}
+
+bool HttpServer::WebSocketConnection::processFrame(std::deque<char>& dataDeque) {
+    if (dataDeque.size() < 2) {
+        return false;
+    }
+    uint8_t first = (uint8_t) dataDeque[0];
+    uint8_t second = (uint8_t) dataDeque[1];
+    Opcode opcode = (Opcode) (first & 0x0F);
+    bool fin = (first & FLAG_FIN) != 0;
+    bool control = (opcode & 0x08) != 0;
+
+    if ((first & RESERVED_BITS) != 0) {
+        fail(PROTOCOL_ERROR, "Reserved bits are set without an extension");
+        return false;
+    } else if ((second & FLAG_MASK) == 0) {
+        fail(PROTOCOL_ERROR, "An unmasked client frame");
+        return false;
+    } else if (control && (!fin || (second & 0x7F) > MAX_CONTROL_PAYLOAD)) {
+        fail(PROTOCOL_ERROR, "A fragmented or long control frame");
+        return false;
+    }
+
+    size_t headerSize = 2;
+    uint64_t size = second & 0x7F;
+    if (size == 126 || size == 127) {
+        size_t lengthSize = (size == 126) ? 2 : 8;
+        if (dataDeque.size() < 2 + lengthSize) {
+            return false;
+        }
+        size = 0;
+        for (size_t i = 0; i < lengthSize; ++i) {
+            size = (size << 8) | (uint8_t) dataDeque[2 + i];
+        }
+        headerSize += lengthSize;
+    }
+    // Whatever is buffered counts against the limit before the payload arrives
+    uint64_t limit = server.settings.maxWebSocketMessageSize;
+    if (!control && (size > limit || (fragmented && message.size() + size > limit))) {
+        fail(MESSAGE_TOO_BIG, "A too long message");
+        return false;
+    }
+
+    headerSize += 4;
+    if (dataDeque.size() < headerSize + size) {
+        return false;
+    }
+    char mask[4];
+    std::copy(dataDeque.begin() + headerSize - 4, dataDeque.begin() + headerSize, mask);
+    std::deque<char>::iterator payloadStart = dataDeque.begin() + headerSize;
+    payload.assign(payloadStart, payloadStart + size);
+    dataDeque.erase(dataDeque.begin(), payloadStart + size);
+    for (size_t i = 0; i < payload.size(); ++i) {
+        payload[i] ^= mask[i & 3];
+    }
+
+    if (control) {
+        processControlFrame(opcode);
+    } else if (opcode == CONTINUATION) {
+        if (!fragmented) {
+            fail(PROTOCOL_ERROR, "A continuation frame without a message");
+            return false;
+        }
+        message += payload;
+        if (fin) {
+            fragmented = false;
+            deliver(messageOpcode, message);
+            message.clear();
+        }
+    } else if (opcode == TEXT || opcode == BINARY) {
+        if (fragmented) {
+            fail(PROTOCOL_ERROR, "A new message before the previous one ended");
+            return false;
+        } else if (fin) {
+            deliver(opcode, payload);
+        } else {
+            fragmented = true;
+            messageOpcode = opcode;
+            message.swap(payload);
+        }
+    } else {
+        fail(PROTOCOL_ERROR, "An unknown opcode " + std::to_string(opcode));
+        return false;
+    }
+    return true;
+}
+
+void HttpServer::WebSocketConnection::processControlFrame(Opcode opcode) {
+    if (opcode == PING) {
+        if (!closeSent) {
+            writeFrame(PONG, payload.data(), payload.size());
+        }
+    } else if (opcode == CLOSE) {
+        if (payload.size() == 1) {
+            fail(PROTOCOL_ERROR, "A close frame with a truncated status code");
+            return;
+        }
+        // The closing handshake is done once both sides sent their close frames; the status code is echoed
+        uint16_t code = (payload.size() >= 2)
+                        ? (uint16_t) (((uint8_t) payload[0] << 8) | (uint8_t) payload[1]) : NORMAL_CLOSURE;
+        if (!closeSent) {
+            close(code);
+        } else {
+            socket->close();
+        }
+    } else if (opcode != PONG) {
+        fail(PROTOCOL_ERROR, "An unknown control opcode " + std::to_string(opcode));
+    }
+}
+
+void HttpServer::WebSocketConnection::deliver(Opcode opcode, const std::string& data) {
+    if (closeSent) {
+        return;
+    } else if (opcode == TEXT && !isValidUtf8(data)) {
+        fail(INVALID_DATA, "A text message isn't valid UTF-8");
+        return;
+    }
+    WebSocket webSocket(connection.shared_from_this());
+    handler(webSocket, data);
+}
+
+void HttpServer::WebSocketConnection::checkTimeouts(std::chrono::steady_clock::time_point now) {
+    std::chrono::seconds idleTimeout(server.settings.idleTimeout);
+    if (now - connection.lastActivity >= idleTimeout * 2) {
+        socket->close();
+    } else if (now - connection.lastActivity >= idleTimeout && !pingSent && !closeSent) {
+        pingSent = true;
+        writeFrame(PING, NULL, 0);
+    }
+}
+
+bool HttpServer::WebSocketConnection::send(Opcode opcode, const std::string& data) {
+    if (!isOpened()) {
+        return false;
+    }
+    writeFrame(opcode, data.data(), data.size());
+    return socket->isOpened();
+}
+
+bool HttpServer::WebSocketConnection::sendFrame(const std::string& frame) {
+    if (!isOpened()) {
+        return false;
+    }
+    socket->write(frame);
+    return socket->isOpened();
+}
+
+void HttpServer::WebSocketConnection::close(uint16_t code) {
+    if (!isOpened()) {
+        return;
+    }
+
+    // 1005 and the like only describe a close frame without a status code, so they aren't sent
+    char status[2] = {(char) (code >> 8), (char) code};
+    bool withCode = code != NO_STATUS && code != 1006 && code != 1015;
+    writeFrame(CLOSE, status, withCode ? 2 : 0);
+    closeSent = true;
+    socket->closeAfterWrite();
+}
@@ -0,0 +1,56 @@
+#ifndef HTTPWEBCHAT_WEBSOCKETCONNECTION_H
+#define HTTPWEBCHAT_WEBSOCKETCONNECTION_H
+
+
+#include "http_server.h"
+
+// The WebSocket side of a connection (RFC 6455), which a Connection hands its data to once a handler accepted
+// the handshake. Whole messages go to the handler, pings are answered, and a silent peer is pinged after
+// idleTimeout seconds and dropped when it stays silent as long again. Protocol errors close the connection
+// with the matching status code.
+class HttpServer::WebSocketConnection {
+public:
+    enum Opcode {CONTINUATION, TEXT, BINARY, CLOSE = 8, PING, PONG};
+    enum CloseCode {NORMAL_CLOSURE = 1000, GOING_AWAY, PROTOCOL_ERROR, UNSUPPORTED_DATA, NO_STATUS = 1005,
+                    INVALID_DATA = 1007, POLICY_VIOLATION, MESSAGE_TOO_BIG, INTERNAL_ERROR = 1011};
+private:
+    Connection& connection;
+    HttpServer& server;
+    TcpServerSocket* socket;
+    WebSocket::MessageHandler handler;
+
+    // Our close frame is sent, so nothing else may follow it
+    bool closeSent;
+    bool pingSent;
+    // A message split into fragments
+    bool fragmented;
+    Opcode messageOpcode;
+    std::string message;
+    std::string payload;
+
+    void writeFrame(Opcode, const char*, size_t);
+    void fail(CloseCode, const std::string&);
+    bool processFrame(std::deque<char>&);
+    void processControlFrame(Opcode);
+    void deliver(Opcode, const std::string&);
+public:
+    // Checks the handshake of the request and makes the Sec-WebSocket-Accept value for it;
+    // the status code to reject it with otherwise
+    static int checkHandshake(const HttpRequest&, std::string&);
+    // Server frames are never masked, so the same frame may go to any number of clients
+    static void encodeFrame(Opcode, const char*, size_t, std::string&);
+
+    WebSocketConnection(Connection&, const WebSocket::MessageHandler&);
+
+    bool isOpened() const;
+    void processData(std::deque<char>&);
+    void checkTimeouts(std::chrono::steady_clock::time_point);
+
+    bool send(Opcode, const std::string&);
+    // Sends bytes made by encodeFrame as they are
+    bool sendFrame(const std::string&);
+    void close(uint16_t);
+};
+
+
+#endif //HTTPWEBCHAT_WEBSOCKETCONNECTION_H
@@ -1,5 +1,9 @@
-var timer;
 var username = null;
+var socket = null;
+// The id of the last message shown, which polls continue after
+var lastId = -1;
+// Seconds the server may hold a poll back until there's something new
+var POLL_WAIT = 25;
 
 function format2Dig(value) {
     return ('0' + value).slice(-2);
@@ -23,7 +27,8 @@ function appendMessage(list, message) {
     }
 }
 
-function login(content) {
+// The server answers with a session cookie, which names the user in every later request
+function openSession(content, success) {
     $.ajax({
         url: '/login',
         method: 'POST',
@@ -31,65 +36,136 @@ function login(content) {
             username: content
         }),
         contentType: 'application/json; charset=UTF-8',
-        success: function () {
-            username = content;
-
-            var messageField = $('#message');
-            $('#username').attr('disabled', true);
-            $('#usernameEnter').attr('disabled', true);
-            messageField.attr('disabled', false);
-            $('#messageEnter').attr('disabled', false);
-            messageField.focus();
-            $('#indicator').attr('src', 'green_light.png');
-
-            loadMessages(true)();
+        success: success
+    });
+}
+
+function login(content) {
+    openSession(content, function () {
+        username = content;
+
+        var messageField = $('#message');
+        $('#username').attr('disabled', true);
+        $('#usernameEnter').attr('disabled', true);
+        messageField.attr('disabled', false);
+        $('#messageEnter').attr('disabled', false);
+        messageField.focus();
+        $('#indicator').attr('src', 'green_light.png');
+
+        if (window.WebSocket) {
+            connect();
+        } else {
+            subscribe();
         }
     });
 }
 
-function loadMessages(all) {
-    return function () {
-        $.ajax({
-            url: '/messages',
-            method: 'GET',
-            data: {
-                username: username,
-                all: all
-            },
-            dataType: 'json',
-            success: function (data) {
-                var messageList = $('#messages');
-                for (var i = 0; i < data.messages.length; i++) {
-                    appendMessage(messageList, data.messages[i]);
-                }
-
-                if (data.messages.length > 0) {
-                    var messageBlock = $('#message-block');
-                    var clientHeight = messageBlock.height();
-                    var scrollHeight = messageBlock.get(0).scrollHeight;
-                    if (clientHeight < scrollHeight) {
-                        messageBlock.scrollTop(scrollHeight);
-                    }
-                }
-
-                timer = setTimeout(loadMessages(false), 1000);
-            }
-        });
+function showMessages(messages) {
+    var messageList = $('#messages');
+    for (var i = 0; i < messages.length; i++) {
+        appendMessage(messageList, messages[i]);
+        lastId = messages[i].id;
+    }
+
+    if (messages.length > 0) {
+        var messageBlock = $('#message-block');
+        var clientHeight = messageBlock.height();
+        var scrollHeight = messageBlock.get(0).scrollHeight;
+        if (clientHeight < scrollHeight) {
+            messageBlock.scrollTop(scrollHeight);
+        }
+    }
+}
+
+// Messages go both ways over one connection; every (re)connection gets the whole history again
+function connect() {
+    var protocol = (location.protocol == 'https:') ? 'wss://' : 'ws://';
+    var webSocket = new WebSocket(protocol + location.host + '/socket');
+    var opened = false;
+    webSocket.onopen = function () {
+        opened = true;
+        socket = webSocket;
+        $('#messages').empty();
+        lastId = -1;
+    };
+    webSocket.onmessage = function (event) {
+        showMessages([JSON.parse(event.data)]);
+    };
+    webSocket.onclose = function () {
+        socket = null;
+        if (opened) {
+            setTimeout(connect, 1000);
+        } else {
+            subscribe();
+        }
+    };
+}
+
+// One stream delivers every message; the browser reconnects it by itself, resuming after the last one
+function subscribe() {
+    if (!window.EventSource) {
+        loadMessages();
+        return;
     }
+
+    var source = new EventSource('/events');
+    source.onmessage = function (event) {
+        showMessages([JSON.parse(event.data)]);
+    };
+    source.onerror = function () {
+        if (source.readyState == EventSource.CLOSED) {
+            loadMessages();
+        }
+    };
+}
+
+function loadMessages() {
+    $.ajax({
+        url: '/messages',
+        method: 'GET',
+        data: {
+            after: lastId,
+            wait: POLL_WAIT
+        },
+        dataType: 'json',
+        success: function (data) {
+            showMessages(data.messages);
+            loadMessages();
+        },
+        error: function (xhr) {
+            // The session was dropped after a long idle time, or the server restarted
+            if (xhr.status == 401) {
+                openSession(username, loadMessages);
+            } else {
+                // Polling too often gets 429, which tells how long to back off
+                var retryAfter = parseInt(xhr.getResponseHeader('Retry-After'), 10) || 1;
+                setTimeout(loadMessages, retryAfter * 1000);
+            }
+        }
+    });
 }
 
 function sendMessage(message) {
+    if (socket != null) {
+        socket.send(JSON.stringify({
+            message: message
+        }));
+        return;
+    }
+
     $.ajax({
         url: '/messages',
         method: 'POST',
         data: JSON.stringify({
-            username: username,
             message: message
         }),
         contentType: 'application/json; charset=UTF-8',
-        success: function () {
-            clearTimeout(timer);
-            loadMessages(false)();
+        error: function (xhr) {
+            if (xhr.status == 401) {
+                openSession(username, function () {
+                    sendMessage(message);
+                });
+            }
         }
     });
 }
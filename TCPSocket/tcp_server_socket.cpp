@@ -2,8 +2,10 @@
 
 const size_t TcpServerSocket::READ_BUFFER_SIZE = 4096;
 const size_t TcpServerSocket::WRITE_BUFFER_SIZE = 4096;
+const size_t TcpServerSocket::MAX_WRITE_PARTS = 8;
 
-TcpServerSocket::TcpServerSocket(int fd, const std::string& host, uint16_t port, Poller& poller): TcpSocket(fd, host, port, poller) {
+TcpServerSocket::TcpServerSocket(int fd, const std::string& host, uint16_t port, Poller& poller):
+        TcpSocket(fd, host, port, poller), outOffset(0), closing(false) {
     try {
         poller.setHandler(fd, [this](const epoll_event& event) {
             eventHandler(event);
@@ -48,21 +50,14 @@ void TcpServerSocket::eventHandler(const epoll_event& event) {
 
     if (event.events & EPOLLOUT) {
         try {
-            char buf[WRITE_BUFFER_SIZE];
-            size_t amount = std::min(outBuffer.size(), WRITE_BUFFER_SIZE);
-            std::copy(outBuffer.begin(), outBuffer.begin() + amount, buf);
-            ssize_t writtenCount;
-
-            while (!outBuffer.empty() && (writtenCount = send(fd, buf, amount, MSG_DONTWAIT)) > 0) {
-                outBuffer.erase(outBuffer.begin(), outBuffer.begin() + writtenCount);
-                amount = std::min(outBuffer.size(), WRITE_BUFFER_SIZE);
-                std::copy(outBuffer.begin(), outBuffer.begin() + amount, buf);
-            }
-
-            if (writtenCount == -1 && errno != EAGAIN && errno != EWOULDBLOCK) {
+            if (!sendOutput()) {
                 close();
                 return;
             } else if (outBuffer.empty()) {
+                if (closing) {
+                    close();
+                    return;
+                }
                 poller.setEvents(fd, EPOLLIN);
             }
         } catch (const std::exception& exception) {
@@ -74,9 +69,36 @@ void TcpServerSocket::eventHandler(const epoll_event& event) {
     }
 }
 
+bool TcpServerSocket::sendOutput() {
+    while (outOffset < outBuffer.size()) {
+        ssize_t writtenCount = send(fd, outBuffer.data() + outOffset, outBuffer.size() - outOffset,
+                                    MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (writtenCount > 0) {
+            outOffset += writtenCount;
+        } else if (writtenCount == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            break;
+        } else if (writtenCount == -1 && errno != EINTR) {
+            return false;
+        }
+    }
+
+    if (outOffset == outBuffer.size()) {
+        outBuffer.clear();
+        outOffset = 0;
+    } else if (outOffset >= WRITE_BUFFER_SIZE && outOffset * 2 >= outBuffer.size()) {
+        outBuffer.erase(0, outOffset);
+        outOffset = 0;
+    }
+    return true;
+}
+
 void TcpServerSocket::setReceivedDataHandler(SocketReceivedDataHandler socketReceivedDataHandler) {
     receivedDataHandler = socketReceivedDataHandler;
-    if (socketReceivedDataHandler && !inBuffer.empty()) {
+    processReceivedData();
+}
+
+void TcpServerSocket::processReceivedData() {
+    if (receivedDataHandler && !inBuffer.empty()) {
         try {
             receivedDataHandler(inBuffer);
         } catch (const std::exception& exception) {
@@ -92,16 +114,87 @@ void TcpServerSocket::setClosedHandler(SocketClosedHandler socketClosedHandler)
 }
 
 void TcpServerSocket::write(const std::string& data) {
+    write(data.data(), data.size());
+}
+
+void TcpServerSocket::write(const char* data, size_t size) {
+    iovec part = {const_cast<char*>(data), size};
+    write(&part, 1);
+}
+
+void TcpServerSocket::write(const iovec* parts, size_t count) {
+    if (fd == NONE) {
+        return;
+    }
+
     bool wasEmpty = outBuffer.empty();
-    outBuffer.insert(outBuffer.end(), data.begin(), data.end());
+    bool sent = wasEmpty && count <= MAX_WRITE_PARTS;
+    if (sent) {
+        iovec unsent[MAX_WRITE_PARTS];
+        std::copy(parts, parts + count, unsent);
+
+        msghdr message = {};
+        message.msg_iov = unsent;
+        message.msg_iovlen = count;
+        while (message.msg_iovlen > 0) {
+            ssize_t writtenCount = sendmsg(fd, &message, MSG_DONTWAIT | MSG_NOSIGNAL);
+            if (writtenCount > 0) {
+                while (message.msg_iovlen > 0 && (size_t) writtenCount >= message.msg_iov->iov_len) {
+                    writtenCount -= message.msg_iov->iov_len;
+                    ++message.msg_iov;
+                    --message.msg_iovlen;
+                }
+                if (writtenCount > 0) {
+                    message.msg_iov->iov_base = (char*) message.msg_iov->iov_base + writtenCount;
+                    message.msg_iov->iov_len -= writtenCount;
+                }
+            } else if (writtenCount == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                break;
+            } else if (writtenCount == -1 && errno != EINTR) {
+                close();
+                return;
+            }
+        }
+        parts = message.msg_iov;
+        count = message.msg_iovlen;
+        if (count == 0) {
+            return;
+        }
+    }
+
+    for (size_t i = 0; i < count; ++i) {
+        outBuffer.append((const char*) parts[i].iov_base, parts[i].iov_len);
+    }
     if (wasEmpty) {
-        try {
-            poller.setEvents(fd, EPOLLIN | EPOLLOUT);
-        } catch (const std::exception& exception) {
+        if (!sent && !sendOutput()) {
             close();
-            throw OwnException("Exception while writing to buffer of socket (fd " + std::to_string(fd) + "), closing socket: "
-                  + exception.what());
+            return;
         }
+
+        if (!outBuffer.empty()) {
+            try {
+                poller.setEvents(fd, EPOLLIN | EPOLLOUT);
+            } catch (const std::exception& exception) {
+                close();
+                throw OwnException("Exception while writing to buffer of socket (fd " + std::to_string(fd)
+                                   + "), closing socket: " + exception.what());
+            }
+        }
+    }
+}
+
+std::deque<char>& TcpServerSocket::getInputBuffer() {
+    return inBuffer;
+}
+
+size_t TcpServerSocket::getOutputSize() const {
+    return outBuffer.size() - outOffset;
+}
+
+void TcpServerSocket::closeAfterWrite() {
+    closing = true;
+    if (outBuffer.empty()) {
+        close();
     }
 }
 
@@ -5,6 +5,7 @@
 #include <deque>
 
 #include <sys/socket.h>
+#include <sys/uio.h>
 
 #include "tcp_socket.h"
 
@@ -13,21 +14,33 @@ typedef std::function<void()> SocketClosedHandler;
 
 class TcpServerSocket: public TcpSocket {
     std::deque<char> inBuffer;
-    std::deque<char> outBuffer;
+    std::string outBuffer;
+    size_t outOffset;
     SocketReceivedDataHandler receivedDataHandler;
     SocketClosedHandler closedHandler;
+    bool closing;
 
     void eventHandler(const epoll_event&);
+    bool sendOutput();
 public:
     static const size_t READ_BUFFER_SIZE;
     static const size_t WRITE_BUFFER_SIZE;
+    static const size_t MAX_WRITE_PARTS;
 
     TcpServerSocket(int, const std::string&, uint16_t, Poller&);
     virtual ~TcpServerSocket();
 
     void setReceivedDataHandler(SocketReceivedDataHandler);
     void setClosedHandler(SocketClosedHandler);
+    void processReceivedData();
+    std::deque<char>& getInputBuffer();
     void write(const std::string&);
+    void write(const char*, size_t);
+    // Writes the parts in order with one system call when nothing is queued; only what the socket doesn't take
+    // at once is copied into the output buffer
+    void write(const iovec*, size_t);
+    size_t getOutputSize() const;
+    void closeAfterWrite();
 
     virtual void close();
 };
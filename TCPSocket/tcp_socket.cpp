@@ -32,3 +32,7 @@ void TcpSocket::close() {
 bool TcpSocket::isOpened() const {
     return fd != NONE;
 }
+
+const std::string& TcpSocket::getHost() const {
+    return host;
+}
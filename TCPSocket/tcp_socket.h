@@ -22,6 +22,8 @@ public:
     virtual void close();
 
     bool isOpened() const;
+    // The numeric address of the peer
+    const std::string& getHost() const;
 };
 
 
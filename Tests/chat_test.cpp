@@ -0,0 +1,98 @@
+// Requests against a ChatServer running on this thread, made from another one: a room named by the route can't be
+// swapped for another one through the query, for reading any more than for posting
+
+#include <iostream>
+#include <string>
+#include <thread>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <signal.h>
+#include <sys/socket.h>
+
+#include "ChatServer/chat_server.h"
+
+static const uint16_t PORT = 3335;
+
+// Sends the request with "Connection: close" and returns the whole response, or an empty string
+static std::string request(const std::string& method, const std::string& uri, const std::string& body = "") {
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(PORT);
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (fd == -1 || connect(fd, (sockaddr*) &address, sizeof address) == -1) {
+        std::cerr << "Couldn't connect to port " << PORT << ": " << strerror(errno) << std::endl;
+        if (fd != -1) {
+            close(fd);
+        }
+        return "";
+    }
+
+    std::string data = method + " " + uri + " HTTP/1.1\r\nHost: localhost\r\nConnection: close\r\nContent-Length: "
+                       + std::to_string(body.size()) + "\r\n\r\n" + body;
+    std::string response;
+    if (send(fd, data.data(), data.size(), MSG_NOSIGNAL) == (ssize_t) data.size()) {
+        char buffer[4096];
+        ssize_t received;
+        while ((received = read(fd, buffer, sizeof buffer)) > 0) {
+            response.append(buffer, (size_t) received);
+        }
+    }
+    close(fd);
+    return response;
+}
+
+static bool expect(const std::string& method, const std::string& uri, const std::string& body, int status,
+                   const std::string& contained, bool contains) {
+    std::string response = request(method, uri, body);
+    bool passed = response.compare(0, 12, "HTTP/1.1 " + std::to_string(status)) == 0
+                  && (response.find(contained) != std::string::npos) == contains;
+    if (!passed) {
+        std::cerr << method << " " << uri << ": expected " << status << (contains ? " with " : " without ")
+                  << "\"" << contained << "\", got:\n" << response << std::endl;
+    }
+    return passed;
+}
+
+static bool run() {
+    bool passed = true;
+    passed &= expect("POST", "/rooms/a/login", "{\"username\": \"user\"}", 200, "", true);
+    passed &= expect("POST", "/rooms/b/login", "{\"username\": \"user\"}", 200, "", true);
+    passed &= expect("POST", "/rooms/a/messages?room=b", "{\"username\": \"user\", \"message\": \"into a\"}", 200,
+                     "", true);
+
+    // The route names the room; the query doesn't override it
+    passed &= expect("GET", "/rooms/a/messages?username=user&all=true&room=b", "", 200, "into a", true);
+    passed &= expect("GET", "/rooms/b/messages?username=user&all=true&room=a", "", 200, "into a", false);
+    passed &= expect("HEAD", "/rooms/b/messages?username=user&room=a", "", 200, "", true);
+    passed &= expect("GET", "/rooms/c/messages?username=user&room=a", "", 404, "", true);
+    // The unprefixed routes stay the default room's, which the user never joined
+    passed &= expect("GET", "/messages?username=user&all=true&room=a", "", 200, "into a", false);
+    return passed;
+}
+
+int main() {
+    try {
+        ChatServer::Settings settings;
+        for (size_t route = 0; route < ChatServer::LIMITED_ROUTE_COUNT; ++route) {
+            settings.sessionLimits[route] = RateLimiter();
+            settings.addressLimits[route] = RateLimiter();
+        }
+        Poller poller;
+        ChatServer server(PORT, poller, "", settings);
+
+        // The poller blocked the signal for every thread, so it's taken from its signal fd and ends the polling
+        bool passed = false;
+        std::thread client([&passed]() {
+            passed = run();
+            kill(getpid(), SIGTERM);
+        });
+        poller.poll();
+        client.join();
+        return passed ? 0 : 1;
+    } catch (const std::exception& exception) {
+        std::cerr << "Exception: " << exception.what() << std::endl;
+        return 1;
+    }
+}
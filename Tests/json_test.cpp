@@ -0,0 +1,57 @@
+// Parsing of nested JSON: as deep as allowed it parses, deeper it fails cleanly instead of running out of stack
+
+#include <iostream>
+#include <string>
+
+#include "../ChatServer/json.h"
+
+static bool nested(char open, char close, size_t depth, bool expected) {
+    std::string data;
+    for (size_t i = 0; i < depth; ++i) {
+        data += open;
+        if (open == '{') {
+            data += "\"a\":";
+        }
+    }
+    data += "1";
+    data += std::string(depth, close);
+
+    JSON result;
+    JSON::ParseError error;
+    bool parsed = JSON::parseJSON(data, result, error);
+    if (parsed != expected) {
+        std::cerr << depth << " levels of " << open << close << (parsed ? " parsed" : " didn't parse: ")
+                  << (parsed ? "" : error.describe(data)) << std::endl;
+        return false;
+    }
+    return true;
+}
+
+static bool unfinished(size_t depth) {
+    // What a flood looks like: only the opening brackets, up to the size of a request body
+    std::string data(depth, '[');
+    JSON result;
+    JSON::ParseError error;
+    if (JSON::parseJSON(data, result, error)) {
+        std::cerr << depth << " unclosed brackets parsed" << std::endl;
+        return false;
+    } else if (error.position != JSON::MAX_DEPTH) {
+        std::cerr << depth << " unclosed brackets failed at " << error.position << ": " << error.reason << std::endl;
+        return false;
+    }
+    return true;
+}
+
+int main() {
+    bool passed = true;
+    for (char open : {'[', '{'}) {
+        char close = (open == '[') ? ']' : '}';
+        passed &= nested(open, close, 1, true);
+        passed &= nested(open, close, JSON::MAX_DEPTH, true);
+        passed &= nested(open, close, JSON::MAX_DEPTH + 1, false);
+        passed &= nested(open, close, 100000, false);
+    }
+    passed &= unfinished(1 << 20);
+    passed &= unfinished(16 << 20);
+    return passed ? 0 : 1;
+}
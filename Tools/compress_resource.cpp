@@ -0,0 +1,209 @@
+// Writes a gzip or brotli compressed copy of a file, or the header with the table of all embedded resources;
+// the build uses it to embed precompressed resources
+
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <iterator>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <brotli/encode.h>
+#include <zlib.h>
+
+#include "../resource_hash.h"
+
+static bool readFile(const std::string& path, std::string& content) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in) {
+        std::cerr << "Couldn't read " << path << std::endl;
+        return false;
+    }
+    content.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    return true;
+}
+
+static bool gzip(const std::string& input, std::vector<unsigned char>& output) {
+    z_stream stream = {};
+    if (deflateInit2(&stream, Z_BEST_COMPRESSION, Z_DEFLATED, 15 + 16, 9, Z_DEFAULT_STRATEGY) != Z_OK) {
+        return false;
+    }
+
+    output.resize(deflateBound(&stream, input.size()));
+    stream.next_in = (Bytef*) input.data();
+    stream.avail_in = (uInt) input.size();
+    stream.next_out = output.data();
+    stream.avail_out = (uInt) output.size();
+    int result = deflate(&stream, Z_FINISH);
+    output.resize(stream.total_out);
+    deflateEnd(&stream);
+    return result == Z_STREAM_END;
+}
+
+static bool brotli(const std::string& input, std::vector<unsigned char>& output) {
+    size_t size = BrotliEncoderMaxCompressedSize(input.size());
+    output.resize(size != 0 ? size : input.size() + 1024);
+    if (!BrotliEncoderCompress(BROTLI_MAX_QUALITY, BROTLI_DEFAULT_WINDOW, BROTLI_MODE_GENERIC, input.size(),
+                               (const uint8_t*) input.data(), &size, output.data())) {
+        return false;
+    }
+    output.resize(size);
+    return true;
+}
+
+// Finds a basis and displacements that put every name into a slot of its own; false if the basis doesn't work
+static bool findPerfectHash(const std::vector<std::string>& names, uint64_t basis, std::vector<uint32_t>& displacements,
+                            std::vector<size_t>& slots) {
+    size_t size = names.size();
+    std::vector<std::vector<size_t>> buckets(size);
+    for (size_t i = 0; i < size; ++i) {
+        buckets[ResourceHash::bucket(ResourceHash::fnv1a(names[i], basis), size)].push_back(i);
+    }
+    std::vector<size_t> order(size);
+    for (size_t i = 0; i < size; ++i) {
+        order[i] = i;
+    }
+    std::stable_sort(order.begin(), order.end(), [&buckets](size_t a, size_t b) {
+        return buckets[a].size() > buckets[b].size();
+    });
+
+    displacements.assign(size, 0);
+    slots.assign(size, size);
+    std::vector<bool> taken(size, false);
+    for (size_t bucket : order) {
+        if (buckets[bucket].empty()) {
+            break;
+        }
+
+        bool placed = false;
+        for (uint32_t displacement = 0; displacement < size * size && !placed; ++displacement) {
+            std::vector<size_t> candidate;
+            for (size_t name : buckets[bucket]) {
+                size_t slot = ResourceHash::slot(ResourceHash::fnv1a(names[name], basis), displacement, size);
+                if (taken[slot] || std::find(candidate.begin(), candidate.end(), slot) != candidate.end()) {
+                    break;
+                }
+                candidate.push_back(slot);
+            }
+            if (candidate.size() == buckets[bucket].size()) {
+                for (size_t i = 0; i < candidate.size(); ++i) {
+                    taken[candidate[i]] = true;
+                    slots[buckets[bucket][i]] = candidate[i];
+                }
+                displacements[bucket] = displacement;
+                placed = true;
+            }
+        }
+        if (!placed) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// ld names the symbols of an embedded file after its name, with everything but letters and digits replaced by '_'
+static std::string symbolName(const std::string& filename) {
+    std::string result = "_binary_" + filename;
+    for (size_t i = 8; i < result.size(); ++i) {
+        if (!isalnum((unsigned char) result[i])) {
+            result[i] = '_';
+        }
+    }
+    return result;
+}
+
+static int writeTable(const std::string& output, const std::string& sourceDirectory,
+                      const std::string& compressedDirectory, const std::vector<std::string>& names) {
+    static const char* const SUFFIXES[] = {"", ".gz", ".br"};
+
+    std::vector<std::vector<size_t>> sizes(names.size());
+    std::vector<uint64_t> hashes(names.size());
+    for (size_t i = 0; i < names.size(); ++i) {
+        for (const char* suffix : SUFFIXES) {
+            std::string content;
+            if (!readFile((*suffix == '\0' ? sourceDirectory : compressedDirectory) + "/" + names[i] + suffix,
+                          content)) {
+                return 1;
+            }
+            if (*suffix == '\0') {
+                hashes[i] = ResourceHash::fnv1a(content);
+            }
+            sizes[i].push_back(content.size());
+        }
+    }
+
+    uint64_t basis = ResourceHash::FNV_OFFSET_BASIS;
+    std::vector<uint32_t> displacements;
+    std::vector<size_t> slots;
+    while (!findPerfectHash(names, basis, displacements, slots)) {
+        ++basis;
+    }
+    std::vector<size_t> bySlot(names.size());
+    for (size_t i = 0; i < names.size(); ++i) {
+        bySlot[slots[i]] = i;
+    }
+
+    std::ostringstream out;
+    out << "// Generated by compress_resource from RESOURCE_FILES in CMakeLists.txt; don't edit\n\n"
+        << "#ifndef HTTPWEBCHAT_RESOURCETABLE_H\n#define HTTPWEBCHAT_RESOURCETABLE_H\n\n\n"
+        << "#include \"resource.h\"\n\n";
+    for (const std::string& name : names) {
+        out << "extern const char ";
+        for (const char* suffix : SUFFIXES) {
+            out << symbolName(name + suffix) << "_start[]" << (*suffix == '.' && suffix[1] == 'b' ? ";\n" : ", ");
+        }
+    }
+
+    out << "\nnamespace ResourceTable {\n"
+        << "    const uint64_t BASIS = 0x" << std::hex << basis << std::dec << "ULL;\n"
+        << "    const size_t SIZE = " << names.size() << ";\n\n"
+        << "    constexpr uint32_t DISPLACEMENTS[SIZE] = {";
+    for (size_t i = 0; i < displacements.size(); ++i) {
+        out << (i != 0 ? ", " : "") << displacements[i];
+    }
+    out << "};\n\n    constexpr Resource::Embedded ENTRIES[SIZE] = {\n";
+    for (size_t i : bySlot) {
+        const std::string& name = names[i];
+        out << "        {\"" << name << "\", Http::contentTypeByExtension(\"" << name << "\"),\n         {";
+        for (const char* suffix : SUFFIXES) {
+            out << symbolName(name + suffix) << "_start" << (*suffix == '.' && suffix[1] == 'b' ? "}, {" : ", ");
+        }
+        out << sizes[i][0] << ", " << sizes[i][1] << ", " << sizes[i][2] << "}, 0x"
+            << std::hex << std::setw(16) << std::setfill('0') << hashes[i] << std::dec << "ULL},\n";
+    }
+    out << "    };\n}\n\n\n#endif //HTTPWEBCHAT_RESOURCETABLE_H\n";
+
+    std::ofstream file(output, std::ios::binary);
+    file << out.str();
+    return file ? 0 : 1;
+}
+
+int main(int argc, char** argv) {
+    if (argc >= 6 && std::string(argv[1]) == "table") {
+        return writeTable(argv[2], argv[3], argv[4], std::vector<std::string>(argv + 5, argv + argc));
+    }
+    if (argc != 4) {
+        std::cerr << "Usage: " << argv[0] << " gzip|br <input> <output>" << std::endl
+                  << "       " << argv[0] << " table <output> <source directory> <compressed directory> <file>..."
+                  << std::endl;
+        return 1;
+    }
+
+    std::string input;
+    if (!readFile(argv[2], input)) {
+        return 1;
+    }
+
+    std::vector<unsigned char> output;
+    std::string method = argv[1];
+    if (!((method == "gzip") ? gzip(input, output) : (method == "br") ? brotli(input, output) : false)) {
+        std::cerr << "Couldn't compress " << argv[2] << " with " << method << std::endl;
+        return 1;
+    }
+
+    std::ofstream out(argv[3], std::ios::binary);
+    out.write((const char*) output.data(), output.size());
+    return out ? 0 : 1;
+}
@@ -0,0 +1,165 @@
+// Measures how fast the server answers requests it rejects: unknown files (404), invalid JSON payloads (400)
+// and malformed requests (400, after which the connection is closed). Requests are pipelined over a few
+// connections, which are opened again whenever the server closes them
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+static const size_t PIPELINE_DEPTH = 16;
+// In milliseconds; a server waiting for more of a request it misread never answers
+static const int STALL_TIMEOUT = 5000;
+static const std::string STATUS_LINE = "HTTP/1.1 ";
+
+struct Connection {
+    int fd = -1;
+    // Sent and not answered yet
+    size_t inFlight = 0;
+    std::string output;
+    // The end of what was read, in case a status line is split between reads
+    std::string tail;
+};
+
+static bool makeRequest(const std::string& kind, std::string& request) {
+    if (kind == "not-found") {
+        request = "GET /no-such-file HTTP/1.1\r\nHost: localhost\r\n\r\n";
+    } else if (kind == "bad-json") {
+        // Long enough for building error messages out of the whole body to show
+        std::string body = "{\"username\": \"" + std::string(2000, 'x') + "\", }";
+        request = "POST /login HTTP/1.1\r\nHost: localhost\r\nContent-Length: " + std::to_string(body.size())
+                  + "\r\n\r\n" + body;
+    } else if (kind == "bad-request") {
+        request = "POST /messages HTTP/1.1\r\nHost: localhost\r\nContent-Length: 12x\r\n\r\n";
+    } else {
+        return false;
+    }
+    return true;
+}
+
+static bool connectTo(uint16_t port, Connection& connection) {
+    connection.fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (connection.fd == -1 || connect(connection.fd, (sockaddr*) &address, sizeof address) == -1) {
+        std::cerr << "Couldn't connect to port " << port << ": " << strerror(errno) << std::endl;
+        return false;
+    }
+    connection.inFlight = 0;
+    connection.output.clear();
+    connection.tail.clear();
+    return true;
+}
+
+static size_t countResponses(Connection& connection, const char* data, size_t size) {
+    std::string text = connection.tail;
+    text.append(data, size);
+    size_t count = 0;
+    for (size_t position = text.find(STATUS_LINE); position != std::string::npos;
+         position = text.find(STATUS_LINE, position + STATUS_LINE.size())) {
+        ++count;
+    }
+    size_t keep = std::min(text.size(), STATUS_LINE.size() - 1);
+    connection.tail.assign(text, text.size() - keep, keep);
+    return count;
+}
+
+int main(int argc, char** argv) {
+    if (argc < 2 || argc > 5) {
+        std::cerr << "Usage: " << argv[0] << " not-found|bad-json|bad-request [connections] [requests] [port]"
+                  << std::endl;
+        return 1;
+    }
+    std::string request;
+    if (!makeRequest(argv[1], request)) {
+        std::cerr << "Unknown request kind: " << argv[1] << std::endl;
+        return 1;
+    }
+    size_t connectionCount = (argc > 2) ? std::stoul(argv[2]) : 8;
+    size_t total = (argc > 3) ? std::stoul(argv[3]) : 100000;
+    uint16_t port = (uint16_t) ((argc > 4) ? std::stoul(argv[4]) : 3334);
+
+    std::vector<Connection> connections(connectionCount);
+    std::vector<pollfd> fds(connectionCount);
+    size_t sent = 0, answered = 0, opened = 0;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (Connection& connection : connections) {
+        if (!connectTo(port, connection)) {
+            return 1;
+        }
+        ++opened;
+    }
+
+    std::vector<char> buffer(1 << 16);
+    while (answered < total) {
+        for (size_t i = 0; i < connectionCount; ++i) {
+            Connection& connection = connections[i];
+            while (connection.inFlight < PIPELINE_DEPTH && sent < total) {
+                connection.output += request;
+                ++connection.inFlight;
+                ++sent;
+            }
+            fds[i].fd = connection.fd;
+            fds[i].events = POLLIN | (connection.output.empty() ? 0 : POLLOUT);
+        }
+        int ready = poll(fds.data(), fds.size(), STALL_TIMEOUT);
+        if (ready == -1) {
+            std::cerr << "Couldn't poll: " << strerror(errno) << std::endl;
+            return 1;
+        } else if (ready == 0) {
+            std::cerr << "No response for " << STALL_TIMEOUT / 1000 << " seconds after " << answered << std::endl;
+            return 1;
+        }
+
+        for (size_t i = 0; i < connectionCount; ++i) {
+            Connection& connection = connections[i];
+            if ((fds[i].revents & POLLOUT) && !connection.output.empty()) {
+                // A connection the server closed meanwhile fails here, and is opened again once that is read
+                ssize_t written = send(connection.fd, connection.output.data(), connection.output.size(),
+                                       MSG_NOSIGNAL);
+                if (written > 0) {
+                    connection.output.erase(0, (size_t) written);
+                }
+            }
+            if (!(fds[i].revents & (POLLIN | POLLHUP | POLLERR))) {
+                continue;
+            }
+
+            ssize_t received = read(connection.fd, buffer.data(), buffer.size());
+            if (received > 0) {
+                size_t count = countResponses(connection, buffer.data(), (size_t) received);
+                connection.inFlight -= std::min(count, connection.inFlight);
+                answered += count;
+                continue;
+            }
+
+            // Closed by the server: whatever it didn't answer is sent again on a new connection
+            close(connection.fd);
+            sent -= connection.inFlight;
+            if (answered < total) {
+                if (!connectTo(port, connection)) {
+                    return 1;
+                }
+                ++opened;
+            }
+        }
+    }
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << answered << " responses in " << seconds << " s: " << (size_t) (answered / seconds)
+              << " per second over " << opened << " connections" << std::endl;
+    for (Connection& connection : connections) {
+        close(connection.fd);
+    }
+    return 0;
+}
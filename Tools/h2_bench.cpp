@@ -0,0 +1,317 @@
+// Load test of one GET route over HTTP/1.1 keep-alive against h2c with prior knowledge. Every connection keeps
+// the same number of requests in flight: pipelined over HTTP/1.1, as concurrent streams over h2c. Connections
+// the server closes, as HTTP/1.1 ones are after maxRequestsPerConnection, are opened again; what they didn't
+// answer is sent once more. Reports responses per second, bytes received per response and the status codes
+
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "../HTTP/hpack.h"
+
+// In milliseconds
+static const int STALL_TIMEOUT = 5000;
+static const std::string PREFACE = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+static const size_t FRAME_HEADER_SIZE = 9;
+static const uint32_t MAX_WINDOW = 0x7fffffff;
+enum FrameType {DATA, HEADERS, PRIORITY, RST_STREAM, SETTINGS, PUSH_PROMISE, PING, GOAWAY, WINDOW_UPDATE,
+                CONTINUATION};
+enum FrameFlag {END_STREAM = 0x1, ACK = 0x1, END_HEADERS = 0x4, PADDED = 0x8, PRIORITY_FLAG = 0x20};
+
+struct Connection {
+    int fd = -1;
+    size_t inFlight = 0;
+    std::string output;
+    std::string input;
+    // h2c only
+    std::unique_ptr<HpackEncoder> encoder;
+    std::unique_ptr<HpackDecoder> decoder;
+    uint32_t nextStream = 1;
+    // The header block of a HEADERS frame continued in CONTINUATION frames
+    std::string headerBlock;
+    bool headerBlockEnds = false;
+    // DATA received since the last connection WINDOW_UPDATE
+    uint64_t consumed = 0;
+};
+
+struct Totals {
+    size_t answered = 0;
+    uint64_t bytes = 0;
+    std::map<int, size_t> statuses;
+};
+
+static void appendUint(std::string& output, uint64_t value, int size) {
+    for (int i = size - 1; i >= 0; --i) {
+        output += (char) (value >> (i * 8));
+    }
+}
+
+static uint64_t readUint(const char* data, int size) {
+    uint64_t value = 0;
+    for (int i = 0; i < size; ++i) {
+        value = (value << 8) | (uint8_t) data[i];
+    }
+    return value;
+}
+
+static void appendFrame(std::string& output, FrameType type, uint8_t flags, uint32_t stream,
+                        const std::string& payload) {
+    appendUint(output, payload.size(), 3);
+    appendUint(output, type, 1);
+    appendUint(output, flags, 1);
+    appendUint(output, stream, 4);
+    output += payload;
+}
+
+static bool connectTo(uint16_t port, bool http2, Connection& connection) {
+    connection.fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (connection.fd == -1 || connect(connection.fd, (sockaddr*) &address, sizeof address) == -1) {
+        std::cerr << "Couldn't connect to port " << port << ": " << strerror(errno) << std::endl;
+        return false;
+    }
+    connection.inFlight = 0;
+    connection.output.clear();
+    connection.input.clear();
+    if (http2) {
+        connection.encoder.reset(new HpackEncoder());
+        connection.decoder.reset(new HpackDecoder());
+        connection.nextStream = 1;
+        connection.headerBlock.clear();
+        connection.consumed = 0;
+
+        // Streams get the largest window, and the connection one is topped up as DATA arrives
+        std::string settings;
+        appendUint(settings, 2, 2);
+        appendUint(settings, 0, 4);
+        appendUint(settings, 4, 2);
+        appendUint(settings, MAX_WINDOW, 4);
+        std::string increment;
+        appendUint(increment, MAX_WINDOW - 65535, 4);
+        connection.output = PREFACE;
+        appendFrame(connection.output, SETTINGS, 0, 0, settings);
+        appendFrame(connection.output, WINDOW_UPDATE, 0, 0, increment);
+    }
+    return true;
+}
+
+static void appendRequest(Connection& connection, bool http2, const std::string& path) {
+    if (!http2) {
+        connection.output += "GET " + path + " HTTP/1.1\r\nHost: localhost\r\n\r\n";
+        return;
+    }
+    Http::HeaderList fields = {{":method", "GET"}, {":scheme", "http"}, {":path", path},
+                               {":authority", "localhost"}};
+    std::string block;
+    connection.encoder->encode(fields, block);
+    appendFrame(connection.output, HEADERS, END_STREAM | END_HEADERS, connection.nextStream, block);
+    connection.nextStream += 2;
+}
+
+// Takes the responses out of the input; false when the connection can't go on
+static bool readHttp1(Connection& connection, Totals& totals) {
+    while (true) {
+        size_t end = connection.input.find("\r\n\r\n");
+        if (end == std::string::npos) {
+            return true;
+        }
+        std::string head = connection.input.substr(0, end + 2);
+        if (head.compare(0, 9, "HTTP/1.1 ") != 0 || head.size() < 12) {
+            std::cerr << "Not an HTTP/1.1 response: " << head.substr(0, 40) << std::endl;
+            return false;
+        }
+
+        size_t length = 0;
+        for (size_t line = head.find("\r\n") + 2; line < head.size(); line = head.find("\r\n", line) + 2) {
+            if (strncasecmp(head.data() + line, "Content-Length:", 15) == 0) {
+                length = std::stoul(head.substr(line + 15));
+            } else if (strncasecmp(head.data() + line, "Transfer-Encoding:", 18) == 0) {
+                std::cerr << "Chunked responses aren't supported" << std::endl;
+                return false;
+            }
+        }
+        if (connection.input.size() < end + 4 + length) {
+            return true;
+        }
+        connection.input.erase(0, end + 4 + length);
+        ++totals.statuses[std::stoi(head.substr(9, 3))];
+        ++totals.answered;
+        --connection.inFlight;
+    }
+}
+
+static bool readHttp2(Connection& connection, Totals& totals) {
+    size_t position = 0;
+    const std::string& input = connection.input;
+    while (input.size() - position >= FRAME_HEADER_SIZE) {
+        const char* header = input.data() + position;
+        size_t length = readUint(header, 3);
+        if (input.size() - position - FRAME_HEADER_SIZE < length) {
+            break;
+        }
+        uint8_t type = (uint8_t) header[3], flags = (uint8_t) header[4];
+        uint32_t stream = (uint32_t) readUint(header + 5, 4) & MAX_WINDOW;
+        std::string payload = input.substr(position + FRAME_HEADER_SIZE, length);
+        position += FRAME_HEADER_SIZE + length;
+
+        bool ended = false;
+        if (type == DATA) {
+            connection.consumed += length;
+            if (connection.consumed >= MAX_WINDOW / 2) {
+                std::string increment;
+                appendUint(increment, connection.consumed, 4);
+                appendFrame(connection.output, WINDOW_UPDATE, 0, 0, increment);
+                connection.consumed = 0;
+            }
+            ended = (flags & END_STREAM) != 0;
+        } else if (type == HEADERS || type == CONTINUATION) {
+            if (type == HEADERS) {
+                size_t skip = ((flags & PADDED) ? 1 : 0) + ((flags & PRIORITY_FLAG) ? 5 : 0);
+                size_t padding = (flags & PADDED) ? (uint8_t) payload[0] : 0;
+                connection.headerBlock = payload.substr(skip, payload.size() - skip - padding);
+                connection.headerBlockEnds = (flags & END_STREAM) != 0;
+            } else {
+                connection.headerBlock += payload;
+            }
+            if (flags & END_HEADERS) {
+                Http::HeaderList fields;
+                connection.decoder->decode(connection.headerBlock.data(), connection.headerBlock.size(), fields,
+                                           (size_t) -1);
+                for (const Http::HeaderField& field : fields) {
+                    if (field.first == ":status") {
+                        ++totals.statuses[std::stoi(field.second)];
+                    }
+                }
+                ended = connection.headerBlockEnds;
+            }
+        } else if (type == RST_STREAM) {
+            std::cerr << "Stream " << stream << " reset with error " << readUint(payload.data(), 4) << std::endl;
+            ended = true;
+        } else if (type == SETTINGS && !(flags & ACK)) {
+            appendFrame(connection.output, SETTINGS, ACK, 0, "");
+        } else if (type == PING && !(flags & ACK)) {
+            appendFrame(connection.output, PING, ACK, 0, payload);
+        } else if (type == GOAWAY) {
+            std::cerr << "GOAWAY with error " << readUint(payload.data() + 4, 4) << std::endl;
+            return false;
+        }
+        if (ended && stream != 0) {
+            ++totals.answered;
+            --connection.inFlight;
+        }
+    }
+    connection.input.erase(0, position);
+    return true;
+}
+
+int main(int argc, char** argv) {
+    if (argc < 3 || argc > 7) {
+        std::cerr << "Usage: " << argv[0] << " http1|h2c path [connections] [requests] [in flight] [port]"
+                  << std::endl;
+        return 1;
+    }
+    std::string protocol = argv[1], path = argv[2];
+    if (protocol != "http1" && protocol != "h2c") {
+        std::cerr << "Unknown protocol: " << protocol << std::endl;
+        return 1;
+    }
+    bool http2 = protocol == "h2c";
+    size_t connectionCount = (argc > 3) ? std::stoul(argv[3]) : 24;
+    size_t total = (argc > 4) ? std::stoul(argv[4]) : 200000;
+    size_t depth = (argc > 5) ? std::stoul(argv[5]) : 16;
+    uint16_t port = (uint16_t) ((argc > 6) ? std::stoul(argv[6]) : 3334);
+
+    std::vector<Connection> connections(connectionCount);
+    std::vector<pollfd> fds(connectionCount);
+    size_t sent = 0, opened = 0;
+    Totals totals;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (Connection& connection : connections) {
+        if (!connectTo(port, http2, connection)) {
+            return 1;
+        }
+        ++opened;
+    }
+
+    std::vector<char> buffer(1 << 16);
+    while (totals.answered < total) {
+        for (size_t i = 0; i < connectionCount; ++i) {
+            Connection& connection = connections[i];
+            while (connection.inFlight < depth && sent < total) {
+                appendRequest(connection, http2, path);
+                ++connection.inFlight;
+                ++sent;
+            }
+            fds[i].fd = connection.fd;
+            fds[i].events = POLLIN | (connection.output.empty() ? 0 : POLLOUT);
+        }
+        int ready = poll(fds.data(), fds.size(), STALL_TIMEOUT);
+        if (ready == -1) {
+            std::cerr << "Couldn't poll: " << strerror(errno) << std::endl;
+            return 1;
+        } else if (ready == 0) {
+            std::cerr << "No response for " << STALL_TIMEOUT / 1000 << " seconds after " << totals.answered
+                      << std::endl;
+            return 1;
+        }
+
+        for (size_t i = 0; i < connectionCount; ++i) {
+            Connection& connection = connections[i];
+            if ((fds[i].revents & POLLOUT) && !connection.output.empty()) {
+                ssize_t written = send(connection.fd, connection.output.data(), connection.output.size(),
+                                       MSG_NOSIGNAL);
+                if (written > 0) {
+                    connection.output.erase(0, (size_t) written);
+                }
+            }
+            if (!(fds[i].revents & (POLLIN | POLLHUP | POLLERR))) {
+                continue;
+            }
+
+            ssize_t received = read(connection.fd, buffer.data(), buffer.size());
+            if (received > 0) {
+                totals.bytes += (size_t) received;
+                connection.input.append(buffer.data(), (size_t) received);
+                if (http2 ? readHttp2(connection, totals) : readHttp1(connection, totals)) {
+                    continue;
+                }
+                return 1;
+            }
+
+            close(connection.fd);
+            sent -= connection.inFlight;
+            if (totals.answered < total) {
+                if (!connectTo(port, http2, connection)) {
+                    return 1;
+                }
+                ++opened;
+            }
+        }
+    }
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << protocol << " " << path << ": " << totals.answered << " responses in " << seconds << " s, "
+              << (size_t) (totals.answered / seconds) << " per second, " << totals.bytes / totals.answered
+              << " bytes received per response, over " << opened << " connections; statuses";
+    for (std::map<int, size_t>::const_iterator it = totals.statuses.begin(); it != totals.statuses.end(); ++it) {
+        std::cout << " " << it->first << ": " << it->second;
+    }
+    std::cout << std::endl;
+    for (Connection& connection : connections) {
+        close(connection.fd);
+    }
+    return 0;
+}
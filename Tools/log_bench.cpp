@@ -0,0 +1,102 @@
+// Measures the message log: how many appends a second become durable with a given number of them waiting at
+// once, the way posts wait for their sync, and then how long opening the resulting file takes, which is the
+// recovery at startup. Messages go round-robin to the rooms, and every room keeps its latest ones, so the log
+// gets compacted along the way as it would under the server
+
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <signal.h>
+#include <unistd.h>
+
+#include "../ChatServer/message_log.h"
+
+int main(int argc, char** argv) {
+    if (argc < 2 || argc > 7) {
+        std::cerr << "Usage: " << argv[0] << " log-file [messages] [waiting] [rooms] [kept per room] [message size]"
+                  << std::endl;
+        return 1;
+    }
+    std::string path = argv[1];
+    uint64_t total = (argc > 2) ? std::stoull(argv[2]) : 200000;
+    uint64_t window = (argc > 3) ? std::stoull(argv[3]) : 256;
+    uint64_t roomCount = (argc > 4) ? std::stoull(argv[4]) : 10;
+    uint64_t kept = (argc > 5) ? std::stoull(argv[5]) : 10000;
+    size_t messageSize = (argc > 6) ? std::stoul(argv[6]) : 100;
+    if (access(path.c_str(), F_OK) == 0) {
+        std::cerr << "\"" << path << "\" exists already; the benchmark starts from an empty log" << std::endl;
+        return 1;
+    }
+
+    try {
+        // Shaped like the JSON of a message, which is what the server appends
+        std::string text(messageSize, 'x');
+        std::string data = "{\"from\": \"benchmark\", \"id\": 0, \"text\": \"" + text + "\", \"time\": 1792414688}";
+        std::vector<std::string> rooms;
+        for (uint64_t i = 0; i < roomCount; ++i) {
+            rooms.push_back("room-" + std::to_string(i));
+        }
+
+        Poller poller;
+        uint64_t appended = 0, synced = 0;
+        std::unique_ptr<MessageLog> log;
+        // Keeps the window full: every append which becomes durable lets another one in
+        auto appendMore = [&]() {
+            for (; appended < total && appended - synced < window; ++appended) {
+                uint64_t message = appended - roomCount;
+                uint64_t id = message / roomCount + 1;
+                log->append(MessageLog::MESSAGE, rooms[message % roomCount], id, data,
+                            (id >= kept) ? id - kept + 1 : 0);
+            }
+        };
+        log.reset(new MessageLog(path, poller, [](MessageLog::RecordType, const std::string&, uint64_t,
+                                                  const char*, size_t) {},
+                                 [&](uint64_t sequence) {
+            synced = sequence;
+            if (log->hasFailed()) {
+                std::cerr << "Writing the log failed after " << synced << " appends" << std::endl;
+                raise(SIGTERM);
+            } else if (synced == total) {
+                raise(SIGTERM);
+            } else {
+                appendMore();
+            }
+        }));
+        for (uint64_t i = 0; i < roomCount; ++i) {
+            log->append(MessageLog::JOIN, rooms[i], 0, "benchmark", 0);
+        }
+        // The joins count as appends as well, and take the id 0 of every room
+        appended = roomCount;
+        total += roomCount;
+
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        appendMore();
+        poller.poll();
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        log.reset();
+        if (synced != total) {
+            return 1;
+        }
+        std::cout << total - roomCount << " appends of " << data.size() << " bytes with " << window
+                  << " waiting in " << seconds << " s: " << (uint64_t) ((total - roomCount) / seconds)
+                  << " durable appends per second" << std::endl;
+
+        uint64_t records = 0, bytes = 0;
+        start = std::chrono::steady_clock::now();
+        MessageLog recovered(path, poller, [&records, &bytes](MessageLog::RecordType, const std::string&, uint64_t,
+                                                              const char*, size_t size) {
+            ++records;
+            bytes += size;
+        }, [](uint64_t) {});
+        std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+        std::cout << "Recovered " << records << " records (" << bytes << " bytes of data) in " << elapsed.count()
+                  << " ms" << std::endl;
+        return 0;
+    } catch (const std::exception& exception) {
+        std::cerr << "Exception: " << exception.what() << std::endl;
+        return 1;
+    }
+}
@@ -0,0 +1,317 @@
+// Compares the lookup-table URI codec of Http with the switch-based one it replaced, which is kept below as it
+// was. Every input is encoded, decoded into a new string and decoded in place; the decoded inputs are what the
+// old encoder made of them, as the old decoder knew no other escapes
+
+#include <chrono>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "../HTTP/http_common.h"
+
+namespace Switch {
+    std::string uriEncode(const std::string& toEncode) {
+        std::string result = "";
+        for (std::string::const_iterator it = toEncode.begin(); it != toEncode.end(); ++it) {
+            switch (*it) {
+                case '\t': {
+                    result += "%09";
+                    break;
+                } case '\n': {
+                    result += "%0A";
+                    break;
+                } case '\r': {
+                    result += "%0D";
+                    break;
+                } case ' ': {
+                    result += "%20";
+                    break;
+                } case '!': {
+                    result += "%21";
+                    break;
+                } case '\"': {
+                    result += "%22";
+                    break;
+                } case '#': {
+                    result += "%23";
+                    break;
+                } case '$': {
+                    result += "%24";
+                    break;
+                } case '%': {
+                    result += "%25";
+                    break;
+                } case '&': {
+                    result += "%26";
+                    break;
+                } case '\'': {
+                    result += "%27";
+                    break;
+                } case '(': {
+                    result += "%28";
+                    break;
+                } case ')': {
+                    result += "%29";
+                    break;
+                } case '*': {
+                    result += "%2A";
+                    break;
+                } case '+': {
+                    result += "%2B";
+                    break;
+                } case ',': {
+                    result += "%2C";
+                    break;
+                } case '-': {
+                    result += "%2D";
+                    break;
+                } case '.': {
+                    result += "%2E";
+                    break;
+                } case '/': {
+                    result += "%2F";
+                    break;
+                } case ':': {
+                    result += "%3A";
+                    break;
+                } case ';': {
+                    result += "%3B";
+                    break;
+                } case '<': {
+                    result += "%3C";
+                    break;
+                } case '=': {
+                    result += "%3D";
+                    break;
+                } case '>': {
+                    result += "%3E";
+                    break;
+                } case '?': {
+                    result += "%3F";
+                    break;
+                } case '@': {
+                    result += "%40";
+                    break;
+                } case '[': {
+                    result += "%5B";
+                    break;
+                } case '\\': {
+                    result += "%5C";
+                    break;
+                } case ']': {
+                    result += "%5D";
+                    break;
+                } case '^': {
+                    result += "%5E";
+                    break;
+                } case '_': {
+                    result += "%5F";
+                    break;
+                } case '`': {
+                    result += "%60";
+                    break;
+                } case '{': {
+                    result += "%7B";
+                    break;
+                } case '|': {
+                    result += "%7C";
+                    break;
+                } case '}': {
+                    result += "%7D";
+                    break;
+                } case '~': {
+                    result += "%7E";
+                    break;
+                } default: {
+                    result += *it;
+                }
+            }
+        }
+        return result;
+    }
+
+    std::string uriDecode(const std::string& toDecode) {
+        std::string result = "";
+        size_t faps = 0;
+        for (size_t cur = 0; cur < toDecode.size(); ++cur) {
+            if (toDecode[cur] == '%') {
+                if (cur > toDecode.size() - 3) {
+                    throw OwnException("Invalid URL-encoded string (percent encoding near the end): " + toDecode);
+                }
+                if (faps < cur) {
+                    result += toDecode.substr(faps, cur - faps);
+                }
+
+                char fst = toDecode[cur + 1];
+                char snd = toDecode[cur + 2];
+                if (fst == '0' && snd == '9') {
+                    result += '\t';
+                } else if (fst == '0' && snd == 'A') {
+                    result += '\n';
+                } else if (fst == '0' && snd == 'D') {
+                    result += '\r';
+                } else if (fst == '2' && snd == '0') {
+                    result += ' ';
+                } else if (fst == '2' && snd == '1') {
+                    result += '!';
+                } else if (fst == '2' && snd == '2') {
+                    result += '\"';
+                } else if (fst == '2' && snd == '3') {
+                    result += '#';
+                } else if (fst == '2' && snd == '4') {
+                    result += '$';
+                } else if (fst == '2' && snd == '5') {
+                    result += '%';
+                } else if (fst == '2' && snd == '6') {
+                    result += '&';
+                } else if (fst == '2' && snd == '7') {
+                    result += '\'';
+                } else if (fst == '2' && snd == '8') {
+                    result += '(';
+                } else if (fst == '2' && snd == '9') {
+                    result += ')';
+                } else if (fst == '2' && snd == 'A') {
+                    result += '*';
+                } else if (fst == '2' && snd == 'B') {
+                    result += '+';
+                } else if (fst == '2' && snd == 'C') {
+                    result += ',';
+                } else if (fst == '2' && snd == 'D') {
+                    result += '-';
+                } else if (fst == '2' && snd == 'E') {
+                    result += '.';
+                } else if (fst == '2' && snd == 'F') {
+                    result += '/';
+                } else if (fst == '3' && snd == 'A') {
+                    result += ':';
+                } else if (fst == '3' && snd == 'B') {
+                    result += ';';
+                } else if (fst == '3' && snd == 'C') {
+                    result += '<';
+                } else if (fst == '3' && snd == 'D') {
+                    result += '=';
+                } else if (fst == '3' && snd == 'E') {
+                    result += '>';
+                } else if (fst == '3' && snd == 'F') {
+                    result += '?';
+                } else if (fst == '4' && snd == '0') {
+                    result += '@';
+                } else if (fst == '5' && snd == 'B') {
+                    result += '[';
+                } else if (fst == '5' && snd == 'C') {
+                    result += '\\';
+                } else if (fst == '5' && snd == 'D') {
+                    result += ']';
+                } else if (fst == '5' && snd == 'E') {
+                    result += '^';
+                } else if (fst == '5' && snd == 'F') {
+                    result += '_';
+                } else if (fst == '6' && snd == '0') {
+                    result += '`';
+                } else if (fst == '7' && snd == 'B') {
+                    result += '{';
+                } else if (fst == '7' && snd == 'C') {
+                    result += '|';
+                } else if (fst == '7' && snd == 'D') {
+                    result += '}';
+                } else if (fst == '7' && snd == 'E') {
+                    result += '~';
+                } else {
+                    throw OwnException("Invalid URL-encoded string (invalid percent encoding "
+                                             + toDecode.substr(cur, 3) + "): " + toDecode);
+                }
+                faps = cur + 3;
+            }
+        }
+        if (faps < toDecode.size()) {
+            result += toDecode.substr(faps, toDecode.size() - faps);
+        }
+
+        return result;
+    }
+}
+
+struct Input {
+    const char* name;
+    std::string text;
+};
+
+static std::vector<Input> makeInputs() {
+    std::vector<Input> inputs;
+    inputs.push_back(Input{"path", "/rooms/general-chat/messages"});
+    inputs.push_back(Input{"message", "Hi all! Is the 10:30 meeting still on? Room \"B\" (2nd floor) & tea."});
+    // Mostly plain, like a token or a long word-joined value: one space in 64 bytes
+    std::string plain;
+    while (plain.size() < 4096) {
+        plain += "TheQuickBrownFoxJumpsOverTheLazyDog-0123456789_abcdefghijklmnop ";
+    }
+    plain.resize(4096);
+    inputs.push_back(Input{"4 KiB value", plain});
+    std::string text;
+    while (text.size() < 4096) {
+        text += "The quick brown fox jumps over the lazy dog, again and again. ";
+    }
+    text.resize(4096);
+    inputs.push_back(Input{"4 KiB text", text});
+    std::string symbols;
+    while (symbols.size() < 256) {
+        symbols += "{\"a\": [1, 2], \"b\": \"c&d=e?f#g\"} ";
+    }
+    symbols.resize(256);
+    inputs.push_back(Input{"256 B of JSON", symbols});
+    return inputs;
+}
+
+// Runs the function until about a tenth of a second has passed; returns nanoseconds per call
+static double measure(const std::function<size_t()>& function) {
+    static volatile size_t sink;
+    size_t iterations = 0, batch = 64;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    std::chrono::duration<double, std::nano> elapsed(0);
+    while (elapsed < std::chrono::milliseconds(100)) {
+        for (size_t i = 0; i < batch; ++i) {
+            sink = sink + function();
+        }
+        iterations += batch;
+        batch *= 2;
+        elapsed = std::chrono::steady_clock::now() - start;
+    }
+    return elapsed.count() / iterations;
+}
+
+static void report(const char* name, const char* operation, double before, double after) {
+    std::cout << name << ", " << operation << ": " << before << " ns -> " << after << " ns ("
+              << before / after << "x)" << std::endl;
+}
+
+int main() {
+    for (const Input& input : makeInputs()) {
+        const std::string& text = input.text;
+        std::string encoded = Switch::uriEncode(text);
+        if (Switch::uriDecode(encoded) != text || Http::uriDecode(encoded) != text
+            || Http::uriDecode(Http::uriEncode(text)) != text) {
+            std::cerr << input.name << ": the codecs don't agree" << std::endl;
+            return 1;
+        }
+
+        report(input.name, "encode", measure([&text]() {
+            return Switch::uriEncode(text).size();
+        }), measure([&text]() {
+            return Http::uriEncode(text).size();
+        }));
+        double before = measure([&encoded]() {
+            return Switch::uriDecode(encoded).size();
+        });
+        report(input.name, "decode", before, measure([&encoded]() {
+            return Http::uriDecode(encoded).size();
+        }));
+        // The copy is part of the cost, as a query parameter is copied out of the URI before it's decoded
+        report(input.name, "decode in place", before, measure([&encoded]() {
+            std::string copy = encoded;
+            Http::uriDecodeInPlace(copy);
+            return copy.size();
+        }));
+    }
+    return 0;
+}
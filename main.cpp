@@ -4,10 +4,29 @@ using namespace std;
 
 const uint16_t PORT = 3334;
 
-int main(int, char**) {
+int main(int argc, char** argv) {
+    ChatServer::Settings settings;
+    string resourcePath;
+    for (int i = 1; i < argc; ++i) {
+        if (string(argv[i]) == "--log" && i + 1 < argc) {
+            settings.logPath = argv[++i];
+        } else if (string(argv[i]) == "--no-rate-limits") {
+            // For load tests, which make more requests from one address than any client should
+            for (size_t route = 0; route < ChatServer::LIMITED_ROUTE_COUNT; ++route) {
+                settings.sessionLimits[route] = RateLimiter();
+                settings.addressLimits[route] = RateLimiter();
+            }
+        } else if (resourcePath.empty() && argv[i][0] != '-') {
+            resourcePath = argv[i];
+        } else {
+            cerr << "Usage: " << argv[0] << " [--log message log file] [--no-rate-limits] [resource directory]" << endl;
+            return 1;
+        }
+    }
+
     try {
         Poller poller;
-        ChatServer server(PORT, poller);
+        ChatServer server(PORT, poller, resourcePath, settings);
         cout << "Server started on port " << PORT << endl;
         poller.poll();
         return 0;
@@ -88,7 +88,11 @@ void Poller::poll() {
         int n = epoll_wait(efd, events, MAX_EVENTS, -1);
         for (int i = 0; i < n; ++i) {
             if (events[i].data.fd != sfd) {
-                handlers[events[i].data.fd](events[i]);
+                // A handler earlier in the batch may have removed this one
+                std::map<int, EventHandler>::iterator handler = handlers.find(events[i].data.fd);
+                if (handler != handlers.end()) {
+                    handler->second(events[i]);
+                }
             } else {
                 return;
             }
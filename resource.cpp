@@ -1,23 +1,188 @@
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "HTTP/compressor.h"
 #include "resource.h"
+#include "resource_hash.h"
+#include "resource_table.h"
+
+namespace {
+    std::string hashToString(uint64_t hash) {
+        static const char digits[] = "0123456789abcdef";
+
+        std::string result(16, '0');
+        for (size_t i = 16; i-- > 0; hash >>= 4) {
+            result[i] = digits[hash & 0xf];
+        }
+        return result;
+    }
+
+    time_t executableTime() {
+        static const time_t time = []() {
+            struct stat status;
+            if (stat("/proc/self/exe", &status) == 0) {
+                return status.st_mtime;
+            }
+            return ::time(NULL);
+        }();
+        return time;
+    }
+
+    struct MappedFile {
+        void* address;
+        size_t size;
+        std::string gzip;
+
+        MappedFile(): address(MAP_FAILED), size(0) {}
+
+        ~MappedFile() {
+            if (address != MAP_FAILED) {
+                munmap(address, size);
+            }
+        }
+    };
+}
+
+Resource::Resource(const char* const* data, const size_t* size, Http::ContentType contentType, uint64_t hash,
+                   time_t lastModified): _contentType(contentType), _lastModified(lastModified) {
+    std::copy(data, data + ENCODING_COUNT, _data);
+    std::copy(size, size + ENCODING_COUNT, _size);
+
+    // The encodings have the same content, but as different representations they need different tags
+    std::string hashString = hashToString(hash);
+    _etag[IDENTITY] = "\"" + hashString + "\"";
+    _etag[GZIP] = "\"" + hashString + "-gz\"";
+    _etag[BROTLI] = "\"" + hashString + "-br\"";
+    _lastModifiedString = Http::formatDate(_lastModified);
+}
+
+Resource::Resource(const Embedded& embedded):
+        Resource(embedded.data, embedded.size, embedded.contentType, embedded.hash, executableTime()) {}
+
+Resource Resource::fromFile(const std::string& path) {
+    int fd = _m1_system_call(open(path.c_str(), O_RDONLY | O_CLOEXEC), "Couldn't open \"" + path + "\"");
+    std::shared_ptr<MappedFile> file = std::make_shared<MappedFile>();
+    struct stat status;
+    if (fstat(fd, &status) == -1 || !S_ISREG(status.st_mode)) {
+        ::close(fd);
+        throw OwnException("\"" + path + "\" isn't a readable file");
+    }
 
-std::map<std::string, Resource> Resource::_resources = {{"index.html", LOAD_RESOURCE(index_html)},
-                                                        {"chat.css", LOAD_RESOURCE(chat_css)},
-                                                        {"favicon.ico", LOAD_RESOURCE(favicon_ico)},
-                                                        {"green_light.png", LOAD_RESOURCE(green_light_png)},
-                                                        {"red_light.png", LOAD_RESOURCE(red_light_png)},
-                                                        {"chat.js", LOAD_RESOURCE(chat_js)},
-                                                        {"jquery.js", LOAD_RESOURCE(jquery_js)}};
+    // A file changed in place while mapped shows the new content, or faults if it shrinks, so files should be
+    // replaced by renaming a new version over them
+    file->size = status.st_size;
+    if (file->size != 0) {
+        file->address = mmap(NULL, file->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    ::close(fd);
+    if (file->size != 0 && file->address == MAP_FAILED) {
+        throw OwnException("Couldn't map \"" + path + "\" - " + strerror(errno));
+    }
 
-Resource::Resource(const char* begin, const char* end): _data(begin), _size(end - begin) {}
+    const char* begin = (file->size != 0) ? (const char*) file->address : "";
+    Http::ContentType contentType = Http::contentTypeByExtension(path);
+    if (Http::isCompressible(contentType)) {
+        Compressor::forThread(Compressor::GZIP, 9).compress(begin, file->size, file->gzip, true);
+    }
+
+    // Missing encodings are the original itself, which hasEncoding rules out
+    const char* data[ENCODING_COUNT] = {begin, file->gzip.empty() ? begin : file->gzip.data(), begin};
+    size_t size[ENCODING_COUNT] = {file->size, file->gzip.empty() ? file->size : file->gzip.size(), file->size};
+    Resource result(data, size, contentType, ResourceHash::fnv1a(begin, file->size), status.st_mtime);
+    result._owner = file;
+    return result;
+}
 
 const char* const& Resource::data() const {
-    return _data;
+    return _data[IDENTITY];
 }
 
 const size_t& Resource::size() const {
-    return _size;
+    return _size[IDENTITY];
+}
+
+const char* Resource::data(Encoding encoding) const {
+    return _data[encoding];
+}
+
+size_t Resource::size(Encoding encoding) const {
+    return _size[encoding];
+}
+
+Http::ContentType Resource::contentType() const {
+    return _contentType;
+}
+
+bool Resource::hasEncoding(Encoding encoding) const {
+    // Already compressed files (images) don't get smaller, and their variants aren't worth sending
+    return encoding == IDENTITY || _size[encoding] < _size[IDENTITY];
+}
+
+Resource::Encoding Resource::chooseEncoding(const std::string& acceptEncoding) const {
+    Encoding result = IDENTITY;
+    double bestQuality = 0;
+    for (Encoding encoding : {BROTLI, GZIP}) {
+        if (hasEncoding(encoding)) {
+            double quality = Http::encodingQuality(acceptEncoding, encodingToString(encoding));
+            if (quality > bestQuality) {
+                result = encoding;
+                bestQuality = quality;
+            }
+        }
+    }
+    return result;
+}
+
+const std::string& Resource::etag(Encoding encoding) const {
+    return _etag[encoding];
+}
+
+const std::string& Resource::cacheControl() const {
+    return _cacheControl;
+}
+
+time_t Resource::lastModified() const {
+    return _lastModified;
+}
+
+const std::string& Resource::lastModifiedString() const {
+    return _lastModifiedString;
+}
+
+const std::shared_ptr<const void>& Resource::owner() const {
+    return _owner;
+}
+
+void Resource::setCacheControl(const std::string& policy) {
+    _cacheControl = policy;
+}
+
+const Resource::Embedded* Resource::findEmbedded(std::string_view name) {
+    uint64_t hash = ResourceHash::fnv1a(name, ResourceTable::BASIS);
+    size_t bucket = ResourceHash::bucket(hash, ResourceTable::SIZE);
+    const Embedded& embedded = ResourceTable::ENTRIES[ResourceHash::slot(hash, ResourceTable::DISPLACEMENTS[bucket],
+                                                                         ResourceTable::SIZE)];
+    return (name == embedded.name) ? &embedded : NULL;
+}
+
+size_t Resource::getEmbeddedCount() {
+    return ResourceTable::SIZE;
+}
+
+const Resource::Embedded& Resource::getEmbedded(size_t index) {
+    return ResourceTable::ENTRIES[index];
 }
 
-const Resource& Resource::getResource(const std::string& name) {
-    return _resources.at(name);
+const char* Resource::encodingToString(Encoding encoding) {
+    switch (encoding) {
+        case GZIP:
+            return "gzip";
+        case BROTLI:
+            return "br";
+        default:
+            return "identity";
+    }
 }
@@ -2,26 +2,68 @@
 #define HTTPWEBCHAT_RESOURCE_H
 
 
-#include <map>
+#include <memory>
+#include <string>
+
+#include "HTTP/http_common.h"
 
 class Resource {
-    const char* _data;
-    size_t _size;
+public:
+    // Encodings are embedded next to the original by the build; see RESOURCE_FILES in CMakeLists.txt.
+    // Resources loaded from files only get gzip, compressed when they're loaded
+    enum Encoding {IDENTITY, GZIP, BROTLI};
+    static const size_t ENCODING_COUNT = BROTLI + 1;
+
+    // An entry of the table the build generates over RESOURCE_FILES (see Tools/compress_resource.cpp), with
+    // everything known about an embedded file at compile time
+    struct Embedded {
+        const char* name;
+        Http::ContentType contentType;
+        const char* data[ENCODING_COUNT];
+        size_t size[ENCODING_COUNT];
+        uint64_t hash;
+    };
+private:
+    const char* _data[ENCODING_COUNT];
+    size_t _size[ENCODING_COUNT];
+    Http::ContentType _contentType;
+    // Strong validators of every encoding, derived from a hash of the original content
+    std::string _etag[ENCODING_COUNT];
+    // Empty until it's set; the server picks a default then
+    std::string _cacheControl;
+    time_t _lastModified;
+    std::string _lastModifiedString;
+    // Keeps the data of a resource loaded from a file alive while any copy of the resource exists
+    std::shared_ptr<const void> _owner;
 
-    static std::map<std::string, Resource> _resources;
+    Resource(const char* const*, const size_t*, Http::ContentType, uint64_t, time_t);
 public:
-    Resource(const char*, const char*);
+    Resource(const Embedded&);
 
     const char* const& data() const;
     const size_t& size() const;
+    const char* data(Encoding) const;
+    size_t size(Encoding) const;
+    Http::ContentType contentType() const;
+    bool hasEncoding(Encoding) const;
+    Encoding chooseEncoding(const std::string&) const;
+    const std::string& etag(Encoding) const;
+    const std::string& cacheControl() const;
+    // Embedded resources are as old as the executable, loaded ones as their file
+    time_t lastModified() const;
+    const std::string& lastModifiedString() const;
+    const std::shared_ptr<const void>& owner() const;
+    void setCacheControl(const std::string&);
 
-    static const Resource& getResource(const std::string& name);
-};
+    // Maps the file into memory; throws OwnException if it can't be read
+    static Resource fromFile(const std::string& path);
 
-#define LOAD_RESOURCE(x) ([]() {\
-    extern const char _binary_##x##_start, _binary_##x##_end;\
-    return Resource(&_binary_##x##_start, &_binary_##x##_end);\
-}())
+    // One hash of the name and one comparison; NULL if there's no such embedded file
+    static const Embedded* findEmbedded(std::string_view name);
+    static size_t getEmbeddedCount();
+    static const Embedded& getEmbedded(size_t);
+    static const char* encodingToString(Encoding);
+};
 
 
 #endif //HTTPWEBCHAT_RESOURCE_H
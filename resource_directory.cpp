@@ -0,0 +1,224 @@
+#include <dirent.h>
+#include <poll.h>
+
+#include <sys/inotify.h>
+#include <sys/stat.h>
+
+#include "resource_directory.h"
+
+namespace {
+    const uint32_t WATCHED_EVENTS = IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_CREATE | IN_DELETE | IN_ONLYDIR;
+
+    std::string join(const std::string& directory, const std::string& name) {
+        return directory.empty() ? name : directory + "/" + name;
+    }
+
+    // Editors' swap and backup files
+    bool isIgnored(const std::string& name) {
+        return name.empty() || name[0] == '.' || name.back() == '~';
+    }
+
+    void notify(int fd) {
+        uint64_t value = 1;
+        _m1_system_call(write(fd, &value, sizeof value), "Couldn't signal an event fd");
+    }
+}
+
+ResourceDirectory::ResourceDirectory(const std::string& root, Poller& poller, const ChangeHandler& changeHandler):
+        root(root), poller(poller), changeHandler(changeHandler), ifd(-1), changesFd(-1), stopFd(-1) {
+    while (this->root.size() > 1 && this->root.back() == '/') {
+        this->root.pop_back();
+    }
+
+    try {
+        ifd = _m1_system_call(inotify_init1(IN_NONBLOCK | IN_CLOEXEC), "Couldn't create an inotify fd");
+        changesFd = _m1_system_call(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC), "Couldn't create an event fd");
+        stopFd = _m1_system_call(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC), "Couldn't create an event fd");
+
+        scan("");
+        applyChanges();
+
+        poller.setHandler(changesFd, [this](const epoll_event&) {
+            uint64_t value;
+            if (read(changesFd, &value, sizeof value) == -1 && errno != EAGAIN) {
+                std::cerr << "Couldn't read event fd (fd " << changesFd << "): " << strerror(errno) << std::endl;
+            }
+            applyChanges();
+        }, EPOLLIN);
+    } catch (const std::exception& exception) {
+        for (int fd : {ifd, changesFd, stopFd}) {
+            if (fd != -1) {
+                close(fd);
+            }
+        }
+        throw;
+    }
+
+    worker = std::thread(&ResourceDirectory::run, this);
+}
+
+ResourceDirectory::~ResourceDirectory() {
+    try {
+        notify(stopFd);
+        worker.join();
+        poller.removeHandler(changesFd);
+    } catch (const std::exception& exception) {
+        std::cerr << "Exception while stopping the resource directory watcher: " << exception.what() << std::endl;
+    }
+    close(ifd);
+    close(changesFd);
+    close(stopFd);
+}
+
+void ResourceDirectory::scan(const std::string& directory) {
+    // The watch goes first, so files created while the directory is read aren't missed
+    std::string path = join(root, directory);
+    int wd = _m1_system_call(inotify_add_watch(ifd, path.c_str(), WATCHED_EVENTS),
+                             "Couldn't watch \"" + path + "\"");
+    watches[wd] = directory;
+
+    DIR* dir = _uwv_system_call(opendir(path.c_str()), (DIR*) NULL, "Couldn't open \"" + path + "\"");
+    std::vector<std::string> names;
+    while (dirent* entry = readdir(dir)) {
+        if (!isIgnored(entry->d_name)) {
+            names.push_back(entry->d_name);
+        }
+    }
+    closedir(dir);
+
+    for (const std::string& entry : names) {
+        std::string name = join(directory, entry);
+        struct stat status;
+        if (stat(join(root, name).c_str(), &status) == -1) {
+            continue;
+        } else if (S_ISDIR(status.st_mode)) {
+            scan(name);
+        } else if (S_ISREG(status.st_mode)) {
+            load(name);
+        }
+    }
+}
+
+void ResourceDirectory::load(const std::string& name) {
+    try {
+        std::unique_ptr<Resource> resource(new Resource(Resource::fromFile(join(root, name))));
+        files.insert(name);
+
+        std::lock_guard<std::mutex> lock(mutex);
+        changes.push_back(Change{name, std::move(resource)});
+    } catch (const std::exception& exception) {
+        std::cerr << "Couldn't load resource \"" << name << "\": " << exception.what() << std::endl;
+        return;
+    }
+    notify(changesFd);
+}
+
+void ResourceDirectory::remove(const std::string& name) {
+    // A removed directory takes every file below it away
+    std::string prefix = name + "/";
+    std::vector<std::string> removed;
+    for (std::set<std::string>::iterator it = files.lower_bound(name);
+         it != files.end() && (*it == name || it->compare(0, prefix.size(), prefix) == 0);) {
+        removed.push_back(*it);
+        files.erase(it++);
+    }
+    if (removed.empty()) {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (const std::string& file : removed) {
+            changes.push_back(Change{file, nullptr});
+        }
+    }
+    notify(changesFd);
+}
+
+void ResourceDirectory::processEvents() {
+    alignas(inotify_event) char buffer[4096];
+
+    // One save usually comes as several events, so a batch reloads a file once, after its last event
+    std::map<std::string, bool> updated;
+    ssize_t readCount;
+    while ((readCount = read(ifd, buffer, sizeof buffer)) > 0) {
+        for (char* it = buffer; it < buffer + readCount;) {
+            const inotify_event* event = (const inotify_event*) it;
+            it += sizeof(inotify_event) + event->len;
+
+            if (event->mask & IN_Q_OVERFLOW) {
+                std::cerr << "Resource directory events were lost, rescanning it" << std::endl;
+                scan("");
+                continue;
+            }
+            std::unordered_map<int, std::string>::iterator watch = watches.find(event->wd);
+            if (watch == watches.end()) {
+                continue;
+            } else if (event->mask & IN_IGNORED) {
+                watches.erase(watch);
+                continue;
+            }
+
+            std::string entry = (event->len != 0) ? event->name : "";
+            if (isIgnored(entry)) {
+                continue;
+            }
+            std::string name = join(watch->second, entry);
+            if (event->mask & IN_ISDIR) {
+                if (event->mask & (IN_CREATE | IN_MOVED_TO)) {
+                    scan(name);
+                } else if (event->mask & (IN_DELETE | IN_MOVED_FROM)) {
+                    remove(name);
+                }
+            } else if (event->mask & (IN_CLOSE_WRITE | IN_MOVED_TO)) {
+                updated[name] = true;
+            } else if (event->mask & (IN_DELETE | IN_MOVED_FROM)) {
+                updated[name] = false;
+            }
+        }
+    }
+    if (readCount == -1 && errno != EAGAIN && errno != EWOULDBLOCK) {
+        throw OwnException("Couldn't read inotify fd - " + std::string(strerror(errno)));
+    }
+
+    for (std::map<std::string, bool>::const_iterator it = updated.begin(); it != updated.end(); ++it) {
+        if (it->second) {
+            load(it->first);
+        } else {
+            remove(it->first);
+        }
+    }
+}
+
+void ResourceDirectory::applyChanges() {
+    std::vector<Change> applied;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        applied.swap(changes);
+    }
+
+    for (const Change& change : applied) {
+        changeHandler(change.name, change.resource.get());
+    }
+}
+
+void ResourceDirectory::run() {
+    pollfd fds[2] = {{ifd, POLLIN, 0}, {stopFd, POLLIN, 0}};
+    while (true) {
+        if (::poll(fds, 2, -1) == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            std::cerr << "Resource directory watcher stopped: " << strerror(errno) << std::endl;
+            return;
+        } else if (fds[1].revents != 0) {
+            return;
+        }
+
+        try {
+            processEvents();
+        } catch (const std::exception& exception) {
+            std::cerr << "Exception while reloading resources: " << exception.what() << std::endl;
+        }
+    }
+}
@@ -0,0 +1,60 @@
+#ifndef HTTPWEBCHAT_RESOURCEDIRECTORY_H
+#define HTTPWEBCHAT_RESOURCEDIRECTORY_H
+
+
+#include <functional>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "poller.h"
+#include "resource.h"
+
+// Serves a directory tree instead of the embedded resources. Every file is loaded as a Resource at startup; then a
+// worker thread watches the tree with inotify and reloads changed files, handing them over to the event loop, so
+// a reload never blocks it. Names are paths relative to the root, like "js/chat.js".
+class ResourceDirectory {
+public:
+    // Gets the new version of a changed file, or NULL when it's removed; always called on the poller's thread
+    typedef std::function<void(const std::string&, const Resource*)> ChangeHandler;
+private:
+    struct Change {
+        std::string name;
+        std::unique_ptr<Resource> resource;
+    };
+
+    std::string root;
+    Poller& poller;
+    ChangeHandler changeHandler;
+    int ifd;
+    // Wakes the event loop up when there are changes, and the worker when it should stop
+    int changesFd;
+    int stopFd;
+
+    // Owned by the worker after the startup
+    std::unordered_map<int, std::string> watches;
+    std::set<std::string> files;
+
+    std::mutex mutex;
+    std::vector<Change> changes;
+
+    std::thread worker;
+
+    void scan(const std::string&);
+    void load(const std::string&);
+    void remove(const std::string&);
+    void processEvents();
+    void applyChanges();
+    void run();
+public:
+    ResourceDirectory(const std::string&, Poller&, const ChangeHandler&);
+    ~ResourceDirectory();
+
+    ResourceDirectory(const ResourceDirectory&) = delete;
+    ResourceDirectory& operator=(const ResourceDirectory&) = delete;
+};
+
+
+#endif //HTTPWEBCHAT_RESOURCEDIRECTORY_H
@@ -0,0 +1,41 @@
+#ifndef HTTPWEBCHAT_RESOURCEHASH_H
+#define HTTPWEBCHAT_RESOURCEHASH_H
+
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+// Shared by the resource table generator (Tools/compress_resource.cpp) and Resource, so the two agree on ETags
+// and on where every name lands in the table
+namespace ResourceHash {
+    const uint64_t FNV_OFFSET_BASIS = 0xcbf29ce484222325ULL;
+
+    // 64-bit FNV-1a; the table is searched with different bases until one gives a perfect hash
+    constexpr uint64_t fnv1a(const char* data, size_t size, uint64_t basis = FNV_OFFSET_BASIS) {
+        uint64_t hash = basis;
+        for (size_t i = 0; i < size; ++i) {
+            hash = (hash ^ static_cast<unsigned char>(data[i])) * 0x100000001b3ULL;
+        }
+        return hash;
+    }
+
+    constexpr uint64_t fnv1a(std::string_view data, uint64_t basis = FNV_OFFSET_BASIS) {
+        return fnv1a(data.data(), data.size(), basis);
+    }
+
+    // A name first picks a bucket, whose displacement then moves it to a slot of its own (hash, displace and
+    // compress); a displacement d0 * size + d1 can reach every slot from any name
+    constexpr size_t bucket(uint64_t hash, size_t size) {
+        return hash % size;
+    }
+
+    constexpr size_t slot(uint64_t hash, uint32_t displacement, size_t size) {
+        uint64_t first = (hash >> 21) % size;
+        uint64_t step = (hash >> 42) % size + 1;
+        return (first + (displacement / size) * step + displacement % size) % size;
+    }
+}
+
+
+#endif //HTTPWEBCHAT_RESOURCEHASH_H